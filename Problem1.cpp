@@ -2,15 +2,82 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <shared_mutex>
 #include <chrono>
 #include <cstdlib>
 #include <ctime>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 using namespace std;
 
 #define maxEvents 200
 #define maxUsers 200
 #define maxTickets 200
+#define maxPurchaseRetries 8
+#define removalBatch 4096       //tickets scanned per ticketMtx acquisition when cancelling a removed event
+#define counterShards 16        //per-thread shards of the sales counters, folded on read
+#define counterBlock 1024       //event slots per lazily allocated counter block
+#define maxCounterBlocks 4096
+#define exportBatch 8192        //tickets copied per ticketMtx acquisition by a ledger export writer
+#define maxFrameBytes 65536     //largest request frame the request server accepts
+#define maxReplyBacklog (1 << 20)   //unsent reply bytes after which the request server stops reading a connection
+#define arenaBytes 4096         //inline buffer of each worker's request arena
+#define maxTraceThreads 4096    //most streams a trace file may declare, guards against corrupt headers
+
+//build with -DcountHeapAllocations to count every global operator new, so the allocation benchmark can
+//report heap allocations per operation; left out by default because the counter is an atomic RMW on
+//every allocation in the program
+#ifdef countHeapAllocations
+std::atomic<long> heapAllocations{0};
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+//kept out of line so the compiler does not pair an inlined free() with a new-expression and warn
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    free(p);
+}
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+#endif
 
 //struct
 struct Event
@@ -19,6 +86,10 @@ struct Event
     string eventName;
     string eventDate;
     bool isActive = false;
+    bool isClosing = false;         //removal in progress, tickets are being canceled in the background
+    unsigned long version = 0;      //assigned on every add/update, never reused
+    int capacity = maxTickets;      //tickets that can be on sale at once
+    int salesSlot = -1;             //index into the live sales counters, assigned when the event is added
 };
 
 struct User 
@@ -29,55 +100,165 @@ struct User
     bool isLoggedin = false;
 };
 
+//ticket records keep their strings in the owning ticketManagement's pool, see commitTicket
 struct Ticket 
 {
-    string ticketID;    
-    string eventID, eventName, eventDate;
-    string userID, userName;
+    pmr::string ticketID;    
+    pmr::string eventID, eventName, eventDate;
+    pmr::string userID, userName;
+    unsigned long eventVersion = 0; //version of the event the ticket was issued against
+    int salesSlot = -1;
+    unsigned long soldSeq = 0;      //ledger sequence of the purchase
+    unsigned long canceledSeq = 0;  //ledger sequence of the cancellation, 0 while active
     bool isCanceled = false;
+    
+    Ticket() = default;
+    explicit Ticket(pmr::memory_resource* pool) : ticketID(pool), eventID(pool), eventName(pool), eventDate(pool), userID(pool), userName(pool) {}
+};
+
+//request-scoped copy of an Event whose strings live in the calling worker's arena
+struct EventSnapshot
+{
+    pmr::string eventID, eventName, eventDate;
+    unsigned long version = 0;
+    int capacity = 0;
+    int salesSlot = -1;
+    
+    explicit EventSnapshot(pmr::memory_resource* arena) : eventID(arena), eventName(arena), eventDate(arena) {}
+};
+
+//Per-worker monotonic arena for data that dies with the request. Allocation is a pointer bump into
+//an inline buffer (spilling to the heap only for unusually large requests) and reset() frees it all.
+class requestArena
+{
+    private:
+        alignas(16) char buffer[arenaBytes];
+        pmr::monotonic_buffer_resource resource{buffer, sizeof(buffer)};
+    public:
+        static requestArena& local()
+        {
+            thread_local requestArena arena;
+            return arena;
+        }
+        pmr::memory_resource* get()
+        {
+            return &resource;
+        }
+        void reset()
+        {
+            resource.release();
+        }
+};
+
+struct EventSales
+{
+    long sold = 0;
+    long canceled = 0;
+    long remaining = 0;
+    double ratePerSec = 0;          //tickets sold per second since the first sale
 };
 
 //classes
 class eventManagement
 {
     private:
-        Event events[maxEvents];
+        vector<Event> events;
+        unordered_map<string, int> byID;    //eventID -> position in events
         int eventCount = 0;
+        int capacity;
+        unsigned long nextVersion = 1;
+        int nextSlot = 0;
+        bool verbose = true;
         mutable std::shared_mutex eventMtx;
+        
+        int findEvent(const string& id) const       //caller holds eventMtx
+        {
+            auto it = byID.find(id);
+            return it == byID.end() ? -1 : it->second;
+        }
     public:
+        eventManagement(int capacity = maxEvents) : capacity(capacity) {}
+        void setVerbose(bool v)
+        {
+            verbose = v;
+        }
         bool addEvent (const Event& newEvent)   //function to add an event
         {
             std::unique_lock<std::shared_mutex> lock(eventMtx);
             //prevention of duplicate event IDs
-            for (int i = 0; i < eventCount; ++i)
+            if (findEvent(newEvent.eventID) >= 0)
             {
-                if (events[i].eventID == newEvent.eventID)
-                {
-                    cout << "Error. Event ID is taken.\n";
-                    return false;
-                }
+                if (verbose) cout << "Error. Event ID is taken.\n";
+                return false;
             }
-            if (eventCount >= maxEvents)
+            if (eventCount >= capacity)
             {
                 return false;
             }
-            events[eventCount++] = newEvent;
-            cout << "Event has been added!\n";
+            events.push_back(newEvent);
+            events[eventCount].salesSlot = nextSlot++;
+            events[eventCount].version = nextVersion++;
+            byID[newEvent.eventID] = eventCount++;
+            if (verbose) cout << "Event has been added!\n";
             return true;
         }
+        //adds a whole batch under one lock acquisition. Duplicates are dropped first (IDs already in
+        //the store or earlier in the batch), so only rows that are really new count against capacity.
+        //Returns the rows added; the others are counted in duplicates and overCapacity.
+        int bulkAddEvents (vector<Event>& batch, long& duplicates, long& overCapacity)
+        {
+            std::unique_lock<std::shared_mutex> lock(eventMtx);
+            int before = eventCount;
+            size_t room = capacity > eventCount ? capacity - eventCount : 0;
+            events.reserve(events.size() + min(batch.size(), room));
+            byID.reserve(byID.size() + batch.size());
+            vector<string> rejected;        //new IDs that did not fit, held in byID until the batch is done
+            for (auto& e : batch)
+            {
+                if (!byID.emplace(e.eventID, eventCount).second)
+                {
+                    duplicates++;
+                    continue;
+                }
+                if (eventCount >= capacity)
+                {
+                    rejected.push_back(e.eventID);
+                    continue;
+                }
+                events.push_back(std::move(e));
+                events[eventCount].salesSlot = nextSlot++;
+                events[eventCount].version = nextVersion++;
+                eventCount++;
+            }
+            for (auto& id : rejected)
+            {
+                byID.erase(id);
+            }
+            overCapacity += rejected.size();
+            return eventCount - before;
+        }
         bool updateEvent (const Event& update)  //function to update event details
         {
             std::unique_lock<std::shared_mutex> lock(eventMtx);
-            for (int i = 0; i < eventCount; ++i)
+            int i = findEvent(update.eventID);
+            if (i >= 0)
             {
-                if (events[i].eventID == update.eventID)
+                if (events[i].isClosing)
                 {
-                    events[i] = update;
-                    cout << "Event has been updated.\n";
-                    return true;
+                    if (verbose) cout << "Update failed. The event is being removed.\n";
+                    return false;
                 }
+                //only the editable fields change: the sales slot stays, so tickets already sold keep
+                //counting against the new capacity instead of the counters starting over
+                events[i].eventName = update.eventName;
+                events[i].eventDate = update.eventDate;
+                events[i].isActive = update.isActive;
+                events[i].capacity = update.capacity;
+                events[i].version = nextVersion++;     //invalidates snapshots taken by in-flight purchases
+                if (verbose) cout << "Event has been updated.\n";
+                return true;
             }
-            cout << "Update failed. The event does not exist.\n";
+            if (verbose) cout << "Update failed. The event does not exist.\n";
             return false;
         }
         
@@ -95,7 +276,7 @@ class eventManagement
                 cout << "Event Name: " << events[i].eventName << "\n";
                 cout << "Event ID: " << events[i].eventID << "\n";
                 cout << "Date of Event: " << events[i].eventDate << "\n";
-                cout << "Status: " << (events[i].isActive ? "Active" : "Inactive") << endl;
+                cout << "Status: " << (events[i].isClosing ? "Closing" : events[i].isActive ? "Active" : "Inactive") << endl;
                 cout << "\n";
             }
         }
@@ -103,35 +284,84 @@ class eventManagement
         bool removeEvent (const string& eventId)    //function to remove an event from the list
         {
             std::unique_lock<std::shared_mutex> lock(eventMtx);
-            for (int i = 0; i < eventCount; ++i)
+            int i = findEvent(eventId);
+            if (i >= 0)
             {
-                if (events[i].eventID == eventId)
+                events.erase(events.begin() + i);
+                eventCount--;
+                byID.erase(eventId);
+                for (int j = i; j < eventCount; ++j)
                 {
-                    for (int j = i; j < eventCount - 1; ++j)
-                    {
-                        events[j] = events [j + 1];
-                    }
-                    eventCount--;
-                    cout << "Event has been removed.\n";
-                    return true;
+                    byID[events[j].eventID] = j;
                 }
+                if (verbose) cout << "Event has been removed.\n";
+                return true;
+            }
+            if (verbose) cout << "Couldn't find event.\n";
+            return false;
+        }
+        bool closeEvent (const string& eventId)     //first step of a removal: stops new sales right away
+        {
+            std::unique_lock<std::shared_mutex> lock(eventMtx);
+            int i = findEvent(eventId);
+            if (i >= 0 && !events[i].isClosing)
+            {
+                events[i].isActive = false;
+                events[i].isClosing = true;
+                events[i].version = nextVersion++;     //fails the validation of purchases already in flight
+                if (verbose) cout << "Event is closing. Its tickets are being canceled.\n";
+                return true;
+            }
+            if (verbose) cout << "Couldn't find event.\n";
+            return false;
+        }
+        bool getEventSnapshot(const string& id, EventSnapshot& result) const      //allocation-free copy into the caller's arena
+        {
+            std::shared_lock<std::shared_mutex> lock(eventMtx);
+            int i = findEvent(id);
+            if (i >= 0 && events[i].isActive)
+            {
+                result.eventID.assign(events[i].eventID);
+                result.eventName.assign(events[i].eventName);
+                result.eventDate.assign(events[i].eventDate);
+                result.version = events[i].version;
+                result.capacity = events[i].capacity;
+                result.salesSlot = events[i].salesSlot;
+                return true;
             }
-            cout << "Couldn't find event.\n";
             return false;
         }
         bool getEventbyID(const string& id, Event& result) const
         {
             std::shared_lock<std::shared_mutex> lock(eventMtx);
-            for (int i = 0; i < eventCount; ++i)
+            int i = findEvent(id);
+            if (i >= 0 && events[i].isActive)
             {
-                if (events[i].eventID == id && events[i].isActive)
-                {
-                    result = events[i];
-                    return true;
-                }
+                result = events[i];
+                return true;
             }
             return false;
         }
+        bool isCurrentVersion(const string& id, unsigned long version) const
+        {
+            std::shared_lock<std::shared_mutex> lock(eventMtx);
+            int i = findEvent(id);
+            return i >= 0 && events[i].isActive && events[i].version == version;
+        }
+        //validation step of the optimistic purchase: runs commit only if the event is still at version,
+        //and keeps the event at that version until commit returns
+        template <class Commit>
+        bool commitIfCurrent(const string& id, unsigned long version, Commit commit) const
+        {
+            std::shared_lock<std::shared_mutex> lock(eventMtx);
+            int i = findEvent(id);
+            if (i < 0 || !events[i].isActive || events[i].version != version)
+            {
+                return false;
+            }
+            commit();
+            return true;
+        }
         bool isEventLocked() const
         {
             return !eventMtx.try_lock_shared();     //checks if the readable lock is not available
@@ -143,6 +373,7 @@ class eventManagement
         
         Event getEventat(int index)
         {
+            std::shared_lock<std::shared_mutex> lock(eventMtx);
             if(index >= 0 && index < eventCount)
                 return events[index];
             else
@@ -153,69 +384,108 @@ class eventManagement
 class userManagement
 {
     private:
-        User users[maxUsers];
+        vector<User> users;
+        unordered_map<string, int> byID;    //userID -> position in users
         int userCount = 0;
+        int capacity;
+        bool verbose = true;
         mutable std::shared_mutex userMtx;
+        
+        int findUser(const string& id) const        //caller holds userMtx
+        {
+            auto it = byID.find(id);
+            return it == byID.end() ? -1 : it->second;
+        }
     public:
+        userManagement(int capacity = maxUsers) : capacity(capacity) {}
+        void setVerbose(bool v)
+        {
+            verbose = v;
+        }
         bool registerUser(const User& newUser)
         {
             std::unique_lock<std::shared_mutex> lock(userMtx);
-            for (int i = 0; i < userCount; ++i)
+            if (findUser(newUser.userID) >= 0)
             {
-                if(users[i].userID == newUser.userID)
-                {
-                    cout << "Error. User already exists.\n";
-                    return false;
-                }
+                if (verbose) cout << "Error. User already exists.\n";
+                return false;
             }
-            if (userCount >= maxUsers)
+            if (userCount >= capacity)
             {
                 return false;
             }
-            users[userCount++] = newUser;
-            cout << "User has been added.\n";
+            users.push_back(newUser);
+            byID[newUser.userID] = userCount++;
+            if (verbose) cout << "User has been added.\n";
             return true;
         }
+        //same as bulkAddEvents: duplicates are dropped before capacity is checked
+        int bulkRegisterUsers(vector<User>& batch, long& duplicates, long& overCapacity)
+        {
+            std::unique_lock<std::shared_mutex> lock(userMtx);
+            int before = userCount;
+            size_t room = capacity > userCount ? capacity - userCount : 0;
+            users.reserve(users.size() + min(batch.size(), room));
+            byID.reserve(byID.size() + batch.size());
+            vector<string> rejected;
+            for (auto& u : batch)
+            {
+                if (!byID.emplace(u.userID, userCount).second)
+                {
+                    duplicates++;
+                    continue;
+                }
+                if (userCount >= capacity)
+                {
+                    rejected.push_back(u.userID);
+                    continue;
+                }
+                users.push_back(std::move(u));
+                userCount++;
+            }
+            for (auto& id : rejected)
+            {
+                byID.erase(id);
+            }
+            overCapacity += rejected.size();
+            return userCount - before;
+        }
         
         bool loginUser(const string& userID, const string& pass)
         {
             std::unique_lock<std::shared_mutex> lock(userMtx);
-            for (int i = 0; i < userCount; ++i)
+            int i = findUser(userID);
+            if (i >= 0 && users[i].userPass == pass)
             {
-                if (users[i].userID == userID && users[i].userPass == pass)
+                if (users[i].isLoggedin)
                 {
-                    if (users[i].isLoggedin)
-                    {
-                        cout << "User is already logged in.\n";
-                        return false;
-                    }
-                    users[i].isLoggedin = true;
-                    cout << "Successfully logged in.\n";
-                    return true;
+                    if (verbose) cout << "User is already logged in.\n";
+                    return false;
                 }
+                users[i].isLoggedin = true;
+                if (verbose) cout << "Successfully logged in.\n";
+                return true;
             }
-            cout << "Credentials are invalid.\n";
+            if (verbose) cout << "Credentials are invalid.\n";
             return false;
         }
         
         bool logoutUser(const string& userID)
         {
             std::unique_lock<std::shared_mutex> lock(userMtx);
-            for (int i = 0; i <userCount; ++i)
+            int i = findUser(userID);
+            if (i >= 0)
             {
-                if (users[i].userID == userID)
+                if (!users[i].isLoggedin)
                 {
-                    if (!users[i].isLoggedin)
-                    {
-                        cout << "User is currently not logged in.\n";
-                        return false;
-                    }
-                    users[i].isLoggedin = false;
-                    cout << "Successfully logged out.\n";
-                    return true;
+                    if (verbose) cout << "User is currently not logged in.\n";
+                    return false;
                 }
+                users[i].isLoggedin = false;
+                if (verbose) cout << "Successfully logged out.\n";
+                return true;
             }
-            cout << "Unable to find user.\n";
+            if (verbose) cout << "Unable to find user.\n";
             return false;
         }
         bool isUserLocked() const 
@@ -229,6 +499,7 @@ class userManagement
         
         User getUserat(int index)
         {
+            std::shared_lock<std::shared_mutex> lock(userMtx);
             if(index >= 0 && index < userCount)
                 return users[index];
             else
@@ -236,53 +507,281 @@ class userManagement
         }
 };
 
+//Sold/canceled counters per event, written on purchase/cancel and readable without ticketMtx.
+//Every thread increments its own shard; each shard's cells are contiguous and cache-line aligned,
+//so concurrent buyers never write the same line. Readers fold all shards of a slot.
+class salesCounters
+{
+    private:
+        struct Cell
+        {
+            std::atomic<long> sold{0};
+            std::atomic<long> canceled{0};
+        };
+        struct alignas(64) Shard
+        {
+            Cell cells[counterBlock];
+        };
+        struct Block
+        {
+            Shard shards[counterShards];
+            std::atomic<long long> firstSaleNs[counterBlock] = {};
+        };
+        
+        std::atomic<Block*> blocks[maxCounterBlocks] = {};
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+        
+        static int shardIndex()
+        {
+            static std::atomic<int> nextShard{0};
+            thread_local int shard = nextShard++ % counterShards;
+            return shard;
+        }
+        long long nowNs() const
+        {
+            return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count() + 1;
+        }
+        Block* blockFor(int slot)
+        {
+            std::atomic<Block*>& entry = blocks[slot / counterBlock];
+            Block* block = entry.load(std::memory_order_acquire);
+            if (block == nullptr)
+            {
+                Block* fresh = new Block();
+                if (entry.compare_exchange_strong(block, fresh, std::memory_order_acq_rel))
+                {
+                    block = fresh;
+                }
+                else
+                {
+                    delete fresh;       //another thread installed the block first
+                }
+            }
+            return block;
+        }
+    public:
+        ~salesCounters()
+        {
+            for (auto& block : blocks)
+            {
+                delete block.load();
+            }
+        }
+        void recordSale(int slot)
+        {
+            if (slot < 0 || slot >= maxCounterBlocks * counterBlock)
+            {
+                return;
+            }
+            Block* block = blockFor(slot);
+            int cell = slot % counterBlock;
+            block->shards[shardIndex()].cells[cell].sold.fetch_add(1, std::memory_order_relaxed);
+            if (block->firstSaleNs[cell].load(std::memory_order_relaxed) == 0)
+            {
+                long long expected = 0;
+                block->firstSaleNs[cell].compare_exchange_strong(expected, nowNs(), std::memory_order_relaxed);
+            }
+        }
+        void recordCancel(int slot)
+        {
+            if (slot < 0 || slot >= maxCounterBlocks * counterBlock)
+            {
+                return;
+            }
+            blockFor(slot)->shards[shardIndex()].cells[slot % counterBlock].canceled.fetch_add(1, std::memory_order_relaxed);
+        }
+        EventSales read(int slot, int capacity) const
+        {
+            EventSales result;
+            if (slot >= 0 && slot < maxCounterBlocks * counterBlock)
+            {
+                Block* block = blocks[slot / counterBlock].load(std::memory_order_acquire);
+                if (block != nullptr)
+                {
+                    int cell = slot % counterBlock;
+                    for (int s = 0; s < counterShards; ++s)
+                    {
+                        result.sold += block->shards[s].cells[cell].sold.load(std::memory_order_relaxed);
+                        result.canceled += block->shards[s].cells[cell].canceled.load(std::memory_order_relaxed);
+                    }
+                    long long first = block->firstSaleNs[cell].load(std::memory_order_relaxed);
+                    double seconds = first == 0 ? 0 : (nowNs() - first) / 1e9;
+                    result.ratePerSec = seconds > 0 ? result.sold / seconds : 0;
+                }
+            }
+            result.remaining = capacity - (result.sold - result.canceled);
+            return result;
+        }
+};
+
 class ticketManagement
 {
     private:
-        Ticket tickets[100];
+        pmr::unsynchronized_pool_resource ticketPool;  //string storage of every ticket, only touched under ticketMtx
+        vector<Ticket> tickets;
         int ticketCount = 0;
+        int capacity;
+        unsigned long ledgerSeq = 0;    //bumped by every purchase and cancellation, used for export snapshots
+        bool verbose = true;
+        std::atomic<long> purchaseConflicts{0};
+        std::atomic<int> validationPauseUs{0};     //test hook, see setValidationPause
+        salesCounters sales;
         mutable std::shared_mutex ticketMtx;
-  
-    public:
-        bool purchaseTicket (const string& userID, const string& userName, const Event& event)
+        
+        template <class EventLike>      //Event or EventSnapshot
+        bool commitTicket (const string& userID, const string& userName, const EventLike& event, string* issuedID = nullptr)   //caller holds ticketMtx
         {
-            std::unique_lock<std::shared_mutex> lock(ticketMtx);
-    
-            if (ticketCount >= maxTickets)
+            if (ticketCount >= capacity)
+            {
+                if (verbose) cout << "Ticket limit reached.\n";
+                return false;
+            }
+            if (event.salesSlot >= 0 && sales.read(event.salesSlot, event.capacity).remaining <= 0)
             {
-                cout << "Ticket limit reached.\n";
+                if (verbose) cout << "Event is sold out.\n";
                 return false;
             }
             string ticketID = "T" + to_string(ticketCount + 1);
     
-            Ticket newTicket;
-            newTicket.ticketID = ticketID;
-            newTicket.userID = userID;
-            newTicket.userName = userName;
-            newTicket.eventID = event.eventID;
-            newTicket.eventName = event.eventName;
-            newTicket.eventDate = event.eventDate;
+            Ticket newTicket(&ticketPool);
+            newTicket.ticketID.assign(ticketID);
+            newTicket.userID.assign(userID);
+            newTicket.userName.assign(userName);
+            newTicket.eventID.assign(event.eventID);
+            newTicket.eventName.assign(event.eventName);
+            newTicket.eventDate.assign(event.eventDate);
+            newTicket.eventVersion = event.version;
+            newTicket.salesSlot = event.salesSlot;
+            newTicket.soldSeq = ++ledgerSeq;
             newTicket.isCanceled = false;
     
-            tickets[ticketCount++] = newTicket;
-            cout << "Thank you for your purchase. Your Ticket ID is: " << ticketID << endl;
+            tickets.push_back(std::move(newTicket));
+            ticketCount++;
+            sales.recordSale(event.salesSlot);
+            if (verbose) cout << "Thank you for your purchase. Your Ticket ID is: " << ticketID << endl;
+            if (issuedID) *issuedID = ticketID;
             return true;
         }
+  
+    public:
+        ticketManagement(int capacity = maxTickets) : capacity(capacity)
+        {
+            tickets.reserve(capacity);
+        }
+        void setVerbose(bool v)
+        {
+            verbose = v;
+        }
+        //sleeps between taking the event snapshot and validating it, so tests can make updates land in that window
+        void setValidationPause(int microseconds)
+        {
+            validationPauseUs = microseconds;
+        }
+        bool purchaseTicket (const string& userID, const string& userName, const Event& event)
+        {
+            std::unique_lock<std::shared_mutex> lock(ticketMtx);
+            return commitTicket(userID, userName, event);
+        }
+        //optimistic purchase: copy the event without holding ticketMtx, then re-check its version
+        //right before committing. An update or removal in between forces a retry with fresh data.
+        //Lock order is always ticketMtx -> eventMtx (shared), never the other way around.
+        //The snapshot lives in this thread's request arena, the ticket strings in ticketPool.
+        bool purchaseTicketValidated (const string& userID, const string& userName, const string& eventID, const eventManagement& events, string* issuedID = nullptr)
+        {
+            requestArena& arena = requestArena::local();
+            for (int attempt = 0; attempt < maxPurchaseRetries; ++attempt)
+            {
+                arena.reset();
+                EventSnapshot snapshot(arena.get());
+                if (!events.getEventSnapshot(eventID, snapshot))
+                {
+                    if (verbose) cout << "Cannot find event.\n";
+                    return false;
+                }
+                if (int pause = validationPauseUs.load(std::memory_order_relaxed))
+                {
+                    this_thread::sleep_for(chrono::microseconds(pause));
+                }
+                
+                std::unique_lock<std::shared_mutex> lock(ticketMtx);
+                bool committed = false;
+                if (!events.commitIfCurrent(eventID, snapshot.version, [&]() { committed = commitTicket(userID, userName, snapshot, issuedID); }))
+                {
+                    purchaseConflicts++;
+                    continue;
+                }
+                return committed;
+            }
+            if (verbose) cout << "Event kept changing during purchase. Please try again.\n";
+            return false;
+        }
+        EventSales getSales(const Event& event) const   //lock-free, safe to poll from dashboards
+        {
+            return sales.read(event.salesSlot, event.capacity);
+        }
+        long getPurchaseConflicts() const
+        {
+            return purchaseConflicts;
+        }
         bool cancelTicket (const string& ticketID)
         {
             std::unique_lock<std::shared_mutex> lock(ticketMtx);
-            for (int i = 0; i < ticketCount; ++i)
+            int start = 0;
+            if (ticketID.size() > 1 && ticketID[0] == 'T')     //IDs are "T" + position, so try that slot first
+            {
+                int index = atoi(ticketID.c_str() + 1) - 1;
+                start = (index >= 0 && index < ticketCount && string_view(tickets[index].ticketID) == ticketID) ? index : 0;
+            }
+            for (int i = start; i < ticketCount; ++i)
             {
-                if (tickets[i].ticketID == ticketID && !tickets[i].isCanceled)
+                if (string_view(tickets[i].ticketID) == ticketID && !tickets[i].isCanceled)
                 {
                     tickets[i].isCanceled = true;
-                    cout << "Ticket " << ticketID << " has been successfully canceled.\n";
+                    tickets[i].canceledSeq = ++ledgerSeq;
+                    sales.recordCancel(tickets[i].salesSlot);
+                    if (verbose) cout << "Ticket " << ticketID << " has been successfully canceled.\n";
                     return true;
                 }
             }
-            cout << "Error. Cannot find ticket.\n";
+            if (verbose) cout << "Error. Cannot find ticket.\n";
             return false;
         }
+        //cancels the tickets of one event among tickets[from, from + removalBatch), holding ticketMtx for that batch only
+        int cancelEventBatch (const string& eventID, int from)
+        {
+            std::unique_lock<std::shared_mutex> lock(ticketMtx);
+            int canceled = 0;
+            int end = from + removalBatch < ticketCount ? from + removalBatch : ticketCount;
+            for (int i = from; i < end; ++i)
+            {
+                if (string_view(tickets[i].eventID) == eventID && !tickets[i].isCanceled)
+                {
+                    tickets[i].isCanceled = true;
+                    tickets[i].canceledSeq = ++ledgerSeq;
+                    sales.recordCancel(tickets[i].salesSlot);
+                    canceled++;
+                }
+            }
+            return canceled;
+        }
+        //ledger position of a consistent snapshot: tickets are appended in sequence order,
+        //so the snapshot is the first `count` tickets with cancellations up to the returned sequence
+        unsigned long snapshotPoint(int& count) const
+        {
+            std::shared_lock<std::shared_mutex> lock(ticketMtx);
+            count = ticketCount;
+            return ledgerSeq;
+        }
+        void copySnapshotBatch(int from, int count, unsigned long asOf, vector<Ticket>& out) const
+        {
+            out.clear();
+            std::shared_lock<std::shared_mutex> lock(ticketMtx);
+            for (int i = from; i < from + count && i < ticketCount; ++i)
+            {
+                out.push_back(tickets[i]);
+                out.back().isCanceled = tickets[i].canceledSeq != 0 && tickets[i].canceledSeq <= asOf;
+            }
+        }
         void viewEventtickets (const string& eventID) const
         {
             std::shared_lock<std::shared_mutex> lock(ticketMtx);
@@ -292,7 +791,7 @@ class ticketManagement
             for (int i = 0; i < ticketCount; ++i)
             {
                 const Ticket& tix = tickets[i];
-                if (tix.eventID == eventID && !tix.isCanceled)
+                if (string_view(tix.eventID) == eventID && !tix.isCanceled)
                 {
                     cout << "Ticket ID: " << tix.ticketID << "\n";
                     cout << "User: " << tix.userName << " (ID: " <<tix.userID << ")\n\n";
@@ -333,52 +832,1664 @@ class ticketManagement
         {
             for (int i = 0; i < ticketCount; i++)
             {
-                if (tickets[i].userID == userID && tickets[i].eventID == eventID)
+                if (string_view(tickets[i].userID) == userID && string_view(tickets[i].eventID) == eventID)
                 {
-                    return tickets[i].ticketID;
+                    return string(tickets[i].ticketID);
                 }
             }
             return "";
         }
+        int getTicketcount()
+        {
+            std::shared_lock<std::shared_mutex> lock(ticketMtx);
+            return ticketCount;
+        }
+        
+        Ticket getTicketat(int index)
+        {
+            std::shared_lock<std::shared_mutex> lock(ticketMtx);
+            if(index >= 0 && index < ticketCount)
+                return tickets[index];
+            else
+                return {};
+        }
 
 };
 
-//global instances
-eventManagement event;
-userManagement user;
-ticketManagement ticket;
-
-
-//prototype
- void displayMenu();
- void manageEvents();
- void manageUsers();
- void manageTickets();
- void concurrencyControl();
- void liveness();
- void simulateOperations();
-
-int main(){
-	displayMenu();
-	
-}
+struct RemovalJob
+{
+    string eventID;
+    std::atomic<int> scanned{0};
+    std::atomic<int> canceled{0};
+    std::atomic<int> total{0};
+    std::atomic<bool> done{false};
+};
 
-//function
-void displayMenu()
+//Removals are queued and cancelled one after another by a single background worker, so a burst of
+//removals never starts more than one extra thread. Finished jobs are dropped once their final
+//progress has been shown.
+class removalManagement
 {
-	int choice;
-	
-	while (true)
-	{
-		cout << "==============================\n";
-		cout << "    EVENT TICKETING SYSTEM    \n";
-		cout << "==============================\n";
+    private:
+        eventManagement& events;
+        ticketManagement& tickets;
+        vector<unique_ptr<RemovalJob>> jobs;    //queued, running and finished but not yet reported
+        std::deque<RemovalJob*> queue;
+        bool busy = false;                      //the worker is inside cancelInBackground
+        bool stopping = false;
+        thread worker;
+        mutable std::mutex jobMtx;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        
+        void cancelInBackground(RemovalJob* job)
+        {
+            //the event is already closed, so no ticket for it can be committed past this count
+            int total = tickets.getTicketcount();
+            job->total = total;
+            for (int from = 0; from < total; from += removalBatch)
+            {
+                job->canceled += tickets.cancelEventBatch(job->eventID, from);
+                job->scanned = (from + removalBatch < total) ? from + removalBatch : total;
+                this_thread::yield();      //let purchases and cancellations in between batches
+            }
+            events.removeEvent(job->eventID);
+            job->done = true;
+        }
+        void drainQueue()
+        {
+            std::unique_lock<std::mutex> lock(jobMtx);
+            while (true)
+            {
+                wake.wait(lock, [this]() { return !queue.empty() || stopping; });
+                if (queue.empty())
+                {
+                    return;
+                }
+                RemovalJob* job = queue.front();
+                queue.pop_front();
+                busy = true;
+                lock.unlock();
+                cancelInBackground(job);
+                lock.lock();
+                busy = false;
+                if (queue.empty())
+                {
+                    idle.notify_all();
+                }
+            }
+        }
+    public:
+        removalManagement(eventManagement& events, ticketManagement& tickets) : events(events), tickets(tickets) {}
+        ~removalManagement()
+        {
+            waitAll();
+            {
+                std::lock_guard<std::mutex> lock(jobMtx);
+                stopping = true;
+            }
+            wake.notify_one();
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+        //marks the event as closing immediately and queues the cancellation of its tickets
+        bool removeEvent(const string& eventID)
+        {
+            if (!events.closeEvent(eventID))
+            {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(jobMtx);
+            jobs.push_back(make_unique<RemovalJob>());
+            jobs.back()->eventID = eventID;
+            queue.push_back(jobs.back().get());
+            if (!worker.joinable())
+            {
+                worker = thread(&removalManagement::drainQueue, this);
+            }
+            wake.notify_one();
+            return true;
+        }
+        //shows every job, then forgets the finished ones
+        void viewProgress()
+        {
+            std::lock_guard<std::mutex> lock(jobMtx);
+            cout << "\n--------Event Removals--------\n";
+            if (jobs.empty())
+            {
+                cout << "No removals in progress.\n";
+                return;
+            }
+            for (auto& job : jobs)
+            {
+                int total = job->total;
+                int percent = total == 0 ? 0 : (int)(100LL * job->scanned / total);
+                cout << "Event ID: " << job->eventID << "\n";
+                cout << "Progress: " << job->scanned << "/" << total << " tickets scanned (" << (job->done ? 100 : percent) << "%)\n";
+                cout << "Canceled: " << job->canceled << "\n";
+                cout << "Status: " << (job->done ? "Removed" : job->total == 0 ? "Queued" : "Closing") << "\n\n";
+            }
+            jobs.erase(remove_if(jobs.begin(), jobs.end(), [](const unique_ptr<RemovalJob>& job) { return job->done.load(); }), jobs.end());
+        }
+        void waitAll()
+        {
+            std::unique_lock<std::mutex> lock(jobMtx);
+            idle.wait(lock, [this]() { return queue.empty() && !busy; });
+        }
+};
+
+//read-only memory mapping of a whole file, used by the bulk importer
+class mappedFile
+{
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+    public:
+        mappedFile(const string& path)
+        {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER fileSize;
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            {
+                return;
+            }
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+            {
+                data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                size = data ? (size_t)fileSize.QuadPart : 0;
+            }
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+            {
+                if (fd >= 0) close(fd);
+                return;
+            }
+            void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);      //the mapping stays valid after the descriptor is closed
+            if (view != MAP_FAILED)
+            {
+                data = (const char*)view;
+                size = info.st_size;
+                madvise(view, size, MADV_SEQUENTIAL);
+            }
+#endif
+        }
+        ~mappedFile()
+        {
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+            if (data) munmap((void*)data, size);
+#endif
+        }
+        mappedFile(const mappedFile&) = delete;
+        mappedFile& operator=(const mappedFile&) = delete;
+        
+        bool isOpen() const
+        {
+            return data != nullptr;
+        }
+        const char* begin() const
+        {
+            return data;
+        }
+        size_t length() const
+        {
+            return size;
+        }
+};
+
+struct ImportReport
+{
+    long rows = 0;
+    long badRows = 0;
+    int eventsAdded = 0;
+    int usersAdded = 0;
+    long duplicateRows = 0;         //IDs already present or repeated in the file, dropped
+    long overCapacityRows = 0;      //new rows that did not fit in the managers' capacity
+    double parseSeconds = 0;
+    double insertSeconds = 0;
+};
+
+struct ImportChunk
+{
+    vector<Event> events;
+    vector<User> users;
+    long rows = 0;
+    long badRows = 0;
+};
+
+//parses the rows in [begin, end); the range always starts at the beginning of a line
+//  E,<eventID>,<eventName>,<eventDate>,<active 1/0>[,<capacity>]
+//  U,<userID>,<userName>,<password>
+//fields cannot contain commas, lines starting with # are skipped
+void parseImportChunk(const char* begin, const char* end, ImportChunk& out)
+{
+    const char* fields[7];
+    size_t lengths[7];
+    const char* line = begin;
+    while (line < end)
+    {
+        const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+        if (lineEnd == nullptr)
+        {
+            lineEnd = end;
+        }
+        const char* stop = (lineEnd > line && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+        if (stop > line && *line != '#')
+        {
+            int count = 0;
+            const char* field = line;
+            while (count < 7)
+            {
+                const char* comma = (const char*)memchr(field, ',', stop - field);
+                const char* fieldEnd = comma ? comma : stop;
+                fields[count] = field;
+                lengths[count++] = fieldEnd - field;
+                if (comma == nullptr)
+                {
+                    break;
+                }
+                field = comma + 1;
+            }
+            
+            out.rows++;
+            if (lengths[0] == 1 && fields[0][0] == 'E' && (count == 5 || count == 6))
+            {
+                Event e;
+                e.eventID.assign(fields[1], lengths[1]);
+                e.eventName.assign(fields[2], lengths[2]);
+                e.eventDate.assign(fields[3], lengths[3]);
+                e.isActive = lengths[4] > 0 && fields[4][0] == '1';
+                if (count == 6)
+                {
+                    e.capacity = atoi(string(fields[5], lengths[5]).c_str());
+                }
+                out.events.push_back(std::move(e));
+            }
+            else if (lengths[0] == 1 && fields[0][0] == 'U' && count == 4)
+            {
+                User u;
+                u.userID.assign(fields[1], lengths[1]);
+                u.userName.assign(fields[2], lengths[2]);
+                u.userPass.assign(fields[3], lengths[3]);
+                out.users.push_back(std::move(u));
+            }
+            else
+            {
+                out.badRows++;
+            }
+        }
+        line = lineEnd + 1;
+    }
+}
+
+//maps the file, parses line-aligned chunks on threadCount threads, then hands every parsed row
+//to the managers in one bulk insert each (one lock acquisition and one index build per manager)
+bool bulkImport(const string& path, eventManagement& events, userManagement& users, int threadCount, ImportReport& report)
+{
+    mappedFile file(path);
+    if (!file.isOpen())
+    {
+        return false;
+    }
+    
+    auto start = chrono::steady_clock::now();
+    const char* data = file.begin();
+    const char* end = data + file.length();
+    vector<const char*> bounds;
+    bounds.push_back(data);
+    for (int i = 1; i < threadCount; ++i)
+    {
+        const char* cut = data + file.length() * i / threadCount;
+        cut = cut < bounds.back() ? bounds.back() : cut;
+        const char* newline = (const char*)memchr(cut, '\n', end - cut);
+        bounds.push_back(newline ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+    
+    vector<ImportChunk> chunks(threadCount);
+    vector<thread> parsers;
+    for (int i = 0; i < threadCount; ++i)
+    {
+        parsers.emplace_back(parseImportChunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    }
+    for (auto& t : parsers)
+    {
+        t.join();
+    }
+    
+    //concatenate in file order so duplicate IDs keep their first occurrence
+    vector<Event> allEvents;
+    vector<User> allUsers;
+    size_t eventRows = 0;
+    size_t userRows = 0;
+    for (auto& c : chunks)
+    {
+        eventRows += c.events.size();
+        userRows += c.users.size();
+        report.rows += c.rows;
+        report.badRows += c.badRows;
+    }
+    allEvents.reserve(eventRows);
+    allUsers.reserve(userRows);
+    for (auto& c : chunks)
+    {
+        std::move(c.events.begin(), c.events.end(), back_inserter(allEvents));
+        std::move(c.users.begin(), c.users.end(), back_inserter(allUsers));
+        c = ImportChunk();
+    }
+    auto parsed = chrono::steady_clock::now();
+    
+    report.eventsAdded = events.bulkAddEvents(allEvents, report.duplicateRows, report.overCapacityRows);
+    report.usersAdded = users.bulkRegisterUsers(allUsers, report.duplicateRows, report.overCapacityRows);
+    
+    report.parseSeconds = chrono::duration<double>(parsed - start).count();
+    report.insertSeconds = chrono::duration<double>(chrono::steady_clock::now() - parsed).count();
+    return true;
+}
+
+void printImportReport(const ImportReport& report)
+{
+    double total = report.parseSeconds + report.insertSeconds;
+    cout << "Rows read: " << report.rows << " (" << report.badRows << " malformed)\n";
+    cout << "Events added: " << report.eventsAdded << "\n";
+    cout << "Users added: " << report.usersAdded << "\n";
+    cout << "Duplicate IDs dropped: " << report.duplicateRows << "\n";
+    if (report.overCapacityRows > 0)
+    {
+        cout << "Rejected, capacity reached: " << report.overCapacityRows << "\n";
+    }
+    cout << "Parse: " << report.parseSeconds << " s (" << (report.parseSeconds > 0 ? report.rows / report.parseSeconds : 0) << " rows/s)\n";
+    cout << "Insert + index build: " << report.insertSeconds << " s\n";
+    cout << "Overall: " << (total > 0 ? report.rows / total : 0) << " rows/s\n\n";
+}
+
+struct ExportReport
+{
+    long rows = 0;
+    long canceled = 0;
+    long long bytes = 0;
+    unsigned long asOf = 0;
+    double seconds = 0;
+    double longestBatchUs = 0;      //longest single batch copy by a writer, including the wait for ticketMtx
+};
+
+//Column writer for one row group: string columns are stored as rows+1 offsets followed by the bytes,
+//fixed-width columns as plain arrays. A part file is "TCOL1", row groups, then a 0-row terminator.
+class columnWriter
+{
+    private:
+        FILE* out;
+        long long written = 0;
+        
+        void put(const void* data, size_t bytes)
+        {
+            fwrite(data, 1, bytes, out);
+            written += bytes;
+        }
+        template <class Field>
+        void putStrings(const vector<Ticket>& rows, Field field)
+        {
+            vector<uint32_t> offsets;
+            offsets.reserve(rows.size() + 1);
+            uint32_t offset = 0;
+            offsets.push_back(0);
+            for (auto& t : rows)
+            {
+                offset += (uint32_t)(t.*field).size();
+                offsets.push_back(offset);
+            }
+            put(offsets.data(), offsets.size() * sizeof(uint32_t));
+            for (auto& t : rows)
+            {
+                put((t.*field).data(), (t.*field).size());
+            }
+        }
+    public:
+        columnWriter(FILE* out) : out(out)
+        {
+            put("TCOL1", 5);
+        }
+        void writeRowGroup(const vector<Ticket>& rows)
+        {
+            uint32_t count = (uint32_t)rows.size();
+            put(&count, sizeof(count));
+            putStrings(rows, &Ticket::ticketID);
+            putStrings(rows, &Ticket::eventID);
+            putStrings(rows, &Ticket::eventName);
+            putStrings(rows, &Ticket::eventDate);
+            putStrings(rows, &Ticket::userID);
+            putStrings(rows, &Ticket::userName);
+            vector<uint64_t> versions;
+            vector<uint8_t> canceled;
+            versions.reserve(rows.size());
+            canceled.reserve(rows.size());
+            for (auto& t : rows)
+            {
+                versions.push_back(t.eventVersion);
+                canceled.push_back(t.isCanceled ? 1 : 0);
+            }
+            put(versions.data(), versions.size() * sizeof(uint64_t));
+            put(canceled.data(), canceled.size());
+        }
+        void finish()
+        {
+            uint32_t end = 0;
+            put(&end, sizeof(end));
+        }
+        long long bytes() const
+        {
+            return written;
+        }
+};
+
+//writes one CSV field and its separator, quoted per RFC 4180 when it holds a comma, quote or line break
+long putCsvField(FILE* out, string_view field, char after)
+{
+    long bytes = 0;
+    if (field.find_first_of(",\"\r\n") == string_view::npos)
+    {
+        bytes += fwrite(field.data(), 1, field.size(), out);
+    }
+    else
+    {
+        fputc('"', out);
+        for (char c : field)
+        {
+            if (c == '"')
+            {
+                fputc('"', out);        //a quote inside a quoted field is doubled
+                bytes++;
+            }
+            fputc(c, out);
+        }
+        fputc('"', out);
+        bytes += field.size() + 2;
+    }
+    fputc(after, out);
+    return bytes + 1;
+}
+
+//Streams the ledger as of one ledger sequence number into `writers` part files (binary and, optionally, CSV).
+//Every writer owns a contiguous range of the snapshot and copies it out one exportBatch at a time,
+//so ticketMtx (shared) is never held for more than a single batch.
+bool exportLedger(const ticketManagement& tickets, const string& basePath, int writers, bool withCsv, ExportReport& report)
+{
+    auto start = chrono::steady_clock::now();
+    int count = 0;
+    report.asOf = tickets.snapshotPoint(count);
+    report.rows = count;
+    
+    vector<long long> bytes(writers, 0);
+    vector<long> canceled(writers, 0);
+    vector<double> longest(writers, 0);
+    std::atomic<bool> failed{false};
+    
+    auto writer = [&](int part)
+    {
+        int from = (int)((long long)count * part / writers);
+        int to = (int)((long long)count * (part + 1) / writers);
+        string name = basePath + ".part" + to_string(part);
+        FILE* binary = fopen((name + ".tcol").c_str(), "wb");
+        FILE* csv = withCsv ? fopen((name + ".csv").c_str(), "wb") : nullptr;
+        if (binary == nullptr || (withCsv && csv == nullptr))
+        {
+            failed = true;
+            if (binary) fclose(binary);
+            if (csv) fclose(csv);
+            return;
+        }
+        vector<char> binaryBuffer(1 << 20);
+        vector<char> csvBuffer(1 << 20);
+        setvbuf(binary, binaryBuffer.data(), _IOFBF, binaryBuffer.size());
+        if (csv)
+        {
+            setvbuf(csv, csvBuffer.data(), _IOFBF, csvBuffer.size());
+            bytes[part] += fprintf(csv, "ticketID,eventID,eventName,eventDate,userID,userName,eventVersion,canceled\n");
+        }
+        
+        columnWriter columns(binary);
+        vector<Ticket> batch;
+        for (int i = from; i < to; i += exportBatch)
+        {
+            auto copyStart = chrono::steady_clock::now();
+            tickets.copySnapshotBatch(i, (to - i < exportBatch) ? to - i : exportBatch, report.asOf, batch);
+            double us = chrono::duration<double, micro>(chrono::steady_clock::now() - copyStart).count();
+            longest[part] = us > longest[part] ? us : longest[part];
+            
+            columns.writeRowGroup(batch);
+            for (auto& t : batch)
+            {
+                canceled[part] += t.isCanceled ? 1 : 0;
+                if (csv)
+                {
+                    for (const pmr::string* field : {&t.ticketID, &t.eventID, &t.eventName, &t.eventDate, &t.userID, &t.userName})
+                    {
+                        bytes[part] += putCsvField(csv, *field, ',');
+                    }
+                    bytes[part] += fprintf(csv, "%lu,%d\n", t.eventVersion, t.isCanceled ? 1 : 0);
+                }
+            }
+        }
+        columns.finish();
+        bytes[part] += columns.bytes();
+        fclose(binary);
+        if (csv) fclose(csv);
+    };
+    
+    vector<thread> threads;
+    for (int i = 0; i < writers; ++i)
+    {
+        threads.emplace_back(writer, i);
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    
+    for (int i = 0; i < writers; ++i)
+    {
+        report.bytes += bytes[i];
+        report.canceled += canceled[i];
+        report.longestBatchUs = longest[i] > report.longestBatchUs ? longest[i] : report.longestBatchUs;
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return !failed;
+}
+
+void printExportReport(const ExportReport& report)
+{
+    cout << "Snapshot ledger sequence: " << report.asOf << "\n";
+    cout << "Tickets exported: " << report.rows << " (" << report.canceled << " canceled)\n";
+    cout << "Bytes written: " << report.bytes << "\n";
+    cout << "Time: " << report.seconds << " s (" << (report.seconds > 0 ? report.rows / report.seconds : 0) << " tickets/s)\n";
+    cout << "Longest batch copy under the ticket lock: " << report.longestBatchUs << " us\n\n";
+}
+
+//one exported ticket as read back from a part file
+struct LedgerRow
+{
+    string ticketID, eventID, eventName, eventDate, userID, userName;
+    unsigned long eventVersion = 0;
+    bool canceled = false;
+};
+
+//reads a part file written by columnWriter and hands every row to onRow in file order;
+//false if the file is missing, truncated or has bytes after its terminator
+template <class OnRow>
+bool readColumnPart(const string& path, OnRow onRow)
+{
+    mappedFile file(path);
+    if (!file.isOpen() || file.length() < 5 || memcmp(file.begin(), "TCOL1", 5) != 0)
+    {
+        return false;
+    }
+    const char* pos = file.begin() + 5;
+    const char* end = file.begin() + file.length();
+    auto take = [&](void* to, size_t bytes)
+    {
+        if ((size_t)(end - pos) < bytes)
+        {
+            return false;
+        }
+        memcpy(to, pos, bytes);
+        pos += bytes;
+        return true;
+    };
+    string LedgerRow::* columns[] = {&LedgerRow::ticketID, &LedgerRow::eventID, &LedgerRow::eventName, &LedgerRow::eventDate, &LedgerRow::userID, &LedgerRow::userName};
+    vector<LedgerRow> rows;
+    vector<uint32_t> offsets;
+    while (true)
+    {
+        uint32_t count;
+        if (!take(&count, sizeof(count)))
+        {
+            return false;
+        }
+        if (count == 0)
+        {
+            return pos == end;
+        }
+        rows.assign(count, LedgerRow());
+        for (auto column : columns)
+        {
+            offsets.resize(count + 1);
+            if (!take(offsets.data(), offsets.size() * sizeof(uint32_t)) || (size_t)(end - pos) < offsets[count])
+            {
+                return false;
+            }
+            for (uint32_t r = 0; r < count; ++r)
+            {
+                if (offsets[r + 1] < offsets[r])
+                {
+                    return false;
+                }
+                (rows[r].*column).assign(pos + offsets[r], offsets[r + 1] - offsets[r]);
+            }
+            pos += offsets[count];
+        }
+        for (auto& row : rows)
+        {
+            uint64_t version;
+            if (!take(&version, sizeof(version)))
+            {
+                return false;
+            }
+            row.eventVersion = version;
+        }
+        for (auto& row : rows)
+        {
+            uint8_t canceled;
+            if (!take(&canceled, sizeof(canceled)))
+            {
+                return false;
+            }
+            row.canceled = canceled != 0;
+        }
+        for (auto& row : rows)
+        {
+            onRow(row);
+        }
+    }
+}
+
+//parses a CSV part file (RFC 4180 quoting) and hands every record after the header to onRow
+template <class OnRow>
+bool readCsvPart(const string& path, OnRow onRow)
+{
+    mappedFile file(path);
+    if (!file.isOpen())
+    {
+        return false;
+    }
+    const char* pos = file.begin();
+    const char* end = file.begin() + file.length();
+    vector<string> fields;
+    bool header = true;
+    while (pos < end)
+    {
+        fields.clear();
+        while (true)
+        {
+            string field;
+            if (pos < end && *pos == '"')       //a part ending in a comma leaves an empty last field
+            {
+                for (++pos; ; ++pos)
+                {
+                    if (pos >= end)
+                    {
+                        return false;       //unterminated quote
+                    }
+                    if (*pos == '"')
+                    {
+                        if (pos + 1 < end && pos[1] == '"')
+                        {
+                            field += *pos++;
+                            continue;
+                        }
+                        ++pos;
+                        break;
+                    }
+                    field += *pos;
+                }
+            }
+            else
+            {
+                const char* start = pos;
+                while (pos < end && *pos != ',' && *pos != '\n')
+                {
+                    pos++;
+                }
+                field.assign(start, pos);
+            }
+            fields.push_back(std::move(field));
+            if (pos < end && *pos == ',')
+            {
+                pos++;
+                continue;
+            }
+            if (pos < end && *pos != '\n')
+            {
+                return false;       //text after a closing quote
+            }
+            pos++;
+            break;
+        }
+        if (fields.size() != 8)
+        {
+            return false;
+        }
+        if (header)
+        {
+            header = false;
+            continue;
+        }
+        LedgerRow row{fields[0], fields[1], fields[2], fields[3], fields[4], fields[5]};
+        row.eventVersion = strtoul(fields[6].c_str(), nullptr, 10);
+        row.canceled = fields[7] == "1";
+        onRow(row);
+    }
+    return !header;
+}
+
+#ifdef __linux__
+//Wire protocol of the request server (native byte order, local clients only).
+//Request:  u32 length | u8 op | fields,  every field is u16 length + bytes
+//Response: u32 length | u8 status | payload
+enum RequestOp : uint8_t { opLogin = 1, opLogout = 2, opPurchase = 3, opCancel = 4, opQuery = 5 };
+enum ReplyStatus : uint8_t { replyOk = 0, replyFailed = 1, replyBadRequest = 2 };
+
+void putFrameString(string& out, const string& value)
+{
+    uint16_t length = (uint16_t)value.size();
+    out.append((const char*)&length, sizeof(length));
+    out.append(value);
+}
+
+bool getFrameString(const char*& pos, const char* end, string& value)
+{
+    uint16_t length;
+    if (end - pos < (long)sizeof(length))
+    {
+        return false;
+    }
+    memcpy(&length, pos, sizeof(length));
+    pos += sizeof(length);
+    if (end - pos < length)
+    {
+        return false;
+    }
+    value.assign(pos, length);
+    pos += length;
+    return true;
+}
+
+//appends a complete frame around whatever the callback writes
+template <class Body>
+void putFrame(string& out, uint8_t head, Body body)
+{
+    size_t start = out.size();
+    out.append(sizeof(uint32_t), '\0');
+    out.push_back((char)head);
+    body(out);
+    uint32_t length = (uint32_t)(out.size() - start - sizeof(uint32_t));
+    memcpy(&out[start], &length, sizeof(length));
+}
+
+//Single-threaded epoll loop on a Unix domain socket. Sockets are non-blocking, every readable
+//connection is drained and all complete frames in its buffer are answered in order, so clients
+//can pipeline as many requests as they like per round trip.
+class requestServer
+{
+    private:
+        struct Connection
+        {
+            string in;
+            string out;
+            size_t outSent = 0;
+            uint32_t watching = EPOLLIN;    //events currently registered with epoll
+        };
+        
+        eventManagement& events;
+        userManagement& users;
+        ticketManagement& tickets;
+        string socketPath;
+        int listenFd = -1;
+        int epollFd = -1;
+        int wakeFd = -1;
+        thread loop;
+        unordered_map<int, Connection> connections;
+        std::atomic<long> served{0};
+        std::atomic<size_t> peakBacklog{0};
+        
+        static size_t backlog(const Connection& conn)
+        {
+            return conn.out.size() - conn.outSent;
+        }
+        
+        void handle(uint8_t op, const char* pos, const char* end, string& out)
+        {
+            string a, b, c;
+            bool ok = false;
+            switch (op)
+            {
+                case opLogin:
+                    if (!getFrameString(pos, end, a) || !getFrameString(pos, end, b)) break;
+                    putFrame(out, users.loginUser(a, b) ? replyOk : replyFailed, [](string&) {});
+                    return;
+                case opLogout:
+                    if (!getFrameString(pos, end, a)) break;
+                    putFrame(out, users.logoutUser(a) ? replyOk : replyFailed, [](string&) {});
+                    return;
+                case opPurchase:
+                {
+                    if (!getFrameString(pos, end, a) || !getFrameString(pos, end, b) || !getFrameString(pos, end, c)) break;
+                    string ticketID;
+                    ok = tickets.purchaseTicketValidated(a, b, c, events, &ticketID);
+                    putFrame(out, ok ? replyOk : replyFailed, [&](string& o) { putFrameString(o, ticketID); });
+                    return;
+                }
+                case opCancel:
+                    if (!getFrameString(pos, end, a)) break;
+                    putFrame(out, tickets.cancelTicket(a) ? replyOk : replyFailed, [](string&) {});
+                    return;
+                case opQuery:
+                {
+                    if (!getFrameString(pos, end, a)) break;
+                    Event found;
+                    ok = events.getEventbyID(a, found);
+                    EventSales sales = ok ? tickets.getSales(found) : EventSales();
+                    putFrame(out, ok ? replyOk : replyFailed, [&](string& o)
+                    {
+                        int64_t values[3] = {sales.sold, sales.canceled, sales.remaining};
+                        o.append((const char*)values, sizeof(values));
+                    });
+                    return;
+                }
+            }
+            putFrame(out, replyBadRequest, [](string&) {});
+        }
+        
+        void closeConnection(int fd)
+        {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            connections.erase(fd);
+        }
+        
+        //answers the complete frames in conn.in until the reply backlog reaches maxReplyBacklog;
+        //returns false on a malformed frame
+        bool serveBuffered(Connection& conn)
+        {
+            size_t pos = 0;
+            while (conn.in.size() - pos >= sizeof(uint32_t) && backlog(conn) < maxReplyBacklog)
+            {
+                uint32_t length;
+                memcpy(&length, conn.in.data() + pos, sizeof(length));
+                if (length == 0 || length > maxFrameBytes) return false;
+                if (conn.in.size() - pos - sizeof(length) < length) break;
+                const char* body = conn.in.data() + pos + sizeof(length);
+                handle((uint8_t)body[0], body + 1, body + length, conn.out);
+                pos += sizeof(length) + length;
+                served++;
+            }
+            conn.in.erase(0, pos);
+            size_t peak = peakBacklog.load(std::memory_order_relaxed);
+            while (backlog(conn) > peak && !peakBacklog.compare_exchange_weak(peak, backlog(conn), std::memory_order_relaxed))
+            {
+            }
+            return true;
+        }
+        
+        //sends what the socket takes, serves requests held back by a full backlog once it drains,
+        //and stops reading from a client whose replies are backed up (it keeps pipelining but never reads)
+        //returns false when the connection has to be dropped
+        bool flush(int fd, Connection& conn)
+        {
+            while (true)
+            {
+                while (conn.outSent < conn.out.size())
+                {
+                    ssize_t n = send(fd, conn.out.data() + conn.outSent, conn.out.size() - conn.outSent, MSG_NOSIGNAL);
+                    if (n < 0)
+                    {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                        return false;
+                    }
+                    conn.outSent += n;
+                }
+                if (conn.outSent == conn.out.size())
+                {
+                    conn.out.clear();
+                    conn.outSent = 0;
+                }
+                else if (conn.outSent >= conn.out.size() / 2)
+                {
+                    conn.out.erase(0, conn.outSent);
+                    conn.outSent = 0;
+                }
+                size_t before = conn.out.size();
+                if (backlog(conn) >= maxReplyBacklog)
+                {
+                    break;
+                }
+                if (!serveBuffered(conn)) return false;
+                if (conn.out.size() == before)
+                {
+                    break;
+                }
+            }
+            
+            //only ask for EPOLLOUT while replies are backed up, and for EPOLLIN while they are not
+            uint32_t wanted = (backlog(conn) < maxReplyBacklog ? (uint32_t)EPOLLIN : 0) | (backlog(conn) > 0 ? (uint32_t)EPOLLOUT : 0);
+            if (wanted != conn.watching)
+            {
+                epoll_event ev = {};
+                ev.events = wanted;
+                ev.data.fd = fd;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+                conn.watching = wanted;
+            }
+            return true;
+        }
+        
+        bool readAndServe(int fd, Connection& conn)
+        {
+            char buffer[65536];
+            while (conn.in.size() < maxReplyBacklog)     //input is bounded as well: at most one read past the cap
+            {
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n == 0) return false;
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    return false;
+                }
+                conn.in.append(buffer, n);
+            }
+            return serveBuffered(conn) && flush(fd, conn);
+        }
+        
+        void run()
+        {
+            epoll_event ready[64];
+            while (true)
+            {
+                int count = epoll_wait(epollFd, ready, 64, -1);
+                for (int i = 0; i < count; ++i)
+                {
+                    int fd = ready[i].data.fd;
+                    if (fd == wakeFd)
+                    {
+                        return;
+                    }
+                    if (fd == listenFd)
+                    {
+                        int client;
+                        while ((client = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                        {
+                            epoll_event ev = {};
+                            ev.events = EPOLLIN;
+                            ev.data.fd = client;
+                            epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &ev);
+                            connections[client];
+                        }
+                        continue;
+                    }
+                    auto it = connections.find(fd);
+                    if (it == connections.end())
+                    {
+                        continue;
+                    }
+                    bool alive = !(ready[i].events & (EPOLLERR | EPOLLHUP)) || (ready[i].events & EPOLLIN);
+                    if (alive && (ready[i].events & EPOLLIN))
+                    {
+                        alive = readAndServe(fd, it->second);
+                    }
+                    else if (alive && (ready[i].events & EPOLLOUT))
+                    {
+                        alive = flush(fd, it->second);
+                    }
+                    if (!alive)
+                    {
+                        closeConnection(fd);
+                    }
+                }
+            }
+        }
+    public:
+        requestServer(eventManagement& events, userManagement& users, ticketManagement& tickets)
+            : events(events), users(users), tickets(tickets) {}
+        ~requestServer()
+        {
+            stop();
+        }
+        bool start(const string& path)
+        {
+            socketPath = path;
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+            {
+                return false;
+            }
+            strcpy(address.sun_path, path.c_str());
+            unlink(path.c_str());
+            
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+            {
+                stop();
+                return false;
+            }
+            epollFd = epoll_create1(EPOLL_CLOEXEC);
+            wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = listenFd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+            ev.data.fd = wakeFd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+            loop = thread(&requestServer::run, this);
+            return true;
+        }
+        void stop()
+        {
+            if (loop.joinable())
+            {
+                uint64_t one = 1;
+                ssize_t ignored = write(wakeFd, &one, sizeof(one));
+                (void)ignored;
+                loop.join();
+            }
+            for (auto& conn : connections)
+            {
+                close(conn.first);
+            }
+            connections.clear();
+            for (int* fd : {&listenFd, &epollFd, &wakeFd})
+            {
+                if (*fd >= 0) close(*fd);
+                *fd = -1;
+            }
+            if (!socketPath.empty())
+            {
+                unlink(socketPath.c_str());
+                socketPath.clear();
+            }
+        }
+        long getServed() const
+        {
+            return served;
+        }
+        size_t getPeakBacklog() const       //largest unsent reply backlog any connection reached
+        {
+            return peakBacklog;
+        }
+};
+
+struct LoadReport
+{
+    long requests = 0;
+    long failed = 0;
+    double seconds = 0;
+    vector<double> latenciesUs;
+};
+
+//Load generator: one blocking connection per thread, each keeping `depth` requests in flight.
+//Every client logs in its own user, then mixes sales queries, purchases and cancellations
+//of its own tickets, and logs out at the end.
+bool runLoadClients(const string& path, int clients, int depth, int requestsPerClient, int eventCount, LoadReport& report)
+{
+    vector<LoadReport> results(clients);
+    std::atomic<bool> failed{false};
+    
+    auto client = [&](int id)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+        {
+            failed = true;
+            if (fd >= 0) close(fd);
+            return;
+        }
+        LoadReport& mine = results[id];
+        mine.latenciesUs.reserve(requestsPerClient + 2);
+        string userID = "U" + to_string(id);
+        vector<string> myTickets;
+        string in;
+        unsigned seed = 12345 + id;
+        
+        auto exchange = [&](const string& out, int frames, vector<string>& replies)
+        {
+            auto sent = chrono::steady_clock::now();
+            size_t done = 0;
+            while (done < out.size())
+            {
+                ssize_t n = send(fd, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+                if (n <= 0) return false;
+                done += n;
+            }
+            replies.clear();
+            char buffer[65536];
+            size_t pos = 0;
+            while ((int)replies.size() < frames)
+            {
+                uint32_t length;
+                if (in.size() - pos >= sizeof(length))
+                {
+                    memcpy(&length, in.data() + pos, sizeof(length));
+                    if (in.size() - pos - sizeof(length) >= length)
+                    {
+                        replies.push_back(in.substr(pos + sizeof(length), length));
+                        pos += sizeof(length) + length;
+                        mine.latenciesUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count());
+                        continue;
+                    }
+                }
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) return false;
+                in.append(buffer, n);
+            }
+            in.erase(0, pos);
+            return true;
+        };
+        
+        vector<string> replies;
+        string out;
+        putFrame(out, opLogin, [&](string& o) { putFrameString(o, userID); putFrameString(o, "pass"); });
+        bool ok = exchange(out, 1, replies);
+        
+        for (int sent = 0; ok && sent < requestsPerClient; sent += depth)
+        {
+            out.clear();
+            int frames = (requestsPerClient - sent < depth) ? requestsPerClient - sent : depth;
+            vector<uint8_t> ops;
+            for (int f = 0; f < frames; ++f)
+            {
+                seed = seed * 1103515245 + 12345;
+                int roll = (seed >> 16) % 10;
+                string eventID = "E" + to_string((seed >> 8) % eventCount);
+                if (roll < 7 || (roll == 9 && myTickets.empty()))
+                {
+                    putFrame(out, opQuery, [&](string& o) { putFrameString(o, eventID); });
+                    ops.push_back(opQuery);
+                }
+                else if (roll < 9)
+                {
+                    putFrame(out, opPurchase, [&](string& o) { putFrameString(o, userID); putFrameString(o, "Load User"); putFrameString(o, eventID); });
+                    ops.push_back(opPurchase);
+                }
+                else
+                {
+                    string ticketID = myTickets.back();
+                    myTickets.pop_back();
+                    putFrame(out, opCancel, [&](string& o) { putFrameString(o, ticketID); });
+                    ops.push_back(opCancel);
+                }
+            }
+            ok = exchange(out, frames, replies);
+            for (int f = 0; ok && f < frames; ++f)
+            {
+                const string& reply = replies[f];
+                if (reply.empty() || reply[0] != replyOk)
+                {
+                    mine.failed++;
+                    continue;
+                }
+                if (ops[f] == opPurchase)
+                {
+                    const char* pos = reply.data() + 1;
+                    string ticketID;
+                    if (getFrameString(pos, reply.data() + reply.size(), ticketID))
+                    {
+                        myTickets.push_back(ticketID);
+                    }
+                }
+            }
+        }
+        
+        out.clear();
+        putFrame(out, opLogout, [&](string& o) { putFrameString(o, userID); });
+        ok = ok && exchange(out, 1, replies);
+        failed = failed || !ok;
+        mine.requests = mine.latenciesUs.size();
+        close(fd);
+    };
+    
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < clients; ++i)
+    {
+        threads.emplace_back(client, i);
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (auto& r : results)
+    {
+        report.requests += r.requests;
+        report.failed += r.failed;
+        report.latenciesUs.insert(report.latenciesUs.end(), r.latenciesUs.begin(), r.latenciesUs.end());
+    }
+    return !failed;
+}
+
+double percentile(vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t at = (size_t)(p * (sorted.size() - 1));
+    return sorted[at];
+}
+#endif
+
+//Operation traces: a recorded concurrent workload that can be replayed against fresh managers.
+//Thread 0 is the setup stream (events/users), replayed serially before the worker streams start.
+//A purchase carries the ticket ID it was issued during recording as a 4th field; a cancel names that
+//recorded ID and the replay maps it to the ticket its own run of that purchase produced, because
+//positional IDs are handed out in whatever order the threads happen to commit.
+enum TraceOpCode : uint8_t { trAddEvent = 1, trRegister, trLogin, trLogout, trLookup, trPurchase, trCancel, trUpdateEvent };
+
+//fields each op code needs; a purchase may carry one more, its recorded ticket ID
+const uint8_t traceOpFields[] = {0, 4, 3, 2, 1, 1, 3, 1, 4};
+
+struct TraceOp
+{
+    uint64_t atNs = 0;      //offset from the start of the recording
+    uint16_t thread = 0;
+    uint8_t code = 0;
+    vector<string> args;
+};
+
+//performs one traced operation; shared by the live recording and the replay so both do identical work
+bool applyTraceOp(const TraceOp& op, eventManagement& events, userManagement& users, ticketManagement& tickets, string* issuedID = nullptr)
+{
+    const vector<string>& a = op.args;
+    switch (op.code)
+    {
+        case trAddEvent:
+        {
+            Event e = {a[0], a[1], a[2], true};
+            e.capacity = atoi(a[3].c_str());
+            return events.addEvent(e);
+        }
+        case trRegister:
+            return users.registerUser({a[0], a[1], a[2]});
+        case trLogin:
+            return users.loginUser(a[0], a[1]);
+        case trLogout:
+            return users.logoutUser(a[0]);
+        case trLookup:
+        {
+            Event found;
+            return events.getEventbyID(a[0], found);
+        }
+        case trPurchase:
+            return tickets.purchaseTicketValidated(a[0], a[1], a[2], events, issuedID);
+        case trCancel:
+            return tickets.cancelTicket(a[0]);
+        case trUpdateEvent:
+        {
+            Event e = {a[0], a[1], a[2], true};
+            e.capacity = atoi(a[3].c_str());
+            return events.updateEvent(e);
+        }
+    }
+    return false;
+}
+
+//collects operations into one buffer per recording thread so recording adds no shared lock
+class traceRecorder
+{
+    private:
+        vector<vector<TraceOp>> streams;
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    public:
+        traceRecorder(int threads) : streams(threads + 1) {}
+        void record(int thread, uint8_t code, vector<string> args)
+        {
+            TraceOp op;
+            op.atNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+            op.thread = (uint16_t)thread;
+            op.code = code;
+            op.args = std::move(args);
+            streams[thread].push_back(std::move(op));
+        }
+        const TraceOp& last(int thread) const
+        {
+            return streams[thread].back();
+        }
+        void recordIssued(int thread, const string& ticketID)     //attaches the issued ticket ID to the thread's last purchase
+        {
+            streams[thread].back().args.push_back(ticketID);
+        }
+        bool save(const string& path) const
+        {
+            FILE* out = fopen(path.c_str(), "wb");
+            if (out == nullptr)
+            {
+                return false;
+            }
+            uint32_t threads = (uint32_t)streams.size();
+            uint64_t count = 0;
+            for (auto& s : streams)
+            {
+                count += s.size();
+            }
+            fwrite("TTRC2", 1, 5, out);
+            fwrite(&threads, sizeof(threads), 1, out);
+            fwrite(&count, sizeof(count), 1, out);
+            for (auto& s : streams)
+            {
+                for (auto& op : s)
+                {
+                    uint8_t fields = (uint8_t)op.args.size();
+                    fwrite(&op.atNs, sizeof(op.atNs), 1, out);
+                    fwrite(&op.thread, sizeof(op.thread), 1, out);
+                    fwrite(&op.code, sizeof(op.code), 1, out);
+                    fwrite(&fields, sizeof(fields), 1, out);
+                    for (auto& arg : op.args)
+                    {
+                        uint16_t length = (uint16_t)arg.size();
+                        fwrite(&length, sizeof(length), 1, out);
+                        fwrite(arg.data(), 1, length, out);
+                    }
+                }
+            }
+            return fclose(out) == 0;
+        }
+};
+
+struct ReplayReport
+{
+    long ops = 0;
+    long failedOps = 0;
+    double seconds = 0;
+    double recordedSeconds = 0;
+};
+
+class traceReplayer
+{
+    private:
+        vector<vector<TraceOp>> streams;
+    public:
+        bool load(const string& path)
+        {
+            mappedFile file(path);
+            if (!file.isOpen() || file.length() < 17 || memcmp(file.begin(), "TTRC2", 5) != 0)
+            {
+                return false;
+            }
+            const char* pos = file.begin() + 5;
+            const char* end = file.begin() + file.length();
+            uint32_t threads;
+            uint64_t count;
+            memcpy(&threads, pos, sizeof(threads));
+            memcpy(&count, pos + sizeof(threads), sizeof(count));
+            pos += sizeof(threads) + sizeof(count);
+            if (threads == 0 || threads > maxTraceThreads)      //there is always a setup stream
+            {
+                return false;
+            }
+            streams.assign(threads, {});
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                TraceOp op;
+                uint8_t fields;
+                if (end - pos < 12) return false;
+                memcpy(&op.atNs, pos, 8);
+                memcpy(&op.thread, pos + 8, 2);
+                op.code = (uint8_t)pos[10];
+                fields = (uint8_t)pos[11];
+                pos += 12;
+                for (int f = 0; f < fields; ++f)
+                {
+                    string arg;
+                    uint16_t length;
+                    if (end - pos < 2) return false;
+                    memcpy(&length, pos, 2);
+                    if (end - pos - 2 < length) return false;
+                    arg.assign(pos + 2, length);
+                    pos += 2 + length;
+                    op.args.push_back(std::move(arg));
+                }
+                if (op.thread >= threads || op.code < trAddEvent || op.code > trUpdateEvent) return false;
+                size_t needed = traceOpFields[op.code];
+                if (op.args.size() != needed && !(op.code == trPurchase && op.args.size() == needed + 1)) return false;
+                streams[op.thread].push_back(std::move(op));
+            }
+            return true;
+        }
+        int countOps(uint8_t code) const
+        {
+            int count = 0;
+            for (auto& s : streams)
+            {
+                for (auto& op : s)
+                {
+                    count += op.code == code ? 1 : 0;
+                }
+            }
+            return count;
+        }
+        //setup stream first, then one thread per recorded worker stream; with originalTiming each
+        //thread waits until the op's recorded offset, otherwise it replays back to back
+        ReplayReport replay(eventManagement& events, userManagement& users, ticketManagement& tickets, bool originalTiming) const
+        {
+            ReplayReport report;
+            for (auto& op : streams[0])
+            {
+                applyTraceOp(op, events, users, tickets);
+            }
+            vector<long> failed(streams.size(), 0);
+            uint64_t firstNs = UINT64_MAX;
+            for (size_t t = 1; t < streams.size(); ++t)
+            {
+                report.ops += streams[t].size();
+                if (!streams[t].empty())
+                {
+                    firstNs = streams[t].front().atNs < firstNs ? streams[t].front().atNs : firstNs;
+                    report.recordedSeconds = (double)streams[t].back().atNs / 1e9 > report.recordedSeconds ? (double)streams[t].back().atNs / 1e9 : report.recordedSeconds;
+                }
+            }
+            if (firstNs != UINT64_MAX)
+            {
+                report.recordedSeconds -= firstNs / 1e9;
+            }
+            
+            auto start = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (size_t t = 1; t < streams.size(); ++t)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    unordered_map<string, string> issuedAs;     //recorded ticket ID -> ID issued by this replay
+                    TraceOp cancel;
+                    for (auto& op : streams[t])
+                    {
+                        if (originalTiming)
+                        {
+                            this_thread::sleep_until(start + chrono::nanoseconds(op.atNs - firstNs));
+                        }
+                        bool ok;
+                        if (op.code == trPurchase)
+                        {
+                            string issued;
+                            ok = applyTraceOp(op, events, users, tickets, &issued);
+                            if (ok && op.args.size() > 3)
+                            {
+                                issuedAs[op.args[3]] = issued;
+                            }
+                        }
+                        else if (op.code == trCancel)
+                        {
+                            //a ticket whose purchase failed in this replay has nothing to cancel
+                            auto it = issuedAs.find(op.args[0]);
+                            ok = it != issuedAs.end();
+                            if (ok)
+                            {
+                                cancel.code = trCancel;
+                                cancel.args.assign(1, it->second);
+                                ok = applyTraceOp(cancel, events, users, tickets);
+                                issuedAs.erase(it);
+                            }
+                        }
+                        else
+                        {
+                            ok = applyTraceOp(op, events, users, tickets);
+                        }
+                        failed[t] += ok ? 0 : 1;
+                    }
+                });
+            }
+            for (auto& t : threads)
+            {
+                t.join();
+            }
+            report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            for (long f : failed)
+            {
+                report.failedOps += f;
+            }
+            return report;
+        }
+};
+
+//Runs the simulateOperations session (login, look at events, buy, then buy again / cancel / browse,
+//logout) on `threads` threads against private managers and records every operation.
+//Each thread draws from its own seeded generator, so the choices are the same for a given seed.
+void recordWorkload(traceRecorder& recorder, int threads, int sessionsPerThread, unsigned seed)
+{
+    eventManagement events;
+    userManagement users(threads);
+    ticketManagement tickets(threads * sessionsPerThread * 2);
+    events.setVerbose(false);
+    users.setVerbose(false);
+    tickets.setVerbose(false);
+    
+    const int eventCount = 10;
+    for (int e = 0; e < eventCount; ++e)
+    {
+        recorder.record(0, trAddEvent, {"E" + to_string(e), "Traced Event " + to_string(e), "10-10-2026", to_string(threads * sessionsPerThread * 2)});
+        applyTraceOp(recorder.last(0), events, users, tickets);
+    }
+    for (int u = 1; u <= threads; ++u)
+    {
+        recorder.record(0, trRegister, {"U" + to_string(u), "User " + to_string(u), "pass"});
+        applyTraceOp(recorder.last(0), events, users, tickets);
+    }
+    
+    auto worker = [&](int t)
+    {
+        mt19937 rng(seed + t);
+        string userID = "U" + to_string(t);
+        string userName = "User " + to_string(t);
+        vector<string> owned;
+        auto run = [&](uint8_t code, vector<string> args)
+        {
+            recorder.record(t, code, std::move(args));
+            string issued;
+            applyTraceOp(recorder.last(t), events, users, tickets, &issued);
+            if (!issued.empty())
+            {
+                recorder.recordIssued(t, issued);
+                owned.push_back(issued);
+            }
+        };
+        
+        for (int s = 0; s < sessionsPerThread; ++s)
+        {
+            string eventID = "E" + to_string(rng() % eventCount);
+            run(trLogin, {userID, "pass"});
+            run(trLookup, {eventID});
+            run(trPurchase, {userID, userName, eventID});
+            switch (rng() % 4)
+            {
+                case 0:
+                    run(trPurchase, {userID, userName, eventID});
+                    break;
+                case 1:
+                    if (!owned.empty())
+                    {
+                        run(trCancel, {owned.back()});
+                        owned.pop_back();
+                    }
+                    break;
+                case 2:
+                    run(trLookup, {"E" + to_string(rng() % eventCount)});
+                    break;
+                case 3:
+                    run(trUpdateEvent, {eventID, "Traced Event " + eventID, "11-11-2026", to_string(threads * sessionsPerThread * 2)});
+                    break;
+            }
+            run(trLogout, {userID});
+        }
+    };
+    
+    vector<thread> workers;
+    for (int t = 1; t <= threads; ++t)
+    {
+        workers.emplace_back(worker, t);
+    }
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+}
+
+//global instances
+eventManagement event;
+userManagement user;
+ticketManagement ticket;
+removalManagement removal(event, ticket);
+
+
+//prototype
+ void displayMenu();
+ void manageEvents();
+ void manageUsers();
+ void manageTickets();
+ void concurrencyControl();
+ void liveness();
+ void simulateOperations();
+ void importCatalog();
+ void serveRequests();
+ void runTests();
+ void checkOptimisticPurchases();
+ void benchmarkCascadingRemoval();
+ void benchmarkSalesCounters();
+ void benchmarkBulkImport();
+ void benchmarkLedgerExport();
+ void benchmarkRequestServer();
+ void recordTrace();
+ void replayTrace();
+ void benchmarkPurchaseAllocations();
+
+int main(){
+	displayMenu();
+	
+}
+
+//function
+void displayMenu()
+{
+	int choice;
+	
+	while (true)
+	{
+		cout << "==============================\n";
+		cout << "    EVENT TICKETING SYSTEM    \n";
+		cout << "==============================\n";
 		cout << "1. Event Management" << endl;
 		cout << "2. User Management" << endl;
 		cout << "3. Ticket Management" << endl;
 		cout << "4. Concurrency Control" << endl;
 		cout << "5. Simulate Multiple Threads" << endl;
-		cout << "6. Exit" <<endl;
+		cout << "6. Bulk Import from CSV" << endl;
+		cout << "7. Start Request Server" << endl;
+		cout << "8. Performance & Consistency Tests" << endl;
+		cout << "9. Exit" <<endl;
 		cout << "==============================\n";
 		cout << "Enter your choice: ";
 		cin >> choice;
@@ -400,11 +2511,20 @@ void displayMenu()
 			case 5:
 			    simulateOperations();
 			    break;
-			case 6:            //exits the program
+			case 6:
+			    importCatalog();
+			    break;
+			case 7:
+			    serveRequests();
+			    break;
+			case 8:
+			    runTests();
+			    break;
+			case 9:            //exits the program
 				cout << "Exiting Program..." << endl;
 				return;
-			default:           //will be displayed when the user enters a number greater than 6.
-				cout << "Invalid input. Please choose from 1-6 only.\n";
+			default:           //will be displayed when the user enters a number greater than 9.
+				cout << "Invalid input. Please choose from 1-9 only.\n";
 				continue;
 		}
 	}
@@ -423,7 +2543,8 @@ void manageEvents()
 		cout << "2. Update event details" << endl;
 		cout << "3. Remove an event" << endl;
 		cout << "4. View all events" << endl;
-		cout << "5. Return to Main Menu" << endl;
+		cout << "5. View removal progress" << endl;
+		cout << "6. Return to Main Menu" << endl;
 		cout << "==============================\n";
 		cout << "Enter your choice: ";
 		cin >> choice;
@@ -442,6 +2563,8 @@ void manageEvents()
 				getline(cin, newEvent.eventDate);
 				cout << "Event status (1 = Yes, 0 = No): ";
 				cin >> newEvent.isActive;
+				cout << "Ticket capacity: ";
+				cin >> newEvent.capacity;
 				
 				event.addEvent(newEvent);
 				break;
@@ -458,6 +2581,8 @@ void manageEvents()
 				getline(cin, update.eventDate);
 				cout << "Is the event still active? (1 = Yes, 0 = No): ";
 				cin >> update.isActive;
+				cout << "Update to Ticket capacity: ";
+				cin >> update.capacity;
 				
 				event.updateEvent(update);
 				break;
@@ -470,16 +2595,19 @@ void manageEvents()
 			    cout << "What event would you like to remove? Enter the Event ID: ";
 			    cin >> eventToremove;
 			    
-			    event.removeEvent(eventToremove);
+			    removal.removeEvent(eventToremove);
 				break;
 			}
 			case 4:                    //displays all existing events and their corresponding details
 				event.viewEvents();
 				break;
-			case 5:                    //returns to main menu (Event Ticketing System)
+			case 5:                    //shows how far the background ticket cancellation of removed events got
+				removal.viewProgress();
+				break;
+			case 6:                    //returns to main menu (Event Ticketing System)
 				return;
-			default:                   //will be displayed when the user enters a number greater than 5.
-				cout << "Invalid input. Please choose fom 1-5 only. \n";
+			default:                   //will be displayed when the user enters a number greater than 6.
+				cout << "Invalid input. Please choose fom 1-6 only. \n";
 				continue;
 		}
 	}
@@ -561,7 +2689,9 @@ void manageTickets()
 		cout << "1. Purchase a ticket" << endl;
 		cout << "2. View tickets by event" << endl;
 		cout << "3. Cancel purchased tickets" << endl;
-		cout << "4. Return to Main Menu " << endl;
+		cout << "4. View live sales of an event" << endl;
+		cout << "5. Export ticket ledger" << endl;
+		cout << "6. Return to Main Menu " << endl;
 		cout << "=============================================\n";
 		cout << "Enter your choice: ";
 		cin >> choice;
@@ -582,14 +2712,7 @@ void manageTickets()
                 cout << "Purchase ticket for Event ID: ";
                 cin >> eventID;
                 
-                Event chosenEvent;
-                if (!event.getEventbyID(eventID, chosenEvent))
-                {
-                    cout << "Cannot find event.\n";
-                    break;
-                }
-                
-                bool success = ticket.purchaseTicket(userID, userName, chosenEvent);
+                bool success = ticket.purchaseTicketValidated(userID, userName, eventID, event);
                 if (!success)
                 {
                     cout << "Purchase failed.\n";
@@ -614,15 +2737,105 @@ void manageTickets()
                 ticket.cancelTicket(ticketID);
 				break;
             }
-			case 4:    //returns to main menu (EVENT TICKETING SYSTEM)
+			case 4:     //live sold/canceled/remaining counters, read without the ticket lock
+            {
+                string eventID;
+                cout << "Enter Event ID to view sales: ";
+                cin >> eventID;
+                
+                Event chosenEvent;
+                if (!event.getEventbyID(eventID, chosenEvent))
+                {
+                    cout << "Cannot find event.\n";
+                    break;
+                }
+                EventSales sales = ticket.getSales(chosenEvent);
+                cout << "\n--------Sales for Event ID: " << eventID << "--------\n";
+                cout << "Sold: " << sales.sold << "\n";
+                cout << "Canceled: " << sales.canceled << "\n";
+                cout << "Remaining: " << sales.remaining << "\n";
+                cout << "Sales rate: " << sales.ratePerSec << " tickets/s\n\n";
+				break;
+            }
+			case 5:     //writes every ticket from a consistent snapshot to columnar part files and CSV
+            {
+                string basePath;
+                cout << "Export file prefix: ";
+                cin >> basePath;
+                
+                int writers = thread::hardware_concurrency() > 0 ? (int)thread::hardware_concurrency() : 1;
+                ExportReport report;
+                if (!exportLedger(ticket, basePath, writers, true, report))
+                {
+                    cout << "Export failed. Cannot write to " << basePath << "\n";
+                    break;
+                }
+                cout << "Wrote " << writers << " part(s): " << basePath << ".partN.tcol / .csv\n";
+                printExportReport(report);
+				break;
+            }
+			case 6:    //returns to main menu (EVENT TICKETING SYSTEM)
 				return;
-			default:    //will be displayed if the user enters a number greater than 4.
-				cout << "Invalid input. Please choose from 1-4 only.\n";
+			default:    //will be displayed if the user enters a number greater than 6.
+				cout << "Invalid input. Please choose from 1-6 only.\n";
 				continue;	
 		}
 	}
 }
 
+void importCatalog()
+{
+    string path;
+    cout << "\n--------Bulk Import--------\n";
+    cout << "Rows look like  E,<id>,<name>,<date>,<active 1/0>[,<capacity>]  or  U,<id>,<name>,<password>\n";
+    cout << "Path to CSV file: ";
+    cin >> path;
+    
+    int threads = thread::hardware_concurrency() > 0 ? (int)thread::hardware_concurrency() : 1;
+    ImportReport report;
+    if (!bulkImport(path, event, user, threads, report))
+    {
+        cout << "Cannot open file.\n";
+        return;
+    }
+    printImportReport(report);
+    if (report.overCapacityRows > 0)
+    {
+        cout << "The system holds at most " << maxEvents << " events and " << maxUsers << " users; the rejected rows were not imported.\n\n";
+    }
+}
+
+void serveRequests()
+{
+#ifdef __linux__
+    string path;
+    cout << "\n--------Request Server--------\n";
+    cout << "Unix socket path: ";
+    cin >> path;
+    
+    requestServer server(event, user, ticket);
+    if (!server.start(path))
+    {
+        cout << "Cannot listen on " << path << "\n";
+        return;
+    }
+    event.setVerbose(false);
+    user.setVerbose(false);
+    ticket.setVerbose(false);
+    cout << "Serving login/purchase/cancel/query requests on " << path << "\n";
+    cout << "Enter any key to stop: ";
+    string stop;
+    cin >> stop;
+    server.stop();
+    event.setVerbose(true);
+    user.setVerbose(true);
+    ticket.setVerbose(true);
+    cout << "Server stopped after " << server.getServed() << " requests.\n\n";
+#else
+    cout << "The request server needs Linux (epoll).\n\n";
+#endif
+}
+
 void concurrencyControl()
 {
     cout << "\n--------Lock Status--------\n";
@@ -637,11 +2850,7 @@ void simulateDeadlockavoidance()
     {
         //simulation of the logging and ticket purchasing of a user (1)
         user.loginUser("U01", "pass");
-        Event evt;
-        if (event.getEventbyID("E01", evt))
-        {
-            ticket.purchaseTicket("U01", "User 1", evt);
-        }
+        ticket.purchaseTicketValidated("U01", "User 1", "E01", event);
         user.logoutUser("U01");
     };
     
@@ -649,11 +2858,7 @@ void simulateDeadlockavoidance()
     {
         //simulation of the logging in and ticket purchasing of another user (2)
         user.loginUser("U02", "pass");
-        Event evt;
-        if (event.getEventbyID("E01", evt))
-        {
-            ticket.purchaseTicket("U02", "User 2", evt);
-        }
+        ticket.purchaseTicketValidated("U02", "User 2", "E01", event);
         user.logoutUser("U02");
     };
     
@@ -734,7 +2939,7 @@ void simulateOperations()
         this_thread::sleep_for(chrono::milliseconds(100));
         
         cout << "[" <<u.userName << "] Purchasing a ticket for event: " << targetEvent.eventName << "\n";
-        ticket.purchaseTicket(u.userID, u.userName, targetEvent);
+        ticket.purchaseTicketValidated(u.userID, u.userName, targetEvent.eventID, event);
         this_thread::sleep_for(chrono::milliseconds(100));
         
         int action = rand() % 3;
@@ -743,7 +2948,7 @@ void simulateOperations()
         {
             case 0:
                 cout << "[" <<u.userName << "] Buying another ticket for " <<targetEvent.eventName << "\n";
-                ticket.purchaseTicket(u.userID, u.userName, targetEvent);
+                ticket.purchaseTicketValidated(u.userID, u.userName, targetEvent.eventID, event);
                 break;
             case 1:
             {
@@ -793,3 +2998,721 @@ void simulateOperations()
     t3.join();
     t4.join();
 }
+
+void runTests()
+{
+	int choice;
+	
+	while (true)
+	{
+		cout << "=============================================\n";
+		cout << "        Performance & Consistency Tests      \n";
+		cout << "=============================================\n";
+		cout << "1. Optimistic purchase vs. event updates" << endl;
+		cout << "2. Cascading removal of a large event" << endl;
+		cout << "3. Live sales counters under load" << endl;
+		cout << "4. Parallel bulk import" << endl;
+		cout << "5. Ticket ledger export" << endl;
+		cout << "6. Request server under client load" << endl;
+		cout << "7. Record a workload trace" << endl;
+		cout << "8. Replay a workload trace" << endl;
+		cout << "9. Heap allocations per purchase" << endl;
+		cout << "10. Return to Main Menu" << endl;
+		cout << "=============================================\n";
+		cout << "Enter your choice: ";
+		cin >> choice;
+		
+		switch (choice)
+		{
+			case 1:
+				checkOptimisticPurchases();
+				break;
+			case 2:
+				benchmarkCascadingRemoval();
+				break;
+			case 3:
+				benchmarkSalesCounters();
+				break;
+			case 4:
+				benchmarkBulkImport();
+				break;
+			case 5:
+				benchmarkLedgerExport();
+				break;
+			case 6:
+				benchmarkRequestServer();
+				break;
+			case 7:
+				recordTrace();
+				break;
+			case 8:
+				replayTrace();
+				break;
+			case 9:
+				benchmarkPurchaseAllocations();
+				break;
+			case 10:
+				return;
+			default:
+				cout << "Invalid input. Please choose from 1-10 only.\n";
+				continue;
+		}
+	}
+}
+
+//runs a fixed number of event updates against a fixed number of concurrent purchase attempts on
+//private managers with no ticket or seat cap, then checks that every ticket carries the version that
+//was current when it was committed and that stale snapshots were actually rejected
+void checkOptimisticPurchases()
+{
+    cout << "\n--------Optimistic Purchase Check--------\n";
+    
+    const int buyerThreads = 4;
+    const int purchasesEach = 2000;
+    const int updates = 2000;
+    const int seats = buyerThreads * purchasesEach;
+    
+    eventManagement evts;
+    ticketManagement tix(seats);
+    evts.setVerbose(false);
+    tix.setVerbose(false);
+    tix.setValidationPause(20);
+    
+    auto revision = [&](int rev)
+    {
+        Event e{"E01", "Concert rev " + to_string(rev), "rev " + to_string(rev), true};
+        e.capacity = seats;
+        return e;
+    };
+    evts.addEvent(revision(0));
+    Event first;
+    evts.getEventbyID("E01", first);
+    
+    //one entry per revision: its version and the ticket count read just before it was written.
+    //A ticket at version k must come after revision k's count and before revision k+1's was read
+    //back, otherwise it was committed while another version was current.
+    struct Revision
+    {
+        unsigned long version;
+        int ticketsBefore;
+        int ticketsAfter;
+    };
+    vector<Revision> history;       //only the updater thread touches it until join
+    history.push_back({first.version, 0, 0});
+    
+    auto updater = [&]()
+    {
+        for (int rev = 1; rev <= updates; ++rev)
+        {
+            int before = tix.getTicketcount();
+            evts.updateEvent(revision(rev));
+            int after = tix.getTicketcount();
+            Event current;
+            evts.getEventbyID("E01", current);
+            history.push_back({current.version, before, after});
+            this_thread::sleep_for(chrono::microseconds(20));
+        }
+    };
+    
+    auto buyer = [&](int id)
+    {
+        string userID = "U" + to_string(id);
+        for (int i = 0; i < purchasesEach; ++i)
+        {
+            tix.purchaseTicketValidated(userID, "Buyer " + to_string(id), "E01", evts);
+        }
+    };
+    
+    vector<thread> threads;
+    threads.emplace_back(updater);
+    for (int i = 1; i <= buyerThreads; ++i)
+    {
+        threads.emplace_back(buyer, i);
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    
+    int stale = 0;
+    int count = tix.getTicketcount();
+    for (int i = 0; i < count; ++i)
+    {
+        Ticket t = tix.getTicketat(i);
+        int rev = -1;
+        for (int k = 0; k < (int)history.size(); ++k)
+        {
+            if (history[k].version == t.eventVersion)
+            {
+                rev = k;
+            }
+        }
+        string tag = "rev " + to_string(rev);
+        bool current = rev >= 0 && i >= history[rev].ticketsBefore && (rev + 1 == (int)history.size() || i < history[rev + 1].ticketsAfter);
+        if (!current || string_view(t.eventName) != "Concert " + tag || string_view(t.eventDate) != tag)
+        {
+            stale++;
+        }
+    }
+    long rejected = tix.getPurchaseConflicts();
+    
+    cout << "Purchase attempts: " << buyerThreads * purchasesEach << ", event updates: " << updates << "\n";
+    cout << "Tickets issued: " << count << "\n";
+    cout << "Stale snapshots rejected: " << rejected << (rejected > 0 ? " (PASS)" : " (FAIL)") << "\n";
+    cout << "Tickets not at the version current at commit: " << stale << (stale == 0 ? " (PASS)" : " (FAIL)") << "\n\n";
+}
+
+//removes an event holding 500k tickets while another thread keeps buying tickets for a second event,
+//reporting the removal progress and the worst purchase latency seen during the cascade
+void benchmarkCascadingRemoval()
+{
+    cout << "\n--------Cascading Removal Benchmark--------\n";
+    
+    const int bigEventTickets = 500000;
+    
+    eventManagement evts;
+    ticketManagement tix(bigEventTickets + 100000);
+    evts.setVerbose(false);
+    tix.setVerbose(false);
+    
+    Event stadium = {"E01", "Stadium Tour", "12-31-2025", true};
+    stadium.capacity = bigEventTickets;
+    evts.addEvent(stadium);
+    evts.addEvent({"E02", "Small Gig", "01-15-2026", true});
+    Event big;
+    evts.getEventbyID("E01", big);
+    for (int i = 0; i < bigEventTickets; ++i)
+    {
+        tix.purchaseTicket("U" + to_string(i % 1000), "Fan", big);
+    }
+    cout << "Tickets sold for E01: " << tix.getTicketcount() << "\n";
+    
+    std::atomic<bool> removing{true};
+    long long worstPurchaseUs = 0;
+    int sideSales = 0;
+    thread buyer([&]()
+    {
+        while (removing)
+        {
+            auto start = chrono::steady_clock::now();
+            if (tix.purchaseTicketValidated("U1", "Fan", "E02", evts))
+            {
+                sideSales++;
+            }
+            long long us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+            worstPurchaseUs = us > worstPurchaseUs ? us : worstPurchaseUs;
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    });
+    
+    auto start = chrono::steady_clock::now();
+    {
+        removalManagement removals(evts, tix);
+        removals.removeEvent("E01");
+        Event closing;
+        cout << "E01 purchasable right after removal: " << (evts.getEventbyID("E01", closing) ? "Yes" : "No") << "\n";
+        removals.viewProgress();
+        removals.waitAll();
+        removals.viewProgress();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    removing = false;
+    buyer.join();
+    
+    cout << "Removal finished in " << seconds << " s\n";
+    cout << "Tickets bought for E02 meanwhile: " << sideSales << "\n";
+    cout << "Worst E02 purchase latency: " << worstPurchaseUs << " us\n\n";
+}
+
+//buyers purchase and cancel while a dashboard thread polls the sharded counters as fast as it can;
+//afterwards the counters are checked against a full scan of the ticket store
+void benchmarkSalesCounters()
+{
+    cout << "\n--------Live Sales Counters Benchmark--------\n";
+    
+    const int buyerThreads = 4;
+    const int purchasesPerThread = 50000;
+    
+    const int extraSeats = 5;
+    
+    eventManagement evts;
+    ticketManagement tix(buyerThreads * purchasesPerThread + 2 * extraSeats);
+    evts.setVerbose(false);
+    tix.setVerbose(false);
+    
+    Event show = {"E01", "Arena Show", "03-01-2026", true};
+    show.capacity = buyerThreads * purchasesPerThread;
+    evts.addEvent(show);
+    evts.getEventbyID("E01", show);
+    
+    std::atomic<int> running{buyerThreads};
+    auto buyer = [&](int id)
+    {
+        string userID = "U" + to_string(id);
+        for (int i = 0; i < purchasesPerThread; ++i)
+        {
+            tix.purchaseTicket(userID, "Buyer", show);
+            if (i % 10 == 0)
+            {
+                tix.cancelTicket("T" + to_string(tix.getTicketcount()));
+            }
+        }
+        running--;
+    };
+    
+    long polls = 0;
+    EventSales last;
+    thread dashboard([&]()
+    {
+        while (running > 0)
+        {
+            last = tix.getSales(show);
+            polls++;
+        }
+    });
+    
+    auto start = chrono::steady_clock::now();
+    vector<thread> buyers;
+    for (int i = 1; i <= buyerThreads; ++i)
+    {
+        buyers.emplace_back(buyer, i);
+    }
+    for (auto& t : buyers)
+    {
+        t.join();
+    }
+    dashboard.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    //fold the counters once more and compare against a scan of every ticket
+    EventSales sales = tix.getSales(show);
+    long scannedSold = 0;
+    long scannedCanceled = 0;
+    int count = tix.getTicketcount();
+    for (int i = 0; i < count; ++i)
+    {
+        Ticket t = tix.getTicketat(i);
+        scannedSold++;
+        scannedCanceled += t.isCanceled ? 1 : 0;
+    }
+    
+    auto scanStart = chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i)
+    {
+        tix.getSales(show);
+    }
+    double readNs = chrono::duration<double, nano>(chrono::steady_clock::now() - scanStart).count() / 10;
+    
+    cout << "Sold: " << sales.sold << ", Canceled: " << sales.canceled << ", Remaining: " << sales.remaining << "\n";
+    cout << "Sales rate: " << sales.ratePerSec << " tickets/s\n";
+    cout << "Dashboard polls during the run: " << polls << " (" << polls / seconds << " polls/s)\n";
+    cout << "Counter read cost: " << readNs << " ns\n";
+    bool match = sales.sold == scannedSold && sales.canceled == scannedCanceled;
+    cout << "Counters match ticket scan: " << (match ? "Yes (PASS)" : "No (FAIL)") << "\n";
+    
+    //resize the event to a few seats above what is held now: only those few may still sell
+    Event resized = show;
+    resized.capacity = (int)(sales.sold - sales.canceled) + extraSeats;
+    evts.updateEvent(resized);
+    evts.getEventbyID("E01", resized);
+    int extraSold = 0;
+    for (int i = 0; i < 2 * extraSeats; ++i)
+    {
+        extraSold += tix.purchaseTicketValidated("U0", "Late Buyer", "E01", evts) ? 1 : 0;
+    }
+    EventSales after = tix.getSales(resized);
+    bool carried = extraSold == extraSeats && after.sold == sales.sold + extraSeats && after.remaining == 0;
+    cout << "Sold after resizing to " << resized.capacity << " seats: " << extraSold << " of " << 2 * extraSeats << " attempts, remaining " << after.remaining << "\n";
+    cout << "Sold count carried over the update: " << (carried ? "Yes (PASS)" : "No (FAIL)") << "\n\n";
+}
+
+//writes a synthetic catalog (half events, half users) to a temp file and imports it into private managers
+void benchmarkBulkImport()
+{
+    cout << "\n--------Bulk Import Benchmark--------\n";
+    
+    long rows;
+    cout << "Rows to generate (0 = 10000000): ";
+    cin >> rows;
+    if (rows <= 0)
+    {
+        rows = 10000000;
+    }
+    
+    string path = (filesystem::temp_directory_path() / "ticketing_import_bench.csv").string();
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == nullptr)
+    {
+        cout << "Cannot create " << path << "\n";
+        return;
+    }
+    vector<char> buffer(1 << 20);
+    setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+    for (long i = 0; i < rows; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            fprintf(out, "E,E%ld,Event number %ld,%02ld-%02ld-2026,1,%ld\n", i, i, i % 12 + 1, i % 28 + 1, 100 + i % 900);
+        }
+        else
+        {
+            fprintf(out, "U,U%ld,User %ld,pass%ld\n", i, i, i % 10000);
+        }
+    }
+    fclose(out);
+    cout << "Generated " << rows << " rows in " << path << "\n";
+    
+    int threads = thread::hardware_concurrency() > 0 ? (int)thread::hardware_concurrency() : 1;
+    {
+        eventManagement evts((int)(rows / 2 + 1));
+        userManagement usrs((int)(rows / 2 + 1));
+        ImportReport report;
+        bulkImport(path, evts, usrs, threads, report);
+        cout << "Parser threads: " << threads << "\n";
+        printImportReport(report);
+    }
+    
+    //duplicates must be dropped before the capacity check: a full manager still takes every new ID that fits
+    out = fopen(path.c_str(), "wb");
+    if (out != nullptr)
+    {
+        fputs("E,A,a,01-01-2026,1\nE,A,a again,01-01-2026,1\nE,B,b,01-01-2026,1\nE,B,b again,01-01-2026,1\nE,C,c,01-01-2026,1\nE,D,d,01-01-2026,1\n", out);
+        fclose(out);
+        eventManagement evts(3);
+        userManagement usrs(3);
+        ImportReport report;
+        bulkImport(path, evts, usrs, 2, report);
+        Event c;
+        bool pass = report.eventsAdded == 3 && report.duplicateRows == 2 && report.overCapacityRows == 1 && evts.getEventbyID("C", c);
+        cout << "Capacity 3, rows A A B B C D: added " << report.eventsAdded << ", duplicates " << report.duplicateRows
+             << ", over capacity " << report.overCapacityRows << (pass ? " (PASS)" : " (FAIL)") << "\n\n";
+    }
+    filesystem::remove(path);
+}
+
+//exports a large ledger while another thread keeps buying and canceling, then checks
+//that the export matches the snapshot it was taken from and not the live store
+void benchmarkLedgerExport()
+{
+    cout << "\n--------Ledger Export Benchmark--------\n";
+    
+    int count;
+    cout << "Tickets in the ledger (0 = 10000000): ";
+    cin >> count;
+    if (count <= 0)
+    {
+        count = 10000000;
+    }
+    
+    eventManagement evts;
+    ticketManagement tix(count + 1000000);
+    evts.setVerbose(false);
+    tix.setVerbose(false);
+    Event show = {"E01", "Festival, \"Live\"", "08-01-2026", true};       //the CSV has to quote this
+    show.capacity = count + 1000000;
+    evts.addEvent(show);
+    evts.getEventbyID("E01", show);
+    const string fanNames[] = {"Fan", "Fan, Jr.", "Fan\nSecond line"};
+    for (int i = 0; i < count; ++i)
+    {
+        tix.purchaseTicket("U" + to_string(i % 100000), fanNames[i % 3], show);
+        if (i % 7 == 0)
+        {
+            tix.cancelTicket("T" + to_string(i + 1));
+        }
+    }
+    cout << "Ledger filled with " << tix.getTicketcount() << " tickets.\n";
+    
+    std::atomic<bool> exporting{true};
+    long liveChanges = 0;
+    thread churn([&]()
+    {
+        int next = 2;
+        while (exporting)
+        {
+            tix.purchaseTicket("U0", "Late Fan", show);
+            tix.cancelTicket("T" + to_string(next));
+            next += 7;
+            liveChanges += 2;
+        }
+    });
+    
+    string base = (filesystem::temp_directory_path() / "ticketing_ledger_bench").string();
+    int writers = thread::hardware_concurrency() > 0 ? (int)thread::hardware_concurrency() : 1;
+    for (int csv = 0; csv <= 1; ++csv)
+    {
+        ExportReport report;
+        bool ok = exportLedger(tix, base, writers, csv == 1, report);
+        cout << (csv ? "Binary + CSV" : "Binary only") << " export with " << writers << " writer(s)" << (ok ? "" : " FAILED") << "\n";
+        printExportReport(report);
+        
+        //read the parts back in order and compare each row with the ticket itself, canceled as of the snapshot
+        for (int format = 0; format <= csv; ++format)
+        {
+            long compared = 0;
+            long mismatched = 0;
+            bool readable = true;
+            auto compare = [&](const LedgerRow& row)
+            {
+                Ticket t = tix.getTicketat((int)compared++);
+                bool canceledAtSnapshot = t.canceledSeq != 0 && t.canceledSeq <= report.asOf;
+                if (row.ticketID != string_view(t.ticketID) || row.eventID != string_view(t.eventID) || row.eventName != string_view(t.eventName)
+                    || row.eventDate != string_view(t.eventDate) || row.userID != string_view(t.userID) || row.userName != string_view(t.userName) || row.eventVersion != t.eventVersion || row.canceled != canceledAtSnapshot)
+                {
+                    mismatched++;
+                }
+            };
+            for (int part = 0; part < writers; ++part)
+            {
+                string name = base + ".part" + to_string(part);
+                readable = readable && (format == 0 ? readColumnPart(name + ".tcol", compare) : readCsvPart(name + ".csv", compare));
+            }
+            bool match = readable && compared == report.rows && mismatched == 0;
+            cout << (format == 0 ? ".tcol" : ".csv") << " files read back: " << compared << " rows, " << mismatched << " differ from the ledger"
+                 << (readable ? "" : ", unreadable part") << (match ? " (PASS)" : " (FAIL)") << "\n";
+        }
+        cout << "\n";
+        for (int part = 0; part < writers; ++part)
+        {
+            filesystem::remove(base + ".part" + to_string(part) + ".tcol");
+            filesystem::remove(base + ".part" + to_string(part) + ".csv");
+        }
+    }
+    exporting = false;
+    churn.join();
+    cout << "Live purchases/cancellations during the exports: " << liveChanges << "\n\n";
+}
+
+//starts the epoll server on private managers and drives it with pipelined local clients
+void benchmarkRequestServer()
+{
+    cout << "\n--------Request Server Load Test--------\n";
+#ifdef __linux__
+    const int clients = 8;
+    const int depth = 32;
+    const int requestsPerClient = 50000;
+    const int eventCount = 20;
+    
+    eventManagement evts;
+    userManagement usrs(clients);
+    ticketManagement tix(clients * requestsPerClient);
+    evts.setVerbose(false);
+    usrs.setVerbose(false);
+    tix.setVerbose(false);
+    for (int i = 0; i < eventCount; ++i)
+    {
+        Event e = {"E" + to_string(i), "Load Event " + to_string(i), "09-09-2026", true};
+        e.capacity = clients * requestsPerClient;
+        evts.addEvent(e);
+    }
+    for (int i = 0; i < clients; ++i)
+    {
+        usrs.registerUser({"U" + to_string(i), "Load User", "pass"});
+    }
+    
+    string path = (filesystem::temp_directory_path() / "ticketing_bench.sock").string();
+    requestServer server(evts, usrs, tix);
+    if (!server.start(path))
+    {
+        cout << "Cannot listen on " << path << "\n\n";
+        return;
+    }
+    LoadReport report;
+    bool ok = runLoadClients(path, clients, depth, requestsPerClient, eventCount, report);
+    
+    //a client that pipelines without reading its replies: the server has to stop reading it
+    //instead of buffering replies without bound, and still answer everything once it reads
+    const int greedyFrames = 200000;
+    long greedyReplies = 0;
+    size_t greedyPeak = 0;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) == 0)
+    {
+        string frames;
+        for (int i = 0; i < greedyFrames; ++i)
+        {
+            putFrame(frames, opQuery, [](string& o) { putFrameString(o, "E0"); });
+        }
+        thread sender([&]()
+        {
+            size_t done = 0;
+            while (done < frames.size())
+            {
+                ssize_t n = send(fd, frames.data() + done, frames.size() - done, MSG_NOSIGNAL);
+                if (n <= 0) return;
+                done += n;
+            }
+        });
+        this_thread::sleep_for(chrono::milliseconds(300));
+        greedyPeak = server.getPeakBacklog();
+        string in;
+        char buffer[65536];
+        size_t pos = 0;
+        while (greedyReplies < greedyFrames)
+        {
+            uint32_t length;
+            if (in.size() - pos >= sizeof(length))
+            {
+                memcpy(&length, in.data() + pos, sizeof(length));
+                if (in.size() - pos - sizeof(length) >= length)
+                {
+                    pos += sizeof(length) + length;
+                    greedyReplies++;
+                    continue;
+                }
+            }
+            in.erase(0, pos);
+            pos = 0;
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            in.append(buffer, n);
+        }
+        sender.join();
+    }
+    if (fd >= 0) close(fd);
+    server.stop();
+    
+    sort(report.latenciesUs.begin(), report.latenciesUs.end());
+    cout << "Clients: " << clients << ", pipeline depth: " << depth << (ok ? "" : " (some connections failed)") << "\n";
+    cout << "Requests: " << report.requests << " (" << report.failed << " rejected by the managers)\n";
+    cout << "Throughput: " << report.requests / report.seconds << " requests/s\n";
+    cout << "Latency p50: " << percentile(report.latenciesUs, 0.50) << " us, p99: " << percentile(report.latenciesUs, 0.99)
+         << " us, p99.9: " << percentile(report.latenciesUs, 0.999) << " us\n";
+    cout << "Tickets sold: " << tix.getTicketcount() << "\n";
+    bool bounded = greedyPeak <= maxReplyBacklog + 64 && greedyReplies == greedyFrames;
+    cout << "Client pipelining " << greedyFrames << " requests without reading: peak reply backlog " << greedyPeak << " bytes (cap "
+         << maxReplyBacklog << "), " << greedyReplies << " replies received" << (bounded ? " (PASS)" : " (FAIL)") << "\n\n";
+#else
+    cout << "The request server needs Linux (epoll).\n\n";
+#endif
+}
+
+void recordTrace()
+{
+    cout << "\n--------Record Workload Trace--------\n";
+    
+    string path;
+    int threads;
+    int sessions;
+    unsigned seed;
+    cout << "Trace file: ";
+    cin >> path;
+    cout << "Threads: ";
+    cin >> threads;
+    cout << "Sessions per thread: ";
+    cin >> sessions;
+    cout << "Seed: ";
+    cin >> seed;
+    if (threads <= 0 || sessions <= 0)
+    {
+        cout << "Threads and sessions must be positive.\n\n";
+        return;
+    }
+    
+    traceRecorder recorder(threads);
+    auto start = chrono::steady_clock::now();
+    recordWorkload(recorder, threads, sessions, seed);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!recorder.save(path))
+    {
+        cout << "Cannot write " << path << "\n\n";
+        return;
+    }
+    cout << "Recorded run took " << seconds << " s. Trace saved to " << path << "\n\n";
+}
+
+//replays a trace against fresh managers, at full speed and with the recorded timing
+void replayTrace()
+{
+    cout << "\n--------Replay Workload Trace--------\n";
+    
+    string path;
+    int originalTiming;
+    cout << "Trace file: ";
+    cin >> path;
+    cout << "Keep original timing? (1 = Yes, 0 = Full speed): ";
+    cin >> originalTiming;
+    
+    traceReplayer replayer;
+    if (!replayer.load(path))
+    {
+        cout << "Cannot read trace " << path << "\n\n";
+        return;
+    }
+    eventManagement evts(replayer.countOps(trAddEvent) + 1);
+    userManagement usrs(replayer.countOps(trRegister) + 1);
+    ticketManagement tix(replayer.countOps(trPurchase) + 1);
+    evts.setVerbose(false);
+    usrs.setVerbose(false);
+    tix.setVerbose(false);
+    
+    ReplayReport report = replayer.replay(evts, usrs, tix, originalTiming == 1);
+    cout << "Operations replayed: " << report.ops << " (" << report.failedOps << " rejected by the managers)\n";
+    cout << "Recorded duration: " << report.recordedSeconds << " s\n";
+    cout << "Replay duration: " << report.seconds << " s\n";
+    cout << "Throughput: " << (report.seconds > 0 ? report.ops / report.seconds : 0) << " ops/s\n";
+    cout << "Tickets issued: " << tix.getTicketcount() << "\n\n";
+}
+
+//counts global operator new calls per purchase: copying the Event onto the heap and buying with it,
+//versus the validated path that snapshots into the request arena and stores the ticket in the pool
+void benchmarkPurchaseAllocations()
+{
+    cout << "\n--------Heap Allocations per Purchase--------\n";
+    
+    const int purchases = 200000;
+    eventManagement evts;
+    ticketManagement tix(2 * purchases + 2);
+    evts.setVerbose(false);
+    tix.setVerbose(false);
+    
+    //names longer than the small-string buffer, as real catalog entries are
+    Event tour = {"E01", "The Ultimate Concierto World Tour", "Saturday, 13 July 2025", true};
+    tour.capacity = 2 * purchases + 2;
+    evts.addEvent(tour);
+    const string userID = "U0001";
+    const string userName = "A Rather Long Customer Name";
+    
+    //first purchase on each path warms up the arena, the counter block and the pool
+    Event warm;
+    evts.getEventbyID("E01", warm);
+    tix.purchaseTicket(userID, userName, warm);
+    tix.purchaseTicketValidated(userID, userName, "E01", evts);
+    
+#ifdef countHeapAllocations
+    long before = heapAllocations;
+#endif
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < purchases; ++i)
+    {
+        Event copy;
+        evts.getEventbyID("E01", copy);
+        tix.purchaseTicket(userID, userName, copy);
+    }
+    double heapNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / purchases;
+#ifdef countHeapAllocations
+    double heapAllocs = (double)(heapAllocations - before) / purchases;
+    before = heapAllocations;
+#endif
+    
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < purchases; ++i)
+    {
+        tix.purchaseTicketValidated(userID, userName, "E01", evts);
+    }
+    double arenaNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / purchases;
+#ifdef countHeapAllocations
+    double arenaAllocs = (double)(heapAllocations - before) / purchases;
+    
+    cout << "Event copy on the heap: " << heapAllocs << " allocations, " << heapNs << " ns per purchase\n";
+    cout << "Arena snapshot + pooled ticket: " << arenaAllocs << " allocations, " << arenaNs << " ns per purchase\n";
+#else
+    cout << "Event copy on the heap: " << heapNs << " ns per purchase\n";
+    cout << "Arena snapshot + pooled ticket: " << arenaNs << " ns per purchase\n";
+    cout << "(allocation counts need a build with -DcountHeapAllocations)\n";
+#endif
+    cout << "Tickets issued: " << tix.getTicketcount() << "\n\n";
+}
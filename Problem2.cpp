@@ -9,432 +9,3957 @@
 #include <atomic>
 #include <shared_mutex>
 #include <condition_variable>
+#include <cstdint>
+#include <algorithm>
+#include <bitset>
+#include <bit>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <deque>
+#include <map>
+#include <coroutine>
+#include <queue>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BULK_SIMD 1 //per-function target attributes, picked at runtime with __builtin_cpu_supports
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 //Class/Strucs
+const uint32_t liveCanary = 0xDE71CE;
+atomic<long> liveDevices{0}; //constructed minus destroyed, for leak checks
+
+enum class DeviceKind : uint8_t {Fridge, Light, AirCon}; //type tag, checked instead of dynamic_cast
+const int deviceKinds = 3;
+
+struct DeviceState{//unpacked copy of a device's hot state
+    bool on = false;
+    int temp = 0; //setpoint in \u00B0C (fridge, aircon)
+    int level = 0; //brightness 1-3 (light)
+    uint32_t version = 0; //bumped by every write
+};
+
+enum class EventTopic : uint8_t {Power, Setpoint, Brightness};
+const int eventTopics = 3;
+
+struct DeviceEvent{//one field of one device changed
+    const void* source; //the device, for identity only, dereference it under an EpochGuard
+    uint32_t serial; //the device's serial, unlike the address never reused
+    DeviceKind kind;
+    EventTopic topic;
+    int value; //power 0/1, setpoint in \u00B0C or brightness 1-3
+    int previous;
+    uint32_t version;
+    uint64_t timeNs; //steady_clock
+};
+
+void publishDeviceChange(const void* dev, uint32_t serial, DeviceKind kind, const DeviceState& before, const DeviceState& after);
+void addDeviceChange(vector<DeviceEvent>& out, const void* dev, uint32_t serial, DeviceKind kind, const DeviceState& before, const DeviceState& after, int except = -1);
+
+//Shared by a DeviceSubscription and every device it watches. seq is bumped on each change and waited on
+//with atomic::wait; once the subscription is gone, devices drop it the next time they change.
+struct ChangeSignal{
+    atomic<uint32_t> seq{0};
+    atomic<bool> active{true};
+};
+
+enum class CommandType : uint8_t {SetPower, Toggle, SetTemp, SetBrightness};
+
+struct DeviceCommand{
+    CommandType type;
+    int value = 0; //on/off, temperature or brightness 1-3; unused for Toggle
+};
+
+struct CommandBatch{//what one Device::post call did
+    bool applied = false; //false: merged into the batch another thread is applying
+    DeviceState before, after; //set when applied
+    uint32_t commands = 0; //posted commands the batch covered
+};
+
+struct MailboxStats{
+    uint64_t received, applied;
+};
+
 class Device {//Parent Class of fridge and light
     protected:
-        mutable shared_mutex rwLock; //Read-write lock
-        condition_variable_any devStatChanged;
+        //bit 0 on, bits 8-15 setpoint (int8), bits 16-17 brightness, bits 32-63 version
+        alignas(64) atomic<uint64_t> state{0};
+        atomic<uint32_t> changes{0}; //bumped after every write; 32 bits so atomic::wait is a plain futex on it
+        atomic<uint32_t> canary{liveCanary}; //cleared by the destructor, lets stress tests spot use-after-free
+        const DeviceKind kind; //kind and serial go into every event, so they share the state's cache line
+        const uint32_t serial; //unique for the whole run, names the device's telemetry
+        inline static atomic<uint32_t> nextSerial{1};
+        mutex subsMtx; //guards subscribers, writers skip it while subscriberCount is 0
+        vector<shared_ptr<ChangeSignal>> subscribers;
+        atomic<uint32_t> subscriberCount{0};
         string id;
         string type = "Device";
-        bool isOn = false;
+        //Commands not applied yet, merged: the last setpoint wins, toggles after the last power command
+        //only count as a parity. bit 0 power set, bit 1 power value, bit 2 toggle parity, bit 3 temp set,
+        //bit 4 brightness set, bit 5 a poster is applying, bits 8-15 temp, bits 16-17 brightness,
+        //bits 20-31 commands merged (saturating)
+        atomic<uint32_t> mailbox{0};
+        atomic<uint64_t> received{0}, applied{0};
+        static const uint32_t applying = 1u << 5;
+
+        static uint64_t pack(const DeviceState& s){
+            return (uint64_t)s.on
+                | (uint64_t)(uint8_t)(int8_t)clamp(s.temp, -128, 127) << 8
+                | (uint64_t)(s.level & 3) << 16
+                | (uint64_t)s.version << 32;
+        }
+        static DeviceState unpack(uint64_t w){
+            DeviceState s;
+            s.on = w & 1;
+            s.temp = (int8_t)(uint8_t)(w >> 8);
+            s.level = (w >> 16) & 3;
+            s.version = (uint32_t)(w >> 32);
+            return s;
+        }
+        //Applies change to a copy and publishes it with one CAS, retrying if another writer got in first.
+        //change returns false to leave the state untouched. Returns the state that was replaced.
+        //With written given, the new state goes there and the caller publishes the change instead.
+        template<class F> DeviceState update(F change, DeviceState* written = nullptr){
+            uint64_t old = state.load(memory_order_relaxed);
+            while(true){
+                DeviceState s = unpack(old);
+                DeviceState before = s;
+                if(!change(s)) return before;
+                s.version = before.version + 1;
+                if(state.compare_exchange_weak(old, pack(s), memory_order_acq_rel, memory_order_relaxed)){
+                    changes.fetch_add(1, memory_order_release);
+                    changes.notify_all();
+                    notifySubscribers();
+                    if(written) *written = s;
+                    else publishDeviceChange(this, serial, kind, before, s);
+                    return before;
+                }
+            }
+        }
+        //starting state for constructors: nobody can reach the device yet, so there is nothing to publish
+        void initState(const DeviceState& s){
+            state.store(pack(s), memory_order_relaxed);
+        }
+        static uint32_t merge(uint32_t box, const DeviceCommand& c){
+            switch(c.type){
+                case CommandType::SetPower: box = (box & ~7u) | 1u | (c.value ? 2u : 0u); break;
+                case CommandType::Toggle: box ^= (box & 1u) ? 2u : 4u; break;
+                case CommandType::SetTemp: box = (box & ~(0xFFu << 8)) | 8u | (uint32_t)(uint8_t)(int8_t)clamp(c.value, -128, 127) << 8; break;
+                case CommandType::SetBrightness: box = (box & ~(3u << 16)) | 16u | (uint32_t)(c.value & 3) << 16; break;
+            }
+            uint32_t count = box >> 20;
+            return (box & 0xFFFFFu) | (count < 0xFFFu ? count + 1 : count) << 20;
+        }
+        bool accepts(const DeviceCommand& c) const{
+            switch(c.type){
+                case CommandType::SetTemp: return kind != DeviceKind::Light;
+                case CommandType::SetBrightness: return kind == DeviceKind::Light && c.value >= 1 && c.value <= 3;
+                default: return true;
+            }
+        }
+        void notifySubscribers(){
+            if(subscriberCount.load(memory_order_acquire) == 0) return;
+            lock_guard<mutex> lock(subsMtx);
+            for(size_t i = 0; i < subscribers.size();){
+                ChangeSignal& sig = *subscribers[i];
+                if(!sig.active.load()){//subscription ended, drop it here instead of making it find every device
+                    subscribers[i] = subscribers.back();
+                    subscribers.pop_back();
+                    subscriberCount--;
+                    continue;
+                }
+                sig.seq.fetch_add(1, memory_order_release);
+                sig.seq.notify_all();
+                i++;
+            }
+        }
     public:
-        Device(string id) : id(id), isOn(false){}
+        Device(string id, DeviceKind kind) : kind(kind), serial(nextSerial++), id(id){liveDevices++;}
+
+        DeviceState snapshot() const{//wait-free, one atomic load
+            return unpack(state.load(memory_order_acquire));
+        }
 
         virtual string getId(){
             return this->id;
         }
-        virtual void turnOn(bool b){
-            unique_lock lock(rwLock);
-            if(isOn == b){
-                cout<<"\033[38;5;208m"<<id<<" is already "<<(isOn ? "ON" : "OFF")<<"\033[0m"<<endl;
+        virtual bool setOn(bool b){//returns false if it already was in that state
+            DeviceState before = update([b](DeviceState& s){
+                if(s.on == b) return false;
+                s.on = b;
+                return true;
+            });
+            return before.on != b;
+        }
+        void reportOn(bool changed, bool b){
+            if(!changed){
+                cout<<"\033[38;5;208m"<<id<<" is already "<<(b ? "ON" : "OFF")<<"\033[0m"<<endl;
                 return;
             }
-            isOn = b;
-            cout<<"\033[1;33m"<<id<<" is turned "<<(isOn ? "ON" : "OFF")<<"\033[0m"<<endl;
-            devStatChanged.notify_all();
+            cout<<"\033[1;33m"<<id<<" is turned "<<(b ? "ON" : "OFF")<<"\033[0m"<<endl;
+        }
+        void reportMerged(){//the thread applying the batch reports the result
+            cout<<"\033[90m"<<id<<" is busy, command merged into its pending update\033[0m"<<endl;
+        }
+        virtual void turnOn(bool b){
+            CommandBatch r = post({CommandType::SetPower, b});
+            if(r.applied) reportOn(r.before.on != r.after.on, r.after.on);
         }
         virtual string getOn(){
-            return this->isOn ? "ON" : "OFF";
+            return snapshot().on ? "ON" : "OFF";
         }
         virtual void toggleOn(){
-            this->isOn ? isOn = false : isOn = true;
+            update([](DeviceState& s){
+                s.on = !s.on;
+                return true;
+            });
+        }
+        //Queues a command in the device's mailbox. If nobody is applying, this caller applies every
+        //pending command in one update (one CAS, one round of events) and keeps going until the mailbox
+        //stays empty; otherwise the command is merged and the applying thread picks it up.
+        CommandBatch post(const DeviceCommand& c){
+            CommandBatch batch;
+            if(!accepts(c)) return batch;
+            received.fetch_add(1, memory_order_relaxed);
+            uint32_t box = mailbox.load(memory_order_relaxed);
+            while(!mailbox.compare_exchange_weak(box, merge(box, c) | applying, memory_order_acq_rel, memory_order_relaxed)){}
+            if(box & applying) return batch;
+            batch.applied = true;
+            bool first = true;
+            while(true){
+                uint32_t cmds = mailbox.exchange(applying, memory_order_acq_rel);
+                if(cmds & 0x1Fu){
+                    batch.commands += cmds >> 20;
+                    DeviceState before = update([cmds](DeviceState& s){
+                        DeviceState old = s;
+                        if(cmds & 1u) s.on = cmds & 2u;
+                        else if(cmds & 4u) s.on = !s.on;
+                        if(cmds & 8u) s.temp = (int8_t)(cmds >> 8);
+                        if(cmds & 16u) s.level = (cmds >> 16) & 3;
+                        return s.on != old.on || s.temp != old.temp || s.level != old.level;
+                    });
+                    if(first) batch.before = before;
+                    first = false;
+                    applied.fetch_add(1, memory_order_relaxed);
+                }
+                uint32_t expected = applying;
+                if(mailbox.compare_exchange_strong(expected, 0, memory_order_acq_rel)) break;
+            }
+            batch.after = snapshot();
+            return batch;
+        }
+        //For bulk commands: one CAS like an uncontended post, skipping the mailbox (a command merged there
+        //lands after it). Publishes nothing: on a change it fills before and after and returns true, and
+        //the caller publishes a whole batch of devices at once.
+        bool apply(const DeviceCommand& c, DeviceState& before, DeviceState& after){
+            if(!accepts(c)) return false;
+            bool changed = false;
+            before = update([&c, &changed](DeviceState& s){
+                DeviceState old = s;
+                switch(c.type){
+                    case CommandType::SetPower: s.on = c.value; break;
+                    case CommandType::Toggle: s.on = !s.on; break;
+                    case CommandType::SetTemp: s.temp = clamp(c.value, -128, 127); break;
+                    case CommandType::SetBrightness: s.level = c.value; break;
+                }
+                changed = s.on != old.on || s.temp != old.temp || s.level != old.level;
+                return changed;
+            }, &after);
+            return changed;
+        }
+        MailboxStats mailboxStats() const{
+            return {received.load(), applied.load()};
+        }
+        //read before checking the state, then pass to waitForChange so a write in between is not missed
+        uint32_t changeCount() const{
+            return changes.load(memory_order_acquire);
+        }
+        //blocks in atomic::wait until a write after seen, returns the new count
+        uint32_t waitForChange(uint32_t seen) const{
+            changes.wait(seen, memory_order_acquire);
+            return changes.load(memory_order_acquire);
         }
         virtual void waitUntilOn() {
-            shared_lock lock(rwLock);
-            devStatChanged.wait(lock, [this]() {
-                return isOn;
-            });
+            uint32_t seen = changeCount();
+            while(!snapshot().on) seen = waitForChange(seen);
+        }
+        void subscribe(shared_ptr<ChangeSignal> sig){
+            lock_guard<mutex> lock(subsMtx);
+            subscribers.push_back(move(sig));
+            subscriberCount++;
         }
         virtual string getType(){
             return type;
         }
+        uint32_t getSerial() const{
+            return serial;
+        }
+        DeviceKind getKind() const{
+            return kind;
+        }
+        bool isAlive() const{
+            return canary.load() == liveCanary;
+        }
         virtual void showStatus() = 0;
-        virtual ~Device(){}
+        virtual ~Device(){
+            notifySubscribers(); //being freed counts as a change for anyone watching
+            canary.store(0);
+            liveDevices--;
+        }
 };
 
 class Fridge : public Device {
     protected:
-        int temperature;
         string type = "Fridge";
     public:
-        Fridge(string id) : Device(id) {temperature = 5;} //get id used in making this obj to base constructor
+        Fridge(string id) : Device(id, DeviceKind::Fridge) {initState({false, 5});} //get id used in making this obj to base constructor
 
         void showStatus() override {
-            shared_lock lock(rwLock);
-            cout<<id<<"(Fridge) is "<< (isOn ? "ON" : "OFF")<<" set at "<<temperature<<"\u00B0C"<<endl;
+            DeviceState s = snapshot();
+            cout<<id<<"(Fridge) is "<< (s.on ? "ON" : "OFF")<<" set at "<<s.temp<<"\u00B0C"<<endl;
         }
 
         int getTemp(){
-            shared_lock lock(rwLock);
-            return this->temperature;
+            return snapshot().temp;
         }
 
         void setTemp(int temp){
-            unique_lock lock(rwLock);
-            this->temperature = temp;
+            update([temp](DeviceState& s){
+                s.temp = temp;
+                return true;
+            });
+        }
+
+        void setOnAndTemp(bool b, int temp){//both in the same CAS, readers never see one without the other
+            update([b, temp](DeviceState& s){
+                s.on = b;
+                s.temp = temp;
+                return true;
+            });
+        }
+
+        void reportTemp(int temp){
+            cout<<"Turned "<<this->id<<" temperature to "<<temp<<"\u00B0C."<<endl;
         }
 
-        void putTemp(int temp){
-            setTemp(temp);
-            cout<<"Turned "<<this->id<<" temperature to "<<this->temperature<<"\u00B0C."<<endl;
+        void putTemp(int temp){//with other commands in the same batch, reports where it ended up
+            CommandBatch r = post({CommandType::SetTemp, temp});
+            if(r.applied) reportTemp(r.after.temp);
         }
 };
 
 class Light : public Device {
     protected:
-        string brightness; //Low, Mid, High, Mid is default
         string type = "Light";
     public:
-        Light(string id) : Device(id) {brightness = "Mid";} //get id used in making this obj to base constructor
+        static string levelName(int lvl){//Low, Mid, High, Mid is default
+            switch(lvl){
+                case 1: return "Low";
+                case 3: return "High";
+                default: return "Mid";
+            }
+        }
+        Light(string id) : Device(id, DeviceKind::Light) {initState({false, 0, 2});} //get id used in making this obj to base constructor
         
         void showStatus() override {
-            shared_lock lock(rwLock);
-            cout<<id<<"(Light) is "<< (isOn ? "ON" : "OFF")<<" set at "<<brightness<<" brightness"<<endl;
+            DeviceState s = snapshot();
+            cout<<id<<"(Light) is "<< (s.on ? "ON" : "OFF")<<" set at "<<levelName(s.level)<<" brightness"<<endl;
         }
         void setBrightness(int lvl){
-            unique_lock lock(rwLock);
-            switch(lvl){
-                case 1: this->brightness = "Low"; break;
-                case 2: this->brightness = "Mid"; break;
-                case 3: this->brightness = "High"; break;
-            }
-            
+            if(lvl < 1 || lvl > 3) return;
+            update([lvl](DeviceState& s){
+                s.level = lvl;
+                return true;
+            });
+        }
+        string getBrightness(){
+            return levelName(snapshot().level);
+        }
+        void reportBrightness(){
+            cout<<"Turned "<<this->id<<" brightness to "<<getBrightness()<<"."<<endl;
         }
         void putBrightness(int lvl){
-            setBrightness(lvl);
-            cout<<"Turned "<<this->id<<" brightness to "<<this->brightness<<"."<<endl;
+            if(lvl < 1 || lvl > 3) return;
+            if(post({CommandType::SetBrightness, lvl}).applied) reportBrightness();
         }
 };
 
 class AirCon : public Device {
     protected:
-        int temperature;
         string type = "Air Conditioner";
     public:
-        AirCon(string id) : Device(id) {temperature = 20;} //get id used in making this obj to base constructor
+        AirCon(string id) : Device(id, DeviceKind::AirCon) {initState({false, 20});} //get id used in making this obj to base constructor
 
         void showStatus() override {
-            shared_lock lock(rwLock);
-            cout<<id<<"(Air Conditioner) is "<< (isOn ? "ON" : "OFF")<<" set at "<<temperature<<"\u00B0C"<<endl;
+            DeviceState s = snapshot();
+            cout<<id<<"(Air Conditioner) is "<< (s.on ? "ON" : "OFF")<<" set at "<<s.temp<<"\u00B0C"<<endl;
         }
 
         int getTemp(){
-            shared_lock lock(rwLock);
-            return this->temperature;
+            return snapshot().temp;
         }
 
         void setTemp(int temp){
-            unique_lock lock(rwLock);
-            this->temperature = temp;
+            update([temp](DeviceState& s){
+                s.temp = temp;
+                return true;
+            });
         }
 
-        void putTemp(int temp){
-            setTemp(temp);
-            cout<<"Turned "<<this->id<<" temperature to "<<this->temperature<<"\u00B0C."<<endl;
+        void reportTemp(int temp){
+            cout<<"Turned "<<this->id<<" temperature to "<<temp<<"\u00B0C."<<endl;
         }
-};
 
-struct User {
-    string user;
-    bool isLoggedIn = 0;
+        void putTemp(int temp){//with other commands in the same batch, reports where it ended up
+            CommandBatch r = post({CommandType::SetTemp, temp});
+            if(r.applied) reportTemp(r.after.temp);
+        }
 };
 
-class TrackedMutex{
+//"Wake me when any of these devices changes". Devices only need to be alive (EpochGuard) while the
+//subscription is created; after that it holds nothing of theirs and can outlive them.
+class DeviceSubscription{
     private:
-        atomic<bool> isLocked = false;
-        string name;
-        string owner;
-
+        shared_ptr<ChangeSignal> signal = make_shared<ChangeSignal>();
+        uint32_t seen = 0;
     public:
-        TrackedMutex(string name) : name(name), owner("None"){}
-        
-        void flagLock(string str){
-            isLocked = true;
-            owner = str;
+        DeviceSubscription(const vector<Device*>& watched){
+            for(Device* d : watched) d->subscribe(signal);
         }
-        void flagUnlock(){
-            isLocked = false;
-            owner = "None";
+        ~DeviceSubscription(){
+            cancel();
         }
+        DeviceSubscription(const DeviceSubscription&) = delete;
+        DeviceSubscription& operator=(const DeviceSubscription&) = delete;
 
-        //read onlys
-        bool checkLock() const{ 
-            return isLocked;
+        //blocks until a watched device changed since the last call, false once cancelled
+        bool wait(){
+            uint32_t cur;
+            while((cur = signal->seq.load(memory_order_acquire)) == seen) signal->seq.wait(seen, memory_order_acquire);
+            seen = cur;
+            return signal->active.load();
         }
-        string getOwner() const{
-            return owner;
+        //same without blocking, true if anything changed
+        bool poll(){
+            uint32_t cur = signal->seq.load(memory_order_acquire);
+            if(cur == seen) return false;
+            seen = cur;
+            return true;
         }
-        string getName() const{
-            return name;
+        //safe from another thread, wakes a blocked wait()
+        void cancel(){
+            if(!signal->active.exchange(false)) return;
+            signal->seq.fetch_add(1, memory_order_release);
+            signal->seq.notify_all();
         }
-
 };
 
-//Global Variables
-vector<Device*> devices;
-vector<User> users;
+//Vyukov's bounded MPMC ring: a push or pop is one CAS on its index plus a sequence store in the cell.
+//Full and empty are reported instead of waited on, so the caller picks the policy.
+template<class T> class BoundedQueue{
+    private:
+        struct Cell{
+            atomic<size_t> seq;
+            T value;
+        };
+        unique_ptr<Cell[]> cells;
+        size_t mask;
+        alignas(64) atomic<size_t> tail{0}; //next push
+        alignas(64) atomic<size_t> head{0}; //next pop
+    public:
+        explicit BoundedQueue(size_t capacity){
+            size_t cap = 2;
+            while(cap < capacity) cap *= 2;
+            cells.reset(new Cell[cap]);
+            mask = cap - 1;
+            for(size_t i = 0; i < cap; i++) cells[i].seq.store(i, memory_order_relaxed);
+        }
+        bool push(const T& v){
+            size_t pos = tail.load(memory_order_relaxed);
+            while(true){
+                Cell& c = cells[pos & mask];
+                intptr_t dif = (intptr_t)c.seq.load(memory_order_acquire) - (intptr_t)pos;
+                if(dif == 0){
+                    if(tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                        c.value = v;
+                        c.seq.store(pos + 1, memory_order_release);
+                        return true;
+                    }
+                }
+                else if(dif < 0) return false; //full
+                else pos = tail.load(memory_order_relaxed);
+            }
+        }
+        bool pop(T& v){
+            size_t pos = head.load(memory_order_relaxed);
+            while(true){
+                Cell& c = cells[pos & mask];
+                intptr_t dif = (intptr_t)c.seq.load(memory_order_acquire) - (intptr_t)(pos + 1);
+                if(dif == 0){
+                    if(head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                        v = c.value;
+                        c.seq.store(pos + mask + 1, memory_order_release);
+                        return true;
+                    }
+                }
+                else if(dif < 0) return false; //empty
+                else pos = head.load(memory_order_relaxed);
+            }
+        }
+        size_t popBatch(T* out, size_t max){
+            size_t n = 0;
+            while(n < max && pop(out[n])) n++;
+            return n;
+        }
+        size_t capacity() const{
+            return mask + 1;
+        }
+};
 
-mutex devMtx;
-mutex userMtx;
-recursive_mutex printMtx;
+enum class OverflowPolicy {Drop, Block}; //full queue: lose the event, or make the publisher wait
 
-TrackedMutex devMutex("Device Mutex");
-TrackedMutex userMutex("User Mutex");
-TrackedMutex printMutex("Print Mutex");
+struct BusStats{
+    long queued = 0; //accepted for this subscriber, delivered == queued means it is idle
+    long delivered = 0;
+    long dropped = 0;
+    long blocked = 0; //events whose publisher had to wait for room
+    long batches = 0;
+};
 
-//for generating unique randoms for each thread
-random_device rd;
-mt19937 gen(rd());
+//Device state changes fan out to every subscriber of the event's topic. Each subscriber has its own
+//bounded queues, one per partition; a device always hashes to the same partition so its events stay
+//in order. Each subscriber drains its queues in batches on its own thread.
+class EventBus{
+    public:
+        using Handler = function<void(const DeviceEvent*, size_t)>;
+        static const int maxSubscribers = 16;
+        static const int partitions = 4;
+        static const size_t batchSize = 256;
+    private:
+        struct Subscriber{
+            string name;
+            uint32_t topics;
+            OverflowPolicy policy;
+            Handler handler;
+            vector<unique_ptr<BoundedQueue<DeviceEvent>>> queues;
+            vector<DeviceEvent> spill; //only the worker touches it: what its own handler published into a full queue
+            atomic<bool> running{true};
+            atomic<bool> sleeping{false};
+            atomic<uint32_t> wakeSeq{0};
+            atomic<long> queued{0}, delivered{0}, dropped{0}, blocked{0}, batches{0};
+            thread worker;
 
-//Prototypes
-void mainMenu();
-void startThreads();
-void simulateUsage(int threadId);
-void deviceManagement();
-void addDev();
-void removeDev();
-void listDev();
-void displayDev();
-void userManagement();
-void deviceControl();
-void concurrencyControl();
-void livenessCheck();
-void listUser();
-void removeUser();
+            void wake(){
+                if(sleeping.load() && sleeping.exchange(false)){
+                    wakeSeq.fetch_add(1);
+                    wakeSeq.notify_one();
+                }
+            }
+            void handed(size_t n){
+                delivered += n;
+                delivered.notify_all(); //for waitDelivered
+            }
+            size_t drainOnce(vector<DeviceEvent>& batch){
+                size_t total = 0;
+                if(!spill.empty()){
+                    vector<DeviceEvent> mine;
+                    mine.swap(spill);
+                    for(size_t i = 0; i < mine.size(); i += batchSize){
+                        size_t n = min(batchSize, mine.size() - i);
+                        handler(mine.data() + i, n);
+                        handed(n);
+                        batches++;
+                    }
+                    total += mine.size();
+                }
+                for(auto& q : queues){
+                    size_t n = q->popBatch(batch.data(), batch.size());
+                    if(n == 0) continue;
+                    handler(batch.data(), n);
+                    handed(n);
+                    batches++;
+                    total += n;
+                }
+                return total;
+            }
+            void run(){
+                vector<DeviceEvent> batch(batchSize);
+                int idle = 0;
+                while(true){
+                    if(drainOnce(batch) > 0){
+                        idle = 0;
+                        continue;
+                    }
+                    if(!running.load()){
+                        while(drainOnce(batch) > 0){} //whatever was published before the stop
+                        return;
+                    }
+                    if(++idle < 64){
+                        this_thread::yield();
+                        continue;
+                    }
+                    //announce the sleep, look once more, then wait; publishers see sleeping after their push
+                    uint32_t seq = wakeSeq.load();
+                    sleeping.store(true);
+                    if(drainOnce(batch) > 0 || !running.load()){
+                        sleeping.store(false);
+                        continue;
+                    }
+                    wakeSeq.wait(seq);
+                    idle = 0;
+                }
+            }
+        };
 
-string getColor(int threadId);
-void addUser();
-void makeExample();
+        atomic<Subscriber*> active[maxSubscribers] = {};
+        atomic<int> topicCount[eventTopics] = {};
+        mutex subscribeMtx;
+        vector<unique_ptr<Subscriber>> owned; //kept until the bus goes, a publisher may still hold a pointer
 
-int getCh(int max);
-void showLocks();
+        static BusStats statsOf(const Subscriber& sub){
+            BusStats st;
+            st.queued = sub.queued;
+            st.delivered = sub.delivered;
+            st.dropped = sub.dropped;
+            st.blocked = sub.blocked;
+            st.batches = sub.batches;
+            return st;
+        }
+    public:
+        ~EventBus(){
+            for(int i = 0; i < maxSubscribers; i++) unsubscribe(i);
+        }
+        //returns the subscriber id, or -1 when all slots are taken
+        int subscribe(const string& name, uint32_t topicMask, Handler handler,
+                      OverflowPolicy policy = OverflowPolicy::Drop, size_t capacity = 4096){
+            lock_guard<mutex> lock(subscribeMtx);
+            int id = -1;
+            for(int i = 0; i < maxSubscribers && id < 0; i++) if(!active[i].load()) id = i;
+            if(id < 0) return -1;
+            auto sub = make_unique<Subscriber>();
+            sub->name = name;
+            sub->topics = topicMask;
+            sub->policy = policy;
+            sub->handler = move(handler);
+            for(int p = 0; p < partitions; p++) sub->queues.push_back(make_unique<BoundedQueue<DeviceEvent>>(capacity));
+            Subscriber* raw = sub.get();
+            raw->worker = thread([raw](){raw->run();});
+            owned.push_back(move(sub));
+            active[id].store(raw);
+            for(int t = 0; t < eventTopics; t++) if(topicMask & (1u << t)) topicCount[t]++;
+            return id;
+        }
+        //stops delivery: queued events are still handed over, later ones are not. Returns the final stats.
+        BusStats unsubscribe(int id){
+            if(id < 0 || id >= maxSubscribers) return {};
+            Subscriber* sub;
+            {
+                lock_guard<mutex> lock(subscribeMtx);
+                sub = active[id].exchange(nullptr);
+                if(!sub) return {};
+                for(int t = 0; t < eventTopics; t++) if(sub->topics & (1u << t)) topicCount[t]--;
+            }
+            sub->running.store(false);
+            sub->wakeSeq.fetch_add(1);
+            sub->wakeSeq.notify_one();
+            sub->worker.join();
+            sub->delivered.notify_all(); //a waitDelivered that saw running just before it went
+            return statsOf(*sub);
+        }
+        //whether any subscriber, not counting except, takes topic t
+        bool wants(EventTopic t, int except = -1) const{
+            int n = topicCount[(int)t].load(memory_order_relaxed);
+            Subscriber* sub = (except >= 0 && except < maxSubscribers) ? active[except].load(memory_order_acquire) : nullptr;
+            if(sub && (sub->topics & (1u << (int)t))) n--;
+            return n > 0;
+        }
+    private:
+        //queues e for sub by its policy; false if it was dropped, or went to the spill (already counted)
+        static bool push(Subscriber* sub, const DeviceEvent& e){
+            BoundedQueue<DeviceEvent>& q = *sub->queues[((uintptr_t)e.source >> 6) % partitions];
+            if(q.push(e)) return true;
+            if(sub->policy == OverflowPolicy::Drop){
+                sub->dropped++;
+                return false;
+            }
+            if(this_thread::get_id() == sub->worker.get_id()){//its own handler: waiting would never end
+                sub->spill.push_back(e);
+                sub->queued++;
+                return false;
+            }
+            sub->blocked++;
+            while(!q.push(e)){
+                sub->wake(); //it may be asleep on events this batch already pushed
+                if(!sub->running.load()){
+                    sub->dropped++;
+                    return false;
+                }
+                this_thread::yield();
+            }
+            return true;
+        }
+    public:
+        void publish(const DeviceEvent& e){
+            publishBatch(&e, 1);
+        }
+        //per subscriber one count and one wake-up for the whole batch; a device's events keep their order.
+        //Subscriber except is left out, for a publisher that already did its work.
+        void publishBatch(const DeviceEvent* e, size_t n, int except = -1){
+            for(int id = 0; id < maxSubscribers; id++){
+                Subscriber* sub = active[id].load(memory_order_acquire);
+                if(!sub || id == except) continue;
+                long pushed = 0;
+                for(size_t i = 0; i < n; i++){
+                    if(sub->topics & (1u << (int)e[i].topic)) pushed += push(sub, e[i]);
+                }
+                if(pushed == 0) continue;
+                sub->queued += pushed;
+                atomic_thread_fence(memory_order_seq_cst); //orders the pushes before reading sleeping
+                sub->wake();
+            }
+        }
+        //blocks until the subscriber has handed over at least target events, or is being stopped
+        void waitDelivered(int id, long target) const{
+            Subscriber* sub = (id >= 0 && id < maxSubscribers) ? active[id].load() : nullptr;
+            if(!sub) return;
+            long seen;
+            while((seen = sub->delivered.load()) < target && sub->running.load()) sub->delivered.wait(seen);
+        }
+        BusStats stats(int id) const{
+            Subscriber* sub = (id >= 0 && id < maxSubscribers) ? active[id].load() : nullptr;
+            return sub ? statsOf(*sub) : BusStats();
+        }
+};
 
-void flagLock(TrackedMutex& mtx, string name);
-void flagUnlock(TrackedMutex& mtx);
+EventBus bus;
 
-//Main
-int main(){
-    SetConsoleOutputCP(CP_UTF8); //for degrees
+uint32_t topicBit(EventTopic t){
+    return 1u << (int)t;
+}
 
+//the events of one change that anyone but subscriber except subscribes to, added to out
+void addDeviceChange(vector<DeviceEvent>& out, const void* dev, uint32_t serial, DeviceKind kind, const DeviceState& before, const DeviceState& after, int except){
+    bool power = before.on != after.on && bus.wants(EventTopic::Power, except);
+    bool setpoint = before.temp != after.temp && bus.wants(EventTopic::Setpoint, except);
+    bool level = before.level != after.level && bus.wants(EventTopic::Brightness, except);
+    if(!power && !setpoint && !level) return;
+    DeviceEvent e;
+    e.source = dev;
+    e.serial = serial;
+    e.kind = kind;
+    e.version = after.version;
+    e.timeNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    if(power){
+        e.topic = EventTopic::Power; e.value = after.on; e.previous = before.on;
+        out.push_back(e);
+    }
+    if(setpoint){
+        e.topic = EventTopic::Setpoint; e.value = after.temp; e.previous = before.temp;
+        out.push_back(e);
+    }
+    if(level){
+        e.topic = EventTopic::Brightness; e.value = after.level; e.previous = before.level;
+        out.push_back(e);
+    }
+}
 
-    // makeExample();
-    //Main Menu
-    mainMenu();
+void publishDeviceChange(const void* dev, uint32_t serial, DeviceKind kind, const DeviceState& before, const DeviceState& after){
+    if(!bus.wants(EventTopic::Power) && !bus.wants(EventTopic::Setpoint) && !bus.wants(EventTopic::Brightness)) return;
+    thread_local vector<DeviceEvent> events; //no allocation per change
+    events.clear();
+    addDeviceChange(events, dev, serial, kind, before, after);
+    for(const DeviceEvent& e : events) bus.publish(e);
+}
 
-    return 0;
+//Small number for the calling thread, handed out the first time a thread asks
+uint32_t threadNumber(){
+    static atomic<uint32_t> next{0};
+    thread_local uint32_t number = ++next;
+    return number;
 }
 
-//Functions
-void mainMenu(){
-    int ch;
-    while(true){
-        cout<<"====== Smart Home System ======"<<endl;
-        cout<<"1 - Simulate Multiple Threads"<<endl;
-        cout<<"2 - Device Management"<<endl;
-        cout<<"3 - User Management"<<endl;
-        cout<<"4 - Concurrency Control"<<endl;
-        cout<<"0 - Exit"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Enter Choice: ";
-        ch = getCh(4);
-        if(ch == -1){
-            continue;
-        }
-        cout<<"\n"<<endl;
+//Lock order validator in the style of the kernel's lockdep. Every TrackedMutex name is a lock class.
+//While it is on, each thread keeps a stack of the locks it holds, and blocking on lock B while holding
+//A records the ordering A -> B. When a new ordering closes a cycle with orderings seen before, in any
+//thread, two threads can deadlock on those locks; the cycle is reported once, even if it never happened.
+//While it is off a lock costs one relaxed load more.
+class LockDep{
+    public:
+        static const int maxClasses = 64;
+    private:
+        struct Held{
+            const void* lock;
+            int cls;
+        };
+        static const int maxHeld = 16;
+        inline static thread_local Held held[maxHeld];
+        inline static thread_local int depth = 0;
 
-        switch(ch){
-            case 1: startThreads(); break;
-            case 2: deviceManagement(); break;
-            case 3: userManagement(); break;
-            case 4: showLocks(); break;
-            case 0:
-                cout<<"Exiting... \n"<<endl;
-                cout<<"Group 2"<<endl;
-                cout<<"Bea Ganotisi"<<endl;
-                cout<<"Denise Ballano"<<endl;
-                cout<<"Charisse See"<<endl; 
-                cout<<"\n"<<endl;
+        atomic<bool> enabled{false};
+        atomic<uint64_t> after[maxClasses] = {}; //bit j of after[i]: j was taken while holding i
+        atomic<long> orderings{0};
+        mutex graphMtx;
+        vector<string> names;
+        vector<string> found;
+
+        //i -> ... -> j over recorded orderings, empty if there is no path
+        vector<int> pathFrom(int i, int j){
+            vector<int> parent(maxClasses, -1);
+            deque<int> todo{i};
+            parent[i] = i;
+            while(!todo.empty()){
+                int c = todo.front();
+                todo.pop_front();
+                if(c == j){
+                    vector<int> path{j};
+                    while(path.back() != i) path.push_back(parent[path.back()]);
+                    reverse(path.begin(), path.end());
+                    return path;
+                }
+                uint64_t next = after[c].load();
+                for(int n = 0; n < maxClasses; n++){
+                    if((next >> n & 1) && parent[n] < 0){
+                        parent[n] = c;
+                        todo.push_back(n);
+                    }
+                }
+            }
+            return {};
+        }
+        void addOrdering(int from, int to){
+            lock_guard<mutex> lock(graphMtx);
+            if(after[from].load() >> to & 1) return; //another thread just added it
+            vector<int> back = pathFrom(to, from);
+            after[from].fetch_or(1ull << to);
+            orderings++;
+            if(back.empty()) return;
+            string text = names[from];
+            for(int c : back) text += " -> " + names[c];
+            text += " (thread " + to_string(threadNumber()) + " took " + names[to] + " while holding " + names[from] + ")";
+            found.push_back(text);
+        }
+    public:
+        int classOf(const string& name){
+            lock_guard<mutex> lock(graphMtx);
+            for(int i = 0; i < (int)names.size(); i++) if(names[i] == name) return i;
+            if((int)names.size() == maxClasses) return -1; //untracked
+            names.push_back(name);
+            return names.size() - 1;
+        }
+        bool on() const{
+            return enabled.load(memory_order_relaxed);
+        }
+        void enable(bool on){
+            enabled = on;
+        }
+        //blocking: a try_lock cannot deadlock, it is only pushed so that later locks see it held
+        void acquiring(const void* lock, int cls, bool blocking){
+            if(cls < 0) return;
+            bool reentry = false;
+            for(int i = 0; i < depth; i++) reentry |= (held[i].lock == lock);
+            if(blocking && !reentry){
+                for(int i = 0; i < depth; i++){
+                    int from = held[i].cls;
+                    if(from != cls && !(after[from].load(memory_order_relaxed) >> cls & 1)) addOrdering(from, cls);
+                }
+            }
+            if(depth < maxHeld) held[depth++] = {lock, cls};
+        }
+        static bool holding(){
+            return depth > 0;
+        }
+        void released(const void* lock){
+            for(int i = depth - 1; i >= 0; i--){
+                if(held[i].lock != lock) continue;
+                for(int k = i; k < depth - 1; k++) held[k] = held[k + 1];
+                depth--;
                 return;
+            }
         }
-    }
-}
-
-void startThreads(){
-    if (devices.empty() || users.size() < 3){
-        cout<<"Please ensure at least 3 users and 1 or more devices are added."<<endl;
-        return;
-    }
+        vector<string> reports(){
+            lock_guard<mutex> lock(graphMtx);
+            return found;
+        }
+        long orderingCount() const{
+            return orderings.load();
+        }
+};
 
-    cout<<"\033[1;32mStarting multiple threads...\033[0m"<<endl;
-    vector<thread> threads;
-    for (int i = 1; i <= 3; i++){
-        threads.emplace_back(simulateUsage, i);
-    }
+LockDep lockdep;
 
-    for (auto& t : threads) t.join();
-    cout<<"Simulation done!\n\n"<<endl;
-    return;
-}
+//Lockable wrapper that knows who holds it and feeds the lock order validator. M is mutex or recursive_mutex.
+template <typename M = mutex>
+class TrackedMutex{
+    private:
+        M m;
+        string name;
+        int cls;
+        atomic<uint32_t> owner{0}; //thread number, 0 while unlocked
+        uint32_t depth = 0; //only touched by the owner
 
-void simulateUsage(int threadId){
-    uniform_int_distribution<> secDist(1,2); //for random (sec)
-    string color = getColor(threadId);
-    int sec = secDist(gen); //diff delays for each thread
-    // int sec = 0; //set delays
+    public:
+        explicit TrackedMutex(string name) : name(name), cls(lockdep.classOf(name)){}
+        TrackedMutex(const TrackedMutex&) = delete;
+        TrackedMutex& operator=(const TrackedMutex&) = delete;
 
-    uniform_int_distribution<> userDist(0, ((users.size())-1)); //for random (user)
-    int userId;
-    while(true){
-        lock_guard<mutex> lock(userMtx);
-        userId = userDist(gen);
-        if (userId < 0 || userId >= users.size()){ //check if userIndex is out of bounds
-            lock_guard<recursive_mutex> lock(printMtx);
-            flagLock(printMutex, "Thread "+ to_string(threadId));
-            cout<<color<<"[Thread " << threadId << "]"<<"\033[1;31mInvalid user index.\033[0m"<<endl;
-            flagUnlock(printMutex);
-            continue;
-        } 
-        User& user = users[userId];
-        string name = user.user;
-        if (user.isLoggedIn){
-            lock_guard<recursive_mutex> lock(printMtx);
-            flagLock(printMutex, "Thread "+ to_string(threadId));
-            cout<<color<<"[Thread " << threadId << "]"<<"\033[1;31m "<<name<<" is already logged in.\033[0m"<<endl;
-            flagUnlock(printMutex);
-            continue;
+        void lock(){
+            if(lockdep.on()) lockdep.acquiring(this, cls, true);
+            m.lock();
+            if(depth++ == 0) owner.store(threadNumber(), memory_order_relaxed);
         }
-        user.isLoggedIn = true; //log in user
-        {
-            flagLock(printMutex, "Thread "+ to_string(threadId));
-            lock_guard<recursive_mutex> lock(printMtx);
-            cout<<color<<"[Thread " << threadId << "] User "<<user.user<<" logged in.\033[0m"<<endl;
-            flagUnlock(printMutex);
+        bool try_lock(){
+            if(!m.try_lock()) return false;
+            if(lockdep.on()) lockdep.acquiring(this, cls, false);
+            if(depth++ == 0) owner.store(threadNumber(), memory_order_relaxed);
+            return true;
+        }
+        void unlock(){
+            if(LockDep::holding()) lockdep.released(this);
+            if(--depth == 0) owner.store(0, memory_order_relaxed);
+            m.unlock();
         }
-        
-        flagUnlock(userMutex);
-        break;
-    }
-    
-    //LOG IN USER
-    {
-        scoped_lock<recursive_mutex, mutex> lock(printMtx, userMtx); //printMtx makes sure no interleaved output, userMtx makes sure no race conditions
-        
-    }
-    User& user = users[userId];
-    string name = user.user;
-    this_thread::sleep_for(chrono::seconds(sec));
-    
-    //USE DEVICES
-    for(int i = 0; i < 3; i++){//simulate 3 actions
-        Device* dev = nullptr;
 
-        if(devices.empty()){//if no devices
-            cout<<color<<"[Thread "<< threadId << "]\033[0mNo devices available."<<endl;
-            return;
+        //read onlys
+        bool checkLock() const{ 
+            return owner.load(memory_order_relaxed) != 0;
         }
-        uniform_int_distribution<> devDist(0, ((devices.size())-1)); //for random (user)
-        int deviceIndex = devDist(gen); //get a random device index 
-        dev = devices[deviceIndex];
-
-        {//Print using device
-            lock_guard<recursive_mutex> lock(printMtx); //makes sure no interleaved output
-            flagLock(printMutex, name);
-                cout<<color<<"[Thread " << threadId << "]\033[0m "<<users[userId].user<<" is using device "<<dev->getId()<<"."<<endl; //User is using device
-            flagUnlock(printMutex);
-        }
-        this_thread::sleep_for(chrono::seconds(sec));
-        {//Turn on device
-            scoped_lock<mutex, recursive_mutex> lock(devMtx, printMtx); //makes sure no interleaved output
-            flagLock(devMutex, name);
-            flagLock(printMutex, name);
-                uniform_int_distribution<> dist(0,1); //for random (on or off)
-
-                cout<<color<<"[Thread " << threadId << "]\033[0m ";
-                dev->turnOn(dist(gen)); //user turns on device
-            flagUnlock(printMutex);
-            flagUnlock(devMutex);
-        }
-        this_thread::sleep_for(chrono::seconds(sec));
-        //Change device settings
-        if(Fridge* fridge = dynamic_cast<Fridge*>(dev)){
-            scoped_lock<mutex, recursive_mutex> lock(devMtx, printMtx); //makes sure no interleaved output
-            flagLock(devMutex, name);
-            flagLock(printMutex, name);
-                uniform_int_distribution<> dist(-5,5); //for random (temp)
-
-                cout<<color<<"[Thread " << threadId << "]\033[0m ";
-                fridge->putTemp(dist(gen)); //Varying temps
-            flagUnlock(printMutex);
-            flagUnlock(devMutex);
-        } 
-        else if (Light* light = dynamic_cast<Light*>(dev)){
-            scoped_lock<mutex, recursive_mutex> lock(devMtx, printMtx); //makes sure no interleaved output
-            flagLock(devMutex, name);
-            flagLock(printMutex, name);
-                uniform_int_distribution<> dist(0,3); //for random (temp)
-
-                cout<<color<<"[Thread " << threadId << "]\033[0m ";
-                light->putBrightness(dist(gen));
-            flagUnlock(printMutex);
-            flagUnlock(devMutex);
-        }
-        this_thread::sleep_for(chrono::seconds(sec));
-
-        {//Print device status
-            lock_guard<recursive_mutex> lock(printMtx); //makes sure no interleaved output
-            flagLock(printMutex, name);
-                cout<<color<<"[Thread " << threadId << "]\033[0m ";
-                dev->showStatus(); //show dev status
-            flagUnlock(printMutex);
-        }
-        this_thread::sleep_for(chrono::seconds(sec));
-    }
-    
-    //LOG OUT USER
-    {
-        scoped_lock<mutex, recursive_mutex> lock(userMtx, printMtx); //lockguard user mutex
-        flagLock(userMutex, name);
-        flagLock(printMutex, name);
-            if (userId < 0 || userId >= static_cast<int>(users.size())){ //check if userIndex is out of bounds
-                cout<<"\033[1;31m[Thread " << threadId << "] Invalid user index.\033[0m"<<endl;
-                return;
-            }
-            
-            user.isLoggedIn = false; //logs out user
-            cout<<"\033[1;31m[Thread " << threadId << "] User "<<user.user<<" logged out.\033[0m"<<endl;
-        flagUnlock(printMutex);
-        flagUnlock(userMutex);
-    }
+        string getOwner() const{
+            uint32_t t = owner.load(memory_order_relaxed);
+            return t ? "Thread " + to_string(t) : "None";
+        }
+        string getName() const{
+            return name;
+        }
+};
 
-}
+//Epoch-based reclamation: readers announce the epoch they entered in, removed objects are retired
+//with the epoch of their removal and only deleted once every active reader has moved past it.
+//Readers never wait; writers never free anything a reader may still be looking at.
+class EpochManager{
+    private:
+        static const int maxThreads = 256;
+        struct alignas(64) ThreadSlot{
+            atomic<uint64_t> epoch{0}; //0 = outside any read section
+            atomic<bool> taken{false};
+        };
+        struct Retired{
+            uint64_t epoch;
+            Device* dev;
+        };
 
-void deviceManagement(){
-    int ch;
-    while(true){
-        cout<<"====== Device Management ======"<<endl;
-        cout<<"1 - Add Devices"<<endl;
-        cout<<"2 - Remove Devices"<<endl;
-        cout<<"3 - Manage Devices"<<endl;
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Enter Choice: ";
-        ch = getCh(3);
-        if(ch == -1){
-            continue;
-        }
-        cout<<"\n"<<endl;
+        atomic<uint64_t> globalEpoch{1};
+        ThreadSlot slots[maxThreads];
+        mutex retireMtx;
+        vector<Retired> retired;
+        atomic<long> freed{0};
 
-        switch(ch){
-            case 1: addDev(); break;
-            case 2: removeDev(); break;
-            case 3: deviceControl(); break;
-            case 0: return;
+        struct SlotOwner{//gives the slot back when the thread exits
+            EpochManager* owner = nullptr;
+            int index = -1;
+            ~SlotOwner(){
+                if(owner) owner->slots[index].taken.store(false, memory_order_release);
+            }
+        };
+        int mySlot(){
+            thread_local SlotOwner mine;
+            if(mine.index < 0){
+                for(int i = 0; i < maxThreads; i++){
+                    bool expected = false;
+                    if(slots[i].taken.compare_exchange_strong(expected, true)){
+                        mine.owner = this;
+                        mine.index = i;
+                        break;
+                    }
+                }
+                if(mine.index < 0){
+                    cout<<"\033[1;31mToo many threads for the epoch manager.\033[0m"<<endl;
+                    abort();
+                }
+            }
+            return mine.index;
         }
-    }
-}
+        uint64_t oldestActive(){
+            uint64_t oldest = globalEpoch.load();
+            for(auto& s : slots){
+                uint64_t e = s.epoch.load();
+                if(e != 0 && e < oldest) oldest = e;
+            }
+            return oldest;
+        }
+    public:
+        ~EpochManager(){
+            for(auto& r : retired) delete r.dev;
+        }
+        void enter(){
+            slots[mySlot()].epoch.store(globalEpoch.load()); //seq_cst so the announcement is visible before any load of a device
+        }
+        void exit(){
+            slots[mySlot()].epoch.store(0, memory_order_release);
+        }
+        void retire(Device* dev){
+            vector<Device*> ready;
+            {
+                lock_guard<mutex> lock(retireMtx);
+                retired.push_back({globalEpoch.fetch_add(1), dev});
+                uint64_t oldest = oldestActive();
+                size_t kept = 0;
+                for(auto& r : retired){
+                    if(r.epoch < oldest) ready.push_back(r.dev);
+                    else retired[kept++] = r;
+                }
+                retired.resize(kept);
+            }
+            for(Device* d : ready) delete d;
+            freed += ready.size();
+        }
+        void reclaim(){//frees whatever has become safe without retiring anything new
+            vector<Device*> ready;
+            {
+                lock_guard<mutex> lock(retireMtx);
+                globalEpoch.fetch_add(1);
+                uint64_t oldest = oldestActive();
+                size_t kept = 0;
+                for(auto& r : retired){
+                    if(r.epoch < oldest) ready.push_back(r.dev);
+                    else retired[kept++] = r;
+                }
+                retired.resize(kept);
+            }
+            for(Device* d : ready) delete d;
+            freed += ready.size();
+        }
+        long getFreed() const{
+            return freed;
+        }
+        size_t getPending(){
+            lock_guard<mutex> lock(retireMtx);
+            return retired.size();
+        }
+};
+
+EpochManager epochs;
+
+class EpochGuard{//keeps every device loaded inside its scope alive
+    public:
+        EpochGuard(){epochs.enter();}
+        ~EpochGuard(){epochs.exit();}
+        EpochGuard(const EpochGuard&) = delete;
+        EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+//String-keyed hash map split into shards, each under its own shared_mutex. Lookups only take a read
+//lock on one shard, so readers of different keys rarely touch the same lock.
+template <typename V>
+class ShardedDirectory{
+    private:
+        static const size_t shardCount = 64;
+        struct alignas(64) Shard{
+            mutable shared_mutex mtx;
+            unordered_map<string, V> map;
+        };
+
+        Shard shards[shardCount];
+        atomic<size_t> count{0};
+
+        Shard& shardOf(const string& key){
+            return shards[hash<string>{}(key) % shardCount];
+        }
+        const Shard& shardOf(const string& key) const{
+            return shards[hash<string>{}(key) % shardCount];
+        }
+    public:
+        //false if the key is already there
+        bool insert(const string& key, const V& value){
+            Shard& shard = shardOf(key);
+            unique_lock<shared_mutex> lock(shard.mtx);
+            if(!shard.map.emplace(key, value).second) return false;
+            count++;
+            return true;
+        }
+        bool find(const string& key, V& out) const{
+            const Shard& shard = shardOf(key);
+            shared_lock<shared_mutex> lock(shard.mtx);
+            auto it = shard.map.find(key);
+            if(it == shard.map.end()) return false;
+            out = it->second;
+            return true;
+        }
+        bool contains(const string& key) const{
+            const Shard& shard = shardOf(key);
+            shared_lock<shared_mutex> lock(shard.mtx);
+            return shard.map.count(key) > 0;
+        }
+        bool erase(const string& key){
+            Shard& shard = shardOf(key);
+            unique_lock<shared_mutex> lock(shard.mtx);
+            if(!shard.map.erase(key)) return false;
+            count--;
+            return true;
+        }
+        void reserve(size_t n){
+            for(auto& shard : shards){
+                unique_lock<shared_mutex> lock(shard.mtx);
+                shard.map.reserve(n / shardCount + 1);
+            }
+        }
+        size_t size() const{
+            return count.load();
+        }
+};
+
+//Stable reference to a registry slot. The generation changes every time the slot's device is removed,
+//so an old handle can never reach a device that was added into the same slot later.
+struct DeviceHandle{
+    uint32_t index = UINT32_MAX;
+    uint32_t gen = 0;
+    bool valid() const{
+        return index != UINT32_MAX;
+    }
+};
+
+class DeviceRegistry{
+    private:
+        static const uint32_t chunkSize = 1024;
+        static const uint32_t maxChunks = 4096; //up to 4M devices
+        struct Slot{
+            atomic<Device*> dev{nullptr};
+            atomic<uint32_t> gen{0};
+        };
+
+        atomic<Slot*> chunks[maxChunks] = {};
+        atomic<uint32_t> highWater{0}; //slots ever handed out
+        atomic<uint32_t> live{0};
+        TrackedMutex<mutex> writeMtx{"Device Registry"}; //serializes add/remove only, readers never take it
+        vector<uint32_t> freeSlots;
+        ShardedDirectory<DeviceHandle> byId; //written under writeMtx, read without it
+
+        Slot* slotAt(uint32_t index) const{
+            Slot* chunk = chunks[index / chunkSize].load(memory_order_acquire);
+            return chunk ? &chunk[index % chunkSize] : nullptr;
+        }
+    public:
+        ~DeviceRegistry(){
+            for(auto& c : chunks){
+                Slot* chunk = c.load();
+                if(!chunk) continue;
+                for(uint32_t i = 0; i < chunkSize; i++) delete chunk[i].dev.load();
+                delete[] chunk;
+            }
+        }
+        //invalid handle, and dev deleted, if the ID is taken or the registry is full
+        DeviceHandle add(Device* dev){
+            lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+            string id = dev->getId();
+            if(byId.contains(id)){
+                delete dev;
+                return {};
+            }
+            uint32_t index;
+            if(!freeSlots.empty()){
+                index = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            else{
+                index = highWater.load();
+                if(index / chunkSize >= maxChunks){
+                    delete dev;
+                    return {};
+                }
+                if(!chunks[index / chunkSize].load()) chunks[index / chunkSize].store(new Slot[chunkSize], memory_order_release);
+                highWater.store(index + 1, memory_order_release);
+            }
+            Slot* slot = slotAt(index);
+            slot->dev.store(dev, memory_order_release);
+            live++;
+            DeviceHandle h{index, slot->gen.load()};
+            byId.insert(id, h);
+            return h;
+        }
+        //unlinks the device right away; it is freed once no reader can still hold it
+        bool remove(DeviceHandle h){
+            Device* dev;
+            {
+                lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+                Slot* slot = h.index < highWater.load() ? slotAt(h.index) : nullptr;
+                if(!slot || slot->gen.load() != h.gen || !slot->dev.load()) return false;
+                dev = slot->dev.exchange(nullptr);
+                slot->gen.fetch_add(1, memory_order_release);
+                byId.erase(dev->getId());
+                freeSlots.push_back(h.index);
+                live--;
+            }
+            epochs.retire(dev);
+            return true;
+        }
+        //caller must hold an EpochGuard for as long as it uses the returned pointer
+        Device* get(DeviceHandle h) const{
+            if(h.index >= highWater.load(memory_order_acquire)) return nullptr;
+            Slot* slot = slotAt(h.index);
+            if(slot->gen.load(memory_order_acquire) != h.gen) return nullptr;
+            Device* dev = slot->dev.load(memory_order_acquire);
+            return (slot->gen.load(memory_order_acquire) == h.gen) ? dev : nullptr;
+        }
+        //invalid if no device has this ID; get() still checks the handle, the device may go in between
+        DeviceHandle find(const string& id) const{
+            DeviceHandle h;
+            return byId.find(id, h) ? h : DeviceHandle{};
+        }
+        void reserve(size_t n){
+            byId.reserve(n);
+        }
+        //live handles in slot order, used for numbered menus
+        vector<DeviceHandle> handles() const{
+            vector<DeviceHandle> out;
+            uint32_t end = highWater.load(memory_order_acquire);
+            for(uint32_t i = 0; i < end; i++){
+                Slot* slot = slotAt(i);
+                uint32_t g = slot->gen.load(memory_order_acquire);
+                if(slot->dev.load(memory_order_acquire)) out.push_back({i, g});
+            }
+            return out;
+        }
+        //random live device: a random slot, then probing forward past removed ones
+        template <typename Rng>
+        DeviceHandle pickRandom(Rng& rng) const{
+            uint32_t end = highWater.load(memory_order_acquire);
+            if(end == 0 || live.load() == 0) return {};
+            uint32_t start = uniform_int_distribution<uint32_t>(0, end - 1)(rng);
+            for(uint32_t step = 0; step < end; step++){
+                uint32_t i = (start + step) % end;
+                Slot* slot = slotAt(i);
+                uint32_t g = slot->gen.load(memory_order_acquire);
+                if(slot->dev.load(memory_order_acquire)) return {i, g};
+            }
+            return {};
+        }
+        size_t size() const{
+            return live.load();
+        }
+        bool empty() const{
+            return live.load() == 0;
+        }
+        const TrackedMutex<mutex>& writeLock() const{
+            return writeMtx;
+        }
+};
+
+//Stable reference to a user slot, same idea as DeviceHandle: removing the user bumps the generation.
+struct UserId{
+    uint32_t index = UINT32_MAX;
+    uint32_t gen = 0;
+    bool valid() const{
+        return index != UINT32_MAX;
+    }
+};
+
+//Users live in slots that never move. Each slot's generation and login state share one atomic word, so
+//logging in, logging out and removing are single CASes. Idle users sit on a lock-free stack (Treiber
+//stack, its head tagged against ABA): logging in pops one in O(1) instead of drawing random users until
+//a free one turns up. A removed user stays on the stack until someone pops it, then its slot is reused.
+class UserTable{
+    private:
+        static const uint32_t chunkSize = 1024;
+        static const uint32_t maxChunks = 1024; //up to 1M users
+        static const uint32_t none = UINT32_MAX;
+        enum : uint32_t {Empty, Idle, Busy, Removed};
+        struct Slot{
+            atomic<uint64_t> word{Empty}; //gen << 32 | state
+            atomic<uint32_t> next{none}; //idle stack link
+            string name; //written only while the slot is Empty, under writeMtx
+        };
+        static uint64_t makeWord(uint32_t gen, uint32_t state){
+            return (uint64_t)gen << 32 | state;
+        }
+
+        atomic<Slot*> chunks[maxChunks] = {};
+        atomic<uint32_t> highWater{0};
+        atomic<uint32_t> live{0};
+        atomic<uint64_t> idleHead{none}; //tag << 32 | index
+        TrackedMutex<mutex> writeMtx{"User Table"}; //serializes add/remove/list, logins never take it
+        vector<uint32_t> freeSlots;
+        ShardedDirectory<UserId> byName; //written under writeMtx, read without it
+        struct Waiter{//a coroutine parked in acquireAsync
+            coroutine_handle<> h;
+            function<void(coroutine_handle<>)> resume;
+            UserId* out;
+        };
+        mutex waitMtx;
+        deque<Waiter> waiters;
+        atomic<uint32_t> waiting{0}; //waiters.size(), read by release() without waitMtx
+
+        Slot* slotAt(uint32_t index) const{
+            return &chunks[index / chunkSize].load(memory_order_acquire)[index % chunkSize];
+        }
+        void pushIdle(uint32_t index){
+            uint64_t head = idleHead.load(memory_order_relaxed);
+            do{
+                slotAt(index)->next.store((uint32_t)head, memory_order_relaxed);
+            }while(!idleHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | index, memory_order_release, memory_order_relaxed));
+        }
+        uint32_t popIdle(){
+            uint64_t head = idleHead.load(memory_order_acquire);
+            while((uint32_t)head != none){
+                uint32_t next = slotAt((uint32_t)head)->next.load(memory_order_relaxed);
+                if(idleHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | next, memory_order_acquire, memory_order_acquire)){
+                    return (uint32_t)head;
+                }
+            }
+            return none;
+        }
+        void recycle(uint32_t index){//slot is Empty and off the stack
+            lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+            freeSlots.push_back(index);
+        }
+        //a user just went idle: if a coroutine is parked, log a user in for it and send it on its way
+        void handOff(){
+            atomic_thread_fence(memory_order_seq_cst); //the push before the read of waiting, see park
+            if(waiting.load() == 0) return;
+            lock_guard<mutex> lock(waitMtx);
+            while(!waiters.empty()){
+                UserId id = acquire();
+                if(!id.valid()) return;
+                Waiter w = move(waiters.front());
+                waiters.pop_front();
+                waiting--;
+                *w.out = id;
+                w.resume(w.h);
+            }
+        }
+        //false, with out set, if a user went idle before the coroutine could be parked
+        bool park(coroutine_handle<> h, function<void(coroutine_handle<>)>& resume, UserId& out){
+            lock_guard<mutex> lock(waitMtx);
+            waiting++; //seq_cst: a release() either sees this or its push is seen by the pop below
+            if((out = acquire()).valid()){
+                waiting--;
+                return false;
+            }
+            waiters.push_back({h, move(resume), &out});
+            return true;
+        }
+    public:
+        ~UserTable(){
+            for(auto& c : chunks) delete[] c.load();
+        }
+        //invalid if the name is taken or the table is full
+        UserId add(const string& name){
+            uint32_t index;
+            uint32_t gen;
+            {
+                lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+                if(byName.contains(name)) return {};
+                if(!freeSlots.empty()){
+                    index = freeSlots.back();
+                    freeSlots.pop_back();
+                }
+                else{
+                    index = highWater.load();
+                    if(index / chunkSize >= maxChunks) return {};
+                    if(!chunks[index / chunkSize].load()) chunks[index / chunkSize].store(new Slot[chunkSize], memory_order_release);
+                    highWater.store(index + 1, memory_order_release);
+                }
+                Slot* slot = slotAt(index);
+                slot->name = name;
+                gen = slot->word.load() >> 32;
+                slot->word.store(makeWord(gen, Idle), memory_order_release);
+                live++;
+                byName.insert(name, {index, gen});
+            }
+            pushIdle(index);
+            handOff();
+            return {index, gen};
+        }
+        //a logged in user is removed too; its session's logout then frees the slot. Holding writeMtx keeps
+        //the slot from being reused, and its name rewritten, before the name is unlinked.
+        bool remove(UserId id){
+            lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+            if(!id.valid() || id.index >= highWater.load(memory_order_acquire)) return false;
+            Slot* slot = slotAt(id.index);
+            for(uint32_t state : {Idle, Busy}){
+                uint64_t expected = makeWord(id.gen, state);
+                if(slot->word.compare_exchange_strong(expected, makeWord(id.gen + 1, Removed))){
+                    byName.erase(slot->name);
+                    live--;
+                    return true;
+                }
+            }
+            return false;
+        }
+        //co_await form of acquire: the lock-free pop first, and with everyone logged in the coroutine parks
+        //until a release() hands it a user; resume schedules it again (e.g. on its executor)
+        struct AcquireAwaiter{
+            UserTable& table;
+            function<void(coroutine_handle<>)> resume;
+            UserId id;
+            bool await_ready(){
+                return (id = table.acquire()).valid();
+            }
+            bool await_suspend(coroutine_handle<> h){
+                return table.park(h, resume, id);
+            }
+            UserId await_resume() const{
+                return id;
+            }
+        };
+        AcquireAwaiter acquireAsync(function<void(coroutine_handle<>)> resume){
+            return {*this, move(resume), {}};
+        }
+        //logs in any idle user, invalid if everyone is logged in
+        UserId acquire(){
+            while(true){
+                uint32_t index = popIdle();
+                if(index == none) return {};
+                Slot* slot = slotAt(index);
+                uint64_t word = slot->word.load(memory_order_acquire);
+                uint32_t gen = word >> 32;
+                if((uint32_t)word == Idle && slot->word.compare_exchange_strong(word, makeWord(gen, Busy), memory_order_acquire)){
+                    return {index, gen};
+                }
+                //removed while idle: only this pop can see it now
+                slot->word.store(makeWord(word >> 32, Empty), memory_order_release);
+                recycle(index);
+            }
+        }
+        void release(UserId id){
+            Slot* slot = slotAt(id.index);
+            uint64_t expected = makeWord(id.gen, Busy);
+            if(slot->word.compare_exchange_strong(expected, makeWord(id.gen, Idle), memory_order_release)){
+                pushIdle(id.index);
+                handOff();
+                return;
+            }
+            //removed while logged in
+            slot->word.store(makeWord(id.gen + 1, Empty), memory_order_release);
+            recycle(id.index);
+        }
+        bool isLoggedIn(UserId id) const{
+            if(!id.valid() || id.index >= highWater.load(memory_order_acquire)) return false;
+            return slotAt(id.index)->word.load(memory_order_acquire) == makeWord(id.gen, Busy);
+        }
+        string name(UserId id){
+            lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+            if(!id.valid() || id.index >= highWater.load()) return "";
+            uint64_t word = slotAt(id.index)->word.load();
+            uint32_t state = (uint32_t)word;
+            return ((word >> 32) == id.gen && (state == Idle || state == Busy)) ? slotAt(id.index)->name : "";
+        }
+        //live users in slot order, used for numbered menus
+        vector<pair<UserId, string>> list(){
+            lock_guard<TrackedMutex<mutex>> lock(writeMtx);
+            vector<pair<UserId, string>> out;
+            uint32_t end = highWater.load();
+            for(uint32_t i = 0; i < end; i++){
+                Slot* slot = slotAt(i);
+                uint64_t word = slot->word.load();
+                if((uint32_t)word == Idle || (uint32_t)word == Busy) out.push_back({{i, (uint32_t)(word >> 32)}, slot->name});
+            }
+            return out;
+        }
+        bool contains(const string& name) const{
+            return byName.contains(name);
+        }
+        //invalid if no user has this name
+        UserId find(const string& name) const{
+            UserId id;
+            return byName.find(name, id) ? id : UserId{};
+        }
+        void reserve(size_t n){
+            byName.reserve(n);
+        }
+        size_t size() const{
+            return live.load();
+        }
+        const TrackedMutex<mutex>& writeLock() const{
+            return writeMtx;
+        }
+};
+
+//Bulk kernels over table columns. Row r of a column matches bit r % 64 of word r / 64 of a member mask;
+//only rows whose bit is set are changed. Every level gives the same results, the scalar one runs anywhere.
+enum class PowerOp {On, Off, Toggle};
+
+void setBytesScalar(int8_t* vals, const uint64_t* mask, size_t rows, int8_t v){
+    for(size_t r = 0; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = v;
+    }
+}
+void clampBytesScalar(int8_t* vals, const uint64_t* mask, size_t rows, int8_t lo, int8_t hi){
+    for(size_t r = 0; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = clamp(vals[r], lo, hi);
+    }
+}
+void powerWordsScalar(uint64_t* bits, const uint64_t* mask, size_t words, PowerOp op){
+    for(size_t w = 0; w < words; w++){
+        switch(op){
+            case PowerOp::On: bits[w] |= mask[w]; break;
+            case PowerOp::Off: bits[w] &= ~mask[w]; break;
+            case PowerOp::Toggle: bits[w] ^= mask[w]; break;
+        }
+    }
+}
+size_t countBitsScalar(const uint64_t* bits, const uint64_t* mask, size_t words){
+    size_t n = 0;
+    for(size_t w = 0; w < words; w++) n += bitset<64>(bits[w] & mask[w]).count();
+    return n;
+}
+
+#ifdef BULK_SIMD
+//32 mask bits starting at row r, as one 0x00/0xFF byte per row
+__attribute__((target("avx2"))) static inline __m256i expandMask32(const uint64_t* mask, size_t r){
+    uint32_t m = (uint32_t)(mask[r / 64] >> (r % 64));
+    __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(m), _mm256_setr_epi8(
+        0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3));
+    __m256i bit = _mm256_set1_epi64x((long long)0x8040201008040201ull);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(spread, bit), bit);
+}
+__attribute__((target("avx2"))) void setBytesAvx2(int8_t* vals, const uint64_t* mask, size_t rows, int8_t v){
+    size_t r = 0;
+    __m256i fill = _mm256_set1_epi8(v);
+    for(; r + 32 <= rows; r += 32){
+        __m256i* p = (__m256i*)(vals + r);
+        _mm256_storeu_si256(p, _mm256_blendv_epi8(_mm256_loadu_si256(p), fill, expandMask32(mask, r)));
+    }
+    for(; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = v;
+    }
+}
+__attribute__((target("avx2"))) void clampBytesAvx2(int8_t* vals, const uint64_t* mask, size_t rows, int8_t lo, int8_t hi){
+    size_t r = 0;
+    __m256i vlo = _mm256_set1_epi8(lo), vhi = _mm256_set1_epi8(hi);
+    for(; r + 32 <= rows; r += 32){
+        __m256i* p = (__m256i*)(vals + r);
+        __m256i x = _mm256_loadu_si256(p);
+        __m256i c = _mm256_min_epi8(_mm256_max_epi8(x, vlo), vhi);
+        _mm256_storeu_si256(p, _mm256_blendv_epi8(x, c, expandMask32(mask, r)));
+    }
+    for(; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = clamp(vals[r], lo, hi);
+    }
+}
+__attribute__((target("avx2"))) void powerWordsAvx2(uint64_t* bits, const uint64_t* mask, size_t words, PowerOp op){
+    size_t w = 0;
+    for(; w + 4 <= words; w += 4){
+        __m256i* p = (__m256i*)(bits + w);
+        __m256i b = _mm256_loadu_si256(p), m = _mm256_loadu_si256((const __m256i*)(mask + w));
+        switch(op){
+            case PowerOp::On: b = _mm256_or_si256(b, m); break;
+            case PowerOp::Off: b = _mm256_andnot_si256(m, b); break;
+            case PowerOp::Toggle: b = _mm256_xor_si256(b, m); break;
+        }
+        _mm256_storeu_si256(p, b);
+    }
+    powerWordsScalar(bits + w, mask + w, words - w, op);
+}
+//nibble lookup popcount, summed per 64-bit lane with sad_epu8
+__attribute__((target("avx2"))) size_t countBitsAvx2(const uint64_t* bits, const uint64_t* mask, size_t words){
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    size_t w = 0;
+    for(; w + 4 <= words; w += 4){
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(bits + w)), _mm256_loadu_si256((const __m256i*)(mask + w)));
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+                                      _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + countBitsScalar(bits + w, mask + w, words - w);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i expandMask16(const uint64_t* mask, size_t r){
+    uint32_t m = (uint16_t)(mask[r / 64] >> (r % 64));
+    __m128i spread = _mm_shuffle_epi8(_mm_set1_epi32(m), _mm_setr_epi8(0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1));
+    __m128i bit = _mm_set1_epi64x((long long)0x8040201008040201ull);
+    return _mm_cmpeq_epi8(_mm_and_si128(spread, bit), bit);
+}
+__attribute__((target("sse4.1"))) void setBytesSse(int8_t* vals, const uint64_t* mask, size_t rows, int8_t v){
+    size_t r = 0;
+    __m128i fill = _mm_set1_epi8(v);
+    for(; r + 16 <= rows; r += 16){
+        __m128i* p = (__m128i*)(vals + r);
+        _mm_storeu_si128(p, _mm_blendv_epi8(_mm_loadu_si128(p), fill, expandMask16(mask, r)));
+    }
+    for(; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = v;
+    }
+}
+__attribute__((target("sse4.1"))) void clampBytesSse(int8_t* vals, const uint64_t* mask, size_t rows, int8_t lo, int8_t hi){
+    size_t r = 0;
+    __m128i vlo = _mm_set1_epi8(lo), vhi = _mm_set1_epi8(hi);
+    for(; r + 16 <= rows; r += 16){
+        __m128i* p = (__m128i*)(vals + r);
+        __m128i x = _mm_loadu_si128(p);
+        __m128i c = _mm_min_epi8(_mm_max_epi8(x, vlo), vhi);
+        _mm_storeu_si128(p, _mm_blendv_epi8(x, c, expandMask16(mask, r)));
+    }
+    for(; r < rows; r++){
+        if((mask[r / 64] >> (r % 64)) & 1) vals[r] = clamp(vals[r], lo, hi);
+    }
+}
+__attribute__((target("sse4.1"))) void powerWordsSse(uint64_t* bits, const uint64_t* mask, size_t words, PowerOp op){
+    size_t w = 0;
+    for(; w + 2 <= words; w += 2){
+        __m128i* p = (__m128i*)(bits + w);
+        __m128i b = _mm_loadu_si128(p), m = _mm_loadu_si128((const __m128i*)(mask + w));
+        switch(op){
+            case PowerOp::On: b = _mm_or_si128(b, m); break;
+            case PowerOp::Off: b = _mm_andnot_si128(m, b); break;
+            case PowerOp::Toggle: b = _mm_xor_si128(b, m); break;
+        }
+        _mm_storeu_si128(p, b);
+    }
+    powerWordsScalar(bits + w, mask + w, words - w, op);
+}
+__attribute__((target("sse4.1"))) size_t countBitsSse(const uint64_t* bits, const uint64_t* mask, size_t words){
+    const __m128i lookup = _mm_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i acc = _mm_setzero_si128();
+    size_t w = 0;
+    for(; w + 2 <= words; w += 2){
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(bits + w)), _mm_loadu_si128((const __m128i*)(mask + w)));
+        __m128i cnt = _mm_add_epi8(_mm_shuffle_epi8(lookup, _mm_and_si128(v, low)),
+                                   _mm_shuffle_epi8(lookup, _mm_and_si128(_mm_srli_epi16(v, 4), low)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(cnt, _mm_setzero_si128()));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return lanes[0] + lanes[1] + countBitsScalar(bits + w, mask + w, words - w);
+}
+#endif
+
+struct BulkKernels{
+    const char* name;
+    void (*setBytes)(int8_t*, const uint64_t*, size_t, int8_t);
+    void (*clampBytes)(int8_t*, const uint64_t*, size_t, int8_t, int8_t);
+    void (*powerWords)(uint64_t*, const uint64_t*, size_t, PowerOp);
+    size_t (*countBits)(const uint64_t*, const uint64_t*, size_t);
+};
+
+const BulkKernels scalarKernels = {"Scalar", setBytesScalar, clampBytesScalar, powerWordsScalar, countBitsScalar};
+#ifdef BULK_SIMD
+const BulkKernels sseKernels = {"SSE4.1", setBytesSse, clampBytesSse, powerWordsSse, countBitsSse};
+const BulkKernels avx2Kernels = {"AVX2", setBytesAvx2, clampBytesAvx2, powerWordsAvx2, countBitsAvx2};
+#endif
+
+//kernel sets this CPU can run, slowest first
+vector<const BulkKernels*> supportedKernels(){
+    vector<const BulkKernels*> out = {&scalarKernels};
+#ifdef BULK_SIMD
+    if(__builtin_cpu_supports("sse4.1")) out.push_back(&sseKernels);
+    if(__builtin_cpu_supports("avx2")) out.push_back(&avx2Kernels);
+#endif
+    return out;
+}
+
+//Column store for bulk work over large device counts, one set of columns per kind.
+//Rows are addressed by kind + row, and a scan reads only the columns it needs, front to back.
+struct TableHandle{
+    DeviceKind kind = DeviceKind::Fridge;
+    uint32_t row = UINT32_MAX;
+};
+
+struct TableWrite{//one field of one row, as a device event reports it
+    TableHandle h;
+    EventTopic field;
+    int value;
+};
+
+struct TableSummary{
+    size_t total[deviceKinds] = {};
+    size_t on[deviceKinds] = {};
+    long setpointSum[deviceKinds] = {}; //fridge and aircon only
+    size_t levelCount[4] = {}; //lights per brightness level, index 1-3
+};
+
+class DeviceTable{
+    private:
+        struct Columns{
+            vector<string> ids;
+            vector<uint64_t> onBits; //row r is bit r % 64 of word r / 64
+            vector<uint64_t> allBits; //every existing row, the member mask of allDevices
+            vector<int8_t> setpoints; //fridge, aircon
+            vector<uint8_t> levels; //light, 1-3
+            size_t removed = 0; //rows zeroed by remove(), never reused
+        };
+        struct Group{
+            string name;
+            vector<uint64_t> members[deviceKinds]; //same layout as onBits
+        };
+        Columns kinds[deviceKinds];
+        vector<Group> groups;
+        const BulkKernels* kernels = supportedKernels().back();
+        mutable shared_mutex tableMtx; //exclusive for writes, shared for lookups and scans
+
+        Columns& cols(DeviceKind k){return kinds[(int)k];}
+        const Columns& cols(DeviceKind k) const{return kinds[(int)k];}
+        const vector<uint64_t>& maskFor(int group, DeviceKind k) const{
+            return group == allDevices ? cols(k).allBits : groups[group].members[(int)k];
+        }
+        static void byteChanges(const vector<int8_t>& before, const vector<int8_t>& after, vector<pair<uint32_t, int>>& out){
+            for(size_t r = 0; r < before.size(); r++){
+                if(before[r] != after[r]) out.push_back({(uint32_t)r, after[r]});
+            }
+        }
+    public:
+        static const int allDevices = -1;
+
+        TableHandle add(DeviceKind kind, const string& id){
+            unique_lock lock(tableMtx);
+            Columns& c = cols(kind);
+            uint32_t row = c.ids.size();
+            c.ids.push_back(id);
+            if(row % 64 == 0){
+                c.onBits.push_back(0);
+                c.allBits.push_back(0);
+            }
+            c.allBits.back() |= 1ull << (row % 64);
+            switch(kind){
+                case DeviceKind::Fridge: c.setpoints.push_back(5); break;
+                case DeviceKind::AirCon: c.setpoints.push_back(20); break;
+                case DeviceKind::Light: c.levels.push_back(2); break;
+            }
+            return {kind, row};
+        }
+        void reserve(DeviceKind kind, size_t rows){
+            unique_lock lock(tableMtx);
+            Columns& c = cols(kind);
+            c.ids.reserve(rows);
+            c.onBits.reserve((rows + 63) / 64);
+            c.allBits.reserve((rows + 63) / 64);
+            if(kind == DeviceKind::Light) c.levels.reserve(rows);
+            else c.setpoints.reserve(rows);
+        }
+        //the row keeps its place, zeroed and out of every mask, so no other row moves
+        void remove(TableHandle h){
+            unique_lock lock(tableMtx);
+            Columns& c = cols(h.kind);
+            uint64_t bit = 1ull << (h.row % 64);
+            if(!(c.allBits[h.row / 64] & bit)) return;
+            c.allBits[h.row / 64] &= ~bit;
+            c.onBits[h.row / 64] &= ~bit;
+            for(auto& g : groups){
+                vector<uint64_t>& m = g.members[(int)h.kind];
+                if(m.size() > h.row / 64) m[h.row / 64] &= ~bit;
+            }
+            if(h.kind == DeviceKind::Light) c.levels[h.row] = 0;
+            else c.setpoints[h.row] = 0;
+            c.ids[h.row].clear();
+            c.removed++;
+        }
+        void set(TableHandle h, const DeviceState& s){//every column of the row at once
+            unique_lock lock(tableMtx);
+            Columns& c = cols(h.kind);
+            uint64_t& word = c.onBits[h.row / 64];
+            uint64_t bit = 1ull << (h.row % 64);
+            word = s.on ? (word | bit) : (word & ~bit);
+            if(h.kind == DeviceKind::Light) c.levels[h.row] = s.level;
+            else c.setpoints[h.row] = (int8_t)clamp(s.temp, -128, 127);
+        }
+        void setOn(TableHandle h, bool b){
+            unique_lock lock(tableMtx);
+            uint64_t& word = cols(h.kind).onBits[h.row / 64];
+            uint64_t bit = 1ull << (h.row % 64);
+            word = b ? (word | bit) : (word & ~bit);
+        }
+        void setTemp(TableHandle h, int temp){
+            if(h.kind == DeviceKind::Light) return;
+            unique_lock lock(tableMtx);
+            cols(h.kind).setpoints[h.row] = (int8_t)clamp(temp, -128, 127);
+        }
+        void setBrightness(TableHandle h, int lvl){
+            if(h.kind != DeviceKind::Light || lvl < 1 || lvl > 3) return;
+            unique_lock lock(tableMtx);
+            cols(h.kind).levels[h.row] = lvl;
+        }
+        //a batch of field writes under one lock, same checks as the setters above
+        void write(const vector<TableWrite>& writes){
+            unique_lock lock(tableMtx);
+            for(const TableWrite& w : writes){
+                Columns& c = cols(w.h.kind);
+                bool light = w.h.kind == DeviceKind::Light;
+                switch(w.field){
+                    case EventTopic::Power:{
+                        uint64_t& word = c.onBits[w.h.row / 64];
+                        uint64_t bit = 1ull << (w.h.row % 64);
+                        word = w.value ? (word | bit) : (word & ~bit);
+                        break;
+                    }
+                    case EventTopic::Setpoint:
+                        if(!light) c.setpoints[w.h.row] = (int8_t)clamp(w.value, -128, 127);
+                        break;
+                    case EventTopic::Brightness:
+                        if(light && w.value >= 1 && w.value <= 3) c.levels[w.h.row] = w.value;
+                        break;
+                }
+            }
+        }
+        DeviceState get(TableHandle h) const{
+            shared_lock lock(tableMtx);
+            const Columns& c = cols(h.kind);
+            DeviceState s;
+            s.on = (c.onBits[h.row / 64] >> (h.row % 64)) & 1;
+            if(h.kind == DeviceKind::Light) s.level = c.levels[h.row];
+            else s.temp = c.setpoints[h.row];
+            return s;
+        }
+        string getId(TableHandle h) const{
+            shared_lock lock(tableMtx);
+            return cols(h.kind).ids[h.row];
+        }
+        //one pass per column: popcount over the power words, a sum over setpoints, a histogram over levels
+        TableSummary scan() const{
+            shared_lock lock(tableMtx);
+            TableSummary sum;
+            for(int k = 0; k < deviceKinds; k++){
+                const Columns& c = kinds[k];
+                sum.total[k] = c.ids.size() - c.removed;
+                for(uint64_t w : c.onBits) sum.on[k] += bitset<64>(w).count();
+                long total = 0;
+                for(int8_t t : c.setpoints) total += t;
+                sum.setpointSum[k] = total;
+                for(uint8_t l : c.levels) sum.levelCount[l]++;
+                if(k == (int)DeviceKind::Light) sum.levelCount[0] -= c.removed; //removed rows are zeroed
+            }
+            return sum;
+        }
+        size_t size() const{
+            shared_lock lock(tableMtx);
+            size_t n = 0;
+            for(auto& c : kinds) n += c.ids.size() - c.removed;
+            return n;
+        }
+
+        //Groups ("Building X", "Kitchen") are member masks per kind; allDevices needs no group
+        int addGroup(const string& name){
+            unique_lock lock(tableMtx);
+            groups.push_back({name, {}});
+            return groups.size() - 1;
+        }
+        void addToGroup(int group, TableHandle h){
+            unique_lock lock(tableMtx);
+            vector<uint64_t>& m = groups[group].members[(int)h.kind];
+            if(m.size() <= h.row / 64) m.resize(h.row / 64 + 1, 0);
+            m[h.row / 64] |= 1ull << (h.row % 64);
+        }
+        void useKernels(const BulkKernels* k){
+            unique_lock lock(tableMtx);
+            kernels = k;
+        }
+        const char* kernelName() const{
+            shared_lock lock(tableMtx);
+            return kernels->name;
+        }
+
+        int groupCount() const{
+            shared_lock lock(tableMtx);
+            return groups.size();
+        }
+        string groupName(int group) const{
+            shared_lock lock(tableMtx);
+            return groups[group].name;
+        }
+
+        //Bulk commands: one lock, then a single kernel pass over the kind's column. With changed, the rows
+        //the pass changed are listed too, each with its new value, by comparing against a copy.
+        using RowChanges = vector<pair<uint32_t, int>>;
+        void bulkSetTemp(int group, DeviceKind kind, int temp, RowChanges* changed = nullptr){
+            if(kind == DeviceKind::Light) return;
+            unique_lock lock(tableMtx);
+            Columns& c = cols(kind);
+            const vector<uint64_t>& m = maskFor(group, kind);
+            size_t rows = min(c.setpoints.size(), m.size() * 64);
+            vector<int8_t> before;
+            if(changed) before.assign(c.setpoints.begin(), c.setpoints.begin() + rows);
+            kernels->setBytes(c.setpoints.data(), m.data(), rows, (int8_t)clamp(temp, -128, 127));
+            if(changed) byteChanges(before, c.setpoints, *changed);
+        }
+        void bulkClampTemp(int group, DeviceKind kind, int lo, int hi, RowChanges* changed = nullptr){
+            if(kind == DeviceKind::Light || lo > hi) return;
+            unique_lock lock(tableMtx);
+            Columns& c = cols(kind);
+            const vector<uint64_t>& m = maskFor(group, kind);
+            size_t rows = min(c.setpoints.size(), m.size() * 64);
+            vector<int8_t> before;
+            if(changed) before.assign(c.setpoints.begin(), c.setpoints.begin() + rows);
+            kernels->clampBytes(c.setpoints.data(), m.data(), rows, (int8_t)clamp(lo, -128, 127), (int8_t)clamp(hi, -128, 127));
+            if(changed) byteChanges(before, c.setpoints, *changed);
+        }
+        void bulkPower(int group, DeviceKind kind, PowerOp op, RowChanges* changed = nullptr){
+            unique_lock lock(tableMtx);
+            Columns& c = cols(kind);
+            const vector<uint64_t>& m = maskFor(group, kind);
+            size_t words = min(c.onBits.size(), m.size());
+            vector<uint64_t> before;
+            if(changed) before.assign(c.onBits.begin(), c.onBits.begin() + words);
+            kernels->powerWords(c.onBits.data(), m.data(), words, op);
+            if(!changed) return;
+            for(size_t w = 0; w < words; w++){
+                for(uint64_t diff = before[w] ^ c.onBits[w]; diff; diff &= diff - 1){
+                    uint32_t row = w * 64 + countr_zero(diff);
+                    changed->push_back({row, (int)((c.onBits[w] >> (row % 64)) & 1)});
+                }
+            }
+        }
+        size_t countOn(int group, DeviceKind kind) const{
+            shared_lock lock(tableMtx);
+            const Columns& c = cols(kind);
+            const vector<uint64_t>& m = maskFor(group, kind);
+            return kernels->countBits(c.onBits.data(), m.data(), min(c.onBits.size(), m.size()));
+        }
+};
+
+//Keeps a DeviceTable in step with a DeviceRegistry so status scans and bulk commands run over columns,
+//while the devices stay the source of truth. Devices are added and removed through the fleet; their
+//changes reach the table through the event bus, and start() copies every tracked device in again after a
+//pause. settle() waits for the events published so far, so a scan sees every write that finished before it.
+//A bulk command runs the kernels over the table, then applies what they changed to the devices in batches:
+//one CAS per device, then per batch one table write of the states the CASes produced and one publish to the
+//other subscribers. The fleet skips its own copy of those events. A row keeps the device version it shows
+//and ignores older events, as a device written during a batch may publish before the batch does.
+class DeviceFleet{
+    private:
+        static const size_t deliverBatch = EventBus::batchSize;
+        DeviceRegistry& reg;
+        DeviceTable table;
+        mutable mutex rowsMtx; //taken before tableMtx; held while a row is filled so its events wait for it
+        unordered_map<uint32_t, TableHandle> rows; //by device serial
+        vector<DeviceHandle> handles[deviceKinds]; //by table row, invalid once removed
+        vector<Device*> objects[deviceKinds]; //by table row, null once removed; a row is cleared before its device is retired
+        vector<uint32_t> versions[deviceKinds]; //by table row, the device version the row shows
+        vector<TableWrite> writes; //under rowsMtx, the batch being written, kept for its capacity
+        int subscription = -1;
+        mutable mutex startMtx;
+
+        //publishes outside rowsMtx: with the bus full, a publish waits for the worker that needs it
+        size_t deliver(DeviceKind kind, const DeviceTable::RowChanges& changed, CommandType type){
+            int self;
+            {
+                lock_guard<mutex> lock(startMtx);
+                self = subscription;
+            }
+            EpochGuard guard; //before reading rows: a device still in one is retired after this point
+            vector<Device*> targets;
+            {
+                lock_guard<mutex> lock(rowsMtx);
+                for(auto& [row, value] : changed) targets.push_back(objects[(int)kind][row]);
+            }
+            size_t sent = 0;
+            vector<pair<uint32_t, DeviceState>> written; //row, state after the CAS
+            vector<DeviceEvent> events;
+            written.reserve(deliverBatch);
+            events.reserve(deliverBatch * eventTopics);
+            for(size_t i = 0; i < targets.size(); i++){
+                Device* dev = targets[i];
+                DeviceState before, after;
+                if(dev){
+                    sent++;
+                    if(dev->apply({type, changed[i].second}, before, after)){
+                        written.push_back({changed[i].first, after});
+                        addDeviceChange(events, dev, dev->getSerial(), kind, before, after, self);
+                    }
+                }
+                if(written.size() < deliverBatch && i + 1 < targets.size()) continue;
+                {
+                    lock_guard<mutex> lock(rowsMtx);
+                    writes.clear();
+                    for(auto& [row, s] : written){
+                        TableHandle h{kind, row};
+                        if(!objects[(int)kind][row] || !newer(h, s.version)) continue; //removed, or already newer
+                        writes.push_back({h, EventTopic::Power, s.on});
+                        if(kind == DeviceKind::Light) writes.push_back({h, EventTopic::Brightness, s.level});
+                        else writes.push_back({h, EventTopic::Setpoint, s.temp});
+                    }
+                    if(!writes.empty()) table.write(writes);
+                }
+                bus.publishBatch(events.data(), events.size(), self);
+                written.clear();
+                events.clear();
+            }
+            return sent;
+        }
+        //true if the row should take the event, false for a stale one
+        bool newer(const TableHandle& row, uint32_t version){
+            uint32_t& seen = versions[(int)row.kind][row.row];
+            if((int32_t)(version - seen) < 0) return false;
+            seen = version;
+            return true;
+        }
+        bool validGroup(int group) const{
+            return group == allDevices || (group >= 0 && group < table.groupCount());
+        }
+        void onEvents(const DeviceEvent* e, size_t n){
+            lock_guard<mutex> lock(rowsMtx);
+            writes.clear();
+            for(size_t i = 0; i < n; i++){
+                auto it = rows.find(e[i].serial);
+                if(it == rows.end()) continue; //not tracked, or removed since
+                if(!newer(it->second, e[i].version)) continue;
+                writes.push_back({it->second, e[i].topic, e[i].value});
+            }
+            if(!writes.empty()) table.write(writes);
+        }
+    public:
+        static const int allDevices = DeviceTable::allDevices;
+
+        explicit DeviceFleet(DeviceRegistry& reg) : reg(reg){}
+        ~DeviceFleet(){
+            stop();
+        }
+        //adds to the registry, then to the table; invalid handle, and dev deleted, as with DeviceRegistry::add
+        DeviceHandle add(Device* dev){
+            DeviceKind kind = dev->getKind();
+            uint32_t serial = dev->getSerial();
+            string id = dev->getId();
+            DeviceHandle h = reg.add(dev);
+            if(!h.valid()) return h;
+            lock_guard<mutex> lock(rowsMtx);
+            EpochGuard guard;
+            Device* live = reg.get(h);
+            if(!live) return h; //already removed again
+            TableHandle row = table.add(kind, id);
+            DeviceState state = live->snapshot();
+            table.set(row, state);
+            rows[serial] = row;
+            handles[(int)kind].push_back(h);
+            objects[(int)kind].push_back(live);
+            versions[(int)kind].push_back(state.version);
+            return h;
+        }
+        //the row goes first, so deliver never reads a device that was retired before it looked
+        bool remove(DeviceHandle h){
+            uint32_t serial;
+            {
+                EpochGuard guard;
+                Device* dev = reg.get(h);
+                if(!dev) return false;
+                serial = dev->getSerial();
+            }
+            {
+                lock_guard<mutex> lock(rowsMtx);
+                auto it = rows.find(serial);
+                if(it != rows.end()){
+                    table.remove(it->second);
+                    handles[(int)it->second.kind][it->second.row] = {};
+                    objects[(int)it->second.kind][it->second.row] = nullptr;
+                    rows.erase(it);
+                }
+            }
+            return reg.remove(h);
+        }
+        void reserve(DeviceKind kind, size_t n){
+            table.reserve(kind, n);
+            reg.reserve(n);
+            lock_guard<mutex> lock(rowsMtx);
+            rows.reserve(rows.size() + n);
+            handles[(int)kind].reserve(n);
+            objects[(int)kind].reserve(n);
+            versions[(int)kind].reserve(n);
+        }
+        void start(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription >= 0) return;
+            subscription = bus.subscribe("Device Table",
+                topicBit(EventTopic::Power) | topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+                [this](const DeviceEvent* e, size_t n){onEvents(e, n);}, OverflowPolicy::Block, 16384);
+            //changes made while stopped never reached the table; events queued from here on are newer
+            lock_guard<mutex> rowsLock(rowsMtx);
+            EpochGuard guard;
+            for(auto& [serial, row] : rows){
+                Device* dev = reg.get(handles[(int)row.kind][row.row]);
+                if(!dev) continue;
+                DeviceState state = dev->snapshot();
+                table.set(row, state);
+                versions[(int)row.kind][row.row] = state.version;
+            }
+        }
+        void stop(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription < 0) return;
+            bus.unsubscribe(subscription);
+            subscription = -1;
+        }
+        bool running() const{
+            lock_guard<mutex> lock(startMtx);
+            return subscription >= 0;
+        }
+        //waits until the table has taken in every event published before the call
+        void settle() const{
+            int sub;
+            {
+                lock_guard<mutex> lock(startMtx);
+                sub = subscription;
+            }
+            if(sub < 0) return;
+            //only what is queued now: events published meanwhile would keep a busy stream from ever settling
+            bus.waitDelivered(sub, bus.stats(sub).queued);
+        }
+        TableSummary scan() const{
+            settle();
+            return table.scan();
+        }
+        size_t size() const{
+            return table.size();
+        }
+
+        int addGroup(const string& name){
+            return table.addGroup(name);
+        }
+        bool addToGroup(int group, DeviceHandle h){
+            uint32_t serial;
+            {
+                EpochGuard guard;
+                Device* dev = reg.get(h);
+                if(!dev) return false;
+                serial = dev->getSerial();
+            }
+            if(group < 0 || group >= table.groupCount()) return false;
+            lock_guard<mutex> lock(rowsMtx);
+            auto it = rows.find(serial);
+            if(it == rows.end()) return false;
+            table.addToGroup(group, it->second);
+            return true;
+        }
+        vector<string> groupNames() const{
+            vector<string> out;
+            for(int g = 0; g < table.groupCount(); g++) out.push_back(table.groupName(g));
+            return out;
+        }
+        //Bulk commands over a group or allDevices; each returns how many devices were sent the command
+        size_t setTemp(int group, DeviceKind kind, int temp){
+            if(!validGroup(group)) return 0;
+            settle();
+            DeviceTable::RowChanges changed;
+            table.bulkSetTemp(group, kind, temp, &changed);
+            return deliver(kind, changed, CommandType::SetTemp);
+        }
+        size_t clampTemp(int group, DeviceKind kind, int lo, int hi){
+            if(!validGroup(group)) return 0;
+            settle();
+            DeviceTable::RowChanges changed;
+            table.bulkClampTemp(group, kind, lo, hi, &changed);
+            return deliver(kind, changed, CommandType::SetTemp);
+        }
+        size_t power(int group, DeviceKind kind, PowerOp op){
+            if(!validGroup(group)) return 0;
+            settle();
+            DeviceTable::RowChanges changed;
+            table.bulkPower(group, kind, op, &changed);
+            return deliver(kind, changed, CommandType::SetPower);
+        }
+        size_t countOn(int group, DeviceKind kind) const{
+            if(!validGroup(group)) return 0;
+            settle();
+            return table.countOn(group, kind);
+        }
+};
+
+//Automation rules: "if A1 turns on and F1 temp > 6 then set L1 to low".
+//A rule fires when an event makes one of its conditions become true and all of its conditions then hold.
+//Setting a value a device already has publishes nothing, so rules cannot ping-pong on the same value.
+enum class CmpOp {Eq, Ne, Lt, Le, Gt, Ge};
+
+struct RuleCondition{
+    DeviceHandle device;
+    EventTopic field;
+    CmpOp op;
+    int value;
+    bool holds(int v) const{
+        switch(op){
+            case CmpOp::Eq: return v == value;
+            case CmpOp::Ne: return v != value;
+            case CmpOp::Lt: return v < value;
+            case CmpOp::Le: return v <= value;
+            case CmpOp::Gt: return v > value;
+            case CmpOp::Ge: return v >= value;
+        }
+        return false;
+    }
+};
+
+struct RuleAction{
+    DeviceHandle device;
+    EventTopic field;
+    int value;
+};
+
+struct Rule{
+    string text;
+    vector<RuleCondition> when;
+    vector<RuleAction> then;
+};
+
+struct RuleStats{
+    long events = 0; //events handled
+    long checked = 0; //rule evaluations, only rules indexed under the changed device and field
+    long fired = 0;
+    long actions = 0; //actions that reached a live device
+};
+
+int fieldOf(const DeviceState& s, EventTopic field){
+    switch(field){
+        case EventTopic::Power: return s.on;
+        case EventTopic::Setpoint: return s.temp;
+        case EventTopic::Brightness: return s.level;
+    }
+    return 0;
+}
+
+//Compiled rules plus an index from (device serial, field) to the conditions that read it. The engine is a
+//bus subscriber, so rules run on the bus's consumer thread for it and never on the thread that changed the
+//device. Serials are never reused, unlike addresses; forget() drops a removed device's entries.
+//Actions go to dispatch when one is given (the app queues them as automation work behind people's
+//commands), otherwise they are applied on the bus thread.
+class RuleEngine{
+    private:
+        struct IndexEntry{
+            uint32_t rule;
+            uint16_t cond;
+        };
+        struct DeviceRules{
+            vector<IndexEntry> byField[eventTopics];
+        };
+        DeviceRegistry& reg;
+        const function<void(function<void()>)> dispatch;
+        vector<Rule> rules;
+        unordered_map<uint32_t, DeviceRules> index; //by device serial
+        mutable shared_mutex rulesMtx; //exclusive while adding, shared while evaluating a batch
+        int subscription = -1;
+        mutex startMtx;
+        atomic<long> events{0}, checked{0}, fired{0}, actions{0};
+
+        void apply(const RuleAction& a){//the caller holds an EpochGuard
+            Device* dev = reg.get(a.device);
+            if(!dev) return;
+            switch(a.field){//through the mailbox, so rules and users hitting one device share updates
+                case EventTopic::Power: dev->post({CommandType::SetPower, a.value}); break;
+                case EventTopic::Setpoint: dev->post({CommandType::SetTemp, a.value}); break;
+                case EventTopic::Brightness: dev->post({CommandType::SetBrightness, a.value}); break;
+            }
+            actions++;
+        }
+        void onEvents(const DeviceEvent* e, size_t n){
+            EpochGuard guard;
+            vector<const Rule*> toFire;
+            long looked = 0;
+            {
+                shared_lock lock(rulesMtx);
+                for(size_t i = 0; i < n; i++){
+                    auto it = index.find(e[i].serial);
+                    if(it == index.end()) continue;
+                    for(const IndexEntry& entry : it->second.byField[(int)e[i].topic]){
+                        looked++;
+                        const Rule& r = rules[entry.rule];
+                        const RuleCondition& trigger = r.when[entry.cond];
+                        if(!trigger.holds(e[i].value) || trigger.holds(e[i].previous)) continue; //did not just become true
+                        bool all = true;
+                        for(size_t c = 0; c < r.when.size() && all; c++){
+                            if(c == entry.cond) continue;
+                            Device* d = reg.get(r.when[c].device);
+                            all = d && r.when[c].holds(fieldOf(d->snapshot(), r.when[c].field));
+                        }
+                        if(all) toFire.push_back(&r);
+                    }
+                }
+                for(const Rule* r : toFire){
+                    for(const RuleAction& a : r->then){
+                        if(dispatch){//runs on another thread once this batch's guard is gone
+                            dispatch([this, a](){
+                                EpochGuard guard;
+                                apply(a);
+                            });
+                        }
+                        else apply(a);
+                    }
+                }
+            }
+            events += n;
+            checked += looked;
+            fired += toFire.size();
+        }
+    public:
+        explicit RuleEngine(DeviceRegistry& reg, function<void(function<void()>)> dispatch = nullptr) : reg(reg), dispatch(move(dispatch)){}
+        ~RuleEngine(){
+            stop();
+        }
+        //every device in the rule must still exist
+        bool addRule(const Rule& r){
+            EpochGuard guard;
+            vector<uint32_t> sources;
+            for(auto& c : r.when){
+                Device* d = reg.get(c.device);
+                if(!d) return false;
+                sources.push_back(d->getSerial());
+            }
+            for(auto& a : r.then) if(!reg.get(a.device)) return false;
+            unique_lock lock(rulesMtx);
+            uint32_t id = rules.size();
+            rules.push_back(r);
+            for(size_t c = 0; c < r.when.size(); c++){
+                index[sources[c]].byField[(int)r.when[c].field].push_back({id, (uint16_t)c});
+            }
+            return true;
+        }
+        //drops the index entries of a removed device; its rules can no longer fire from it, and any rule
+        //that also reads it fails its check on the device being gone
+        void forget(uint32_t serial){
+            unique_lock lock(rulesMtx);
+            index.erase(serial);
+        }
+        void reserve(size_t ruleCount, size_t deviceCount){
+            unique_lock lock(rulesMtx);
+            rules.reserve(ruleCount);
+            index.reserve(deviceCount);
+        }
+        void start(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription >= 0) return;
+            subscription = bus.subscribe("Rules", topicBit(EventTopic::Power) | topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+                [this](const DeviceEvent* e, size_t n){onEvents(e, n);}, OverflowPolicy::Block, 16384);
+        }
+        void stop(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription < 0) return;
+            bus.unsubscribe(subscription);
+            subscription = -1;
+        }
+        bool running(){
+            lock_guard<mutex> lock(startMtx);
+            return subscription >= 0;
+        }
+        //true once every event handed to the engine, including ones its own actions caused, was handled
+        bool idle() const{
+            BusStats st = bus.stats(subscription);
+            return st.delivered == st.queued;
+        }
+        vector<string> ruleTexts() const{
+            shared_lock lock(rulesMtx);
+            vector<string> out;
+            for(auto& r : rules) out.push_back(r.text);
+            return out;
+        }
+        size_t size() const{
+            shared_lock lock(rulesMtx);
+            return rules.size();
+        }
+        RuleStats stats() const{
+            RuleStats st;
+            st.events = events;
+            st.checked = checked;
+            st.fired = fired;
+            st.actions = actions;
+            return st;
+        }
+};
+
+//Parses "if <ID> turns|is on|off [and <ID> temp|brightness <op> <value>]... then set <ID> to <value> [and ...]"
+//where a value is on/off, low/mid/high or a temperature. Device IDs are looked up in reg.
+bool parseRule(const string& text, DeviceRegistry& reg, Rule& out, string& error){
+    vector<string> words;
+    istringstream in(text);
+    for(string w; in>>w;) words.push_back(w);
+    auto lower = [](string w){
+        for(auto& c : w) c = tolower(c);
+        return w;
+    };
+    EpochGuard guard;
+    auto find = [&](const string& id, Device*& dev, DeviceHandle& h){
+        h = reg.find(id);
+        dev = reg.get(h);
+        if(dev) return true;
+        error = "No device " + id + ".";
+        return false;
+    };
+    auto levelOf = [](const string& w){
+        return w == "low" ? 1 : w == "mid" ? 2 : w == "high" ? 3 : 0;
+    };
+    auto number = [&](const string& w, int& v){
+        try{
+            size_t used;
+            v = stoi(w, &used);
+            if(used == w.size()) return true;
+        }catch(...){}
+        error = "Expected a number, got " + w + ".";
+        return false;
+    };
+
+    out = Rule();
+    out.text = text;
+    size_t i = 0;
+    if(words.empty() || lower(words[0]) != "if"){
+        error = "Rules start with \"if\".";
+        return false;
+    }
+    i++;
+    while(true){//conditions
+        if(i + 2 >= words.size()){
+            error = "Incomplete condition.";
+            return false;
+        }
+        RuleCondition c;
+        Device* dev;
+        if(!find(words[i], dev, c.device)) return false;
+        string what = lower(words[i + 1]);
+        if(what == "turns" || what == "is"){
+            string v = lower(words[i + 2]);
+            if(v != "on" && v != "off"){
+                error = "Expected on or off after " + what + ".";
+                return false;
+            }
+            c.field = EventTopic::Power;
+            c.op = CmpOp::Eq;
+            c.value = v == "on";
+            i += 3;
+        }
+        else if(what == "temp" || what == "brightness"){
+            if(i + 3 >= words.size()){
+                error = "Incomplete condition.";
+                return false;
+            }
+            bool light = dev->getKind() == DeviceKind::Light;
+            if(light != (what == "brightness")){
+                error = dev->getId() + " has no " + what + ".";
+                return false;
+            }
+            c.field = light ? EventTopic::Brightness : EventTopic::Setpoint;
+            string op = words[i + 2];
+            if(op == "==" || op == "=") c.op = CmpOp::Eq;
+            else if(op == "!=") c.op = CmpOp::Ne;
+            else if(op == "<") c.op = CmpOp::Lt;
+            else if(op == "<=") c.op = CmpOp::Le;
+            else if(op == ">") c.op = CmpOp::Gt;
+            else if(op == ">=") c.op = CmpOp::Ge;
+            else{
+                error = "Unknown comparison " + op + ".";
+                return false;
+            }
+            if(light) c.value = levelOf(lower(words[i + 3]));
+            if(!light || c.value == 0){
+                if(!number(words[i + 3], c.value)) return false;
+            }
+            i += 4;
+        }
+        else{
+            error = "Expected turns, is, temp or brightness after " + words[i] + ".";
+            return false;
+        }
+        out.when.push_back(c);
+        if(i < words.size() && lower(words[i]) == "and"){
+            i++;
+            continue;
+        }
+        break;
+    }
+    if(i >= words.size() || lower(words[i]) != "then"){
+        error = "Expected \"then\".";
+        return false;
+    }
+    i++;
+    while(true){//actions
+        if(i + 3 >= words.size()){
+            error = "Incomplete action, use: set <ID> to <value>.";
+            return false;
+        }
+        if(lower(words[i]) != "set" || lower(words[i + 2]) != "to"){
+            error = "Actions look like: set <ID> to <value>.";
+            return false;
+        }
+        RuleAction a;
+        Device* dev;
+        if(!find(words[i + 1], dev, a.device)) return false;
+        string v = lower(words[i + 3]);
+        if(v == "on" || v == "off"){
+            a.field = EventTopic::Power;
+            a.value = v == "on";
+        }
+        else if(dev->getKind() == DeviceKind::Light){
+            a.field = EventTopic::Brightness;
+            a.value = levelOf(v);
+            if(a.value == 0){
+                error = "Lights take low, mid or high.";
+                return false;
+            }
+        }
+        else{
+            a.field = EventTopic::Setpoint;
+            if(!number(words[i + 3], a.value)) return false;
+        }
+        out.then.push_back(a);
+        i += 4;
+        if(i < words.size() && lower(words[i]) == "and"){
+            i++;
+            continue;
+        }
+        break;
+    }
+    if(i != words.size()){
+        error = "Unexpected \"" + words[i] + "\".";
+        return false;
+    }
+    return true;
+}
+
+struct TelemetryPoint{
+    uint64_t timeMs; //since the store was made
+    int value;
+};
+struct TelemetryBucket{//one step of a downsampled range
+    uint64_t startMs;
+    int minValue, maxValue;
+    double mean;
+    uint32_t samples;
+};
+struct TelemetryStats{
+    size_t series, maxSeries;
+    long samples, dropped; //dropped: changes of devices past the memory budget
+    long forgotten; //series freed for removed devices
+    size_t bytes;
+    double bitsPerSample;
+};
+
+//History of every setpoint and brightness change, one series per device serial, covering a day.
+//A series is a ring of raw blocks of 512 bits plus a roll-up of 48 half-hour buckets. Before the writer
+//reuses a raw block it folds that block's changes into the buckets as min, max, sum and count, so the
+//newest changes stay exact (at least the last 13, more when they compress well) and the 24 h before the
+//latest one are kept per half hour, whatever the change rate. Memory is fixed per device and the budget
+//fixes how many devices get a series; forget() frees the series of a removed device.
+//Inside a block, times are Gorilla delta-of-delta coded and values as deltas:
+//  time:  0 same step | 10 +7 bits | 110 +12 bits | 1110 +20 bits | 1111 +32 bits
+//  value: 0 same      | 10 +3 bits delta | 11 +8 bits value
+//Times are ms since the store was made, 64-bit at the start of a block; a jump too big for 32 bits
+//starts a new block. There is one writer (the bus worker, or whoever calls append), which only locks to
+//add or free a series. Readers copy a block and check its number before and after; the writer clears the
+//number while it reuses the block. A fold bumps foldSeq, odd while it runs, which readers check the same way.
+class TelemetryStore{
+    public:
+        static const int ringBlocks = 2;
+        static const int wordsPerBlock = 8;
+        static const int rollBuckets = 48;
+        static const uint64_t rollStepMs = 1800000; //rollBuckets steps are the day a series covers
+    private:
+        static const uint32_t blockBits = wordsPerBlock * 64;
+        static const uint32_t maxSampleBits = 4 + 32 + 2 + 8;
+        static const uint32_t reusing = UINT32_MAX;
+        static const uint32_t maxRollCount = 4095;
+        static const size_t recentForgets = 4096;
+        struct Block{
+            atomic<uint32_t> number{reusing}; //which block of the series this is
+            atomic<uint32_t> count{0}; //samples readers may decode, published with release
+            atomic<uint64_t> startMs{0};
+            atomic<int32_t> firstValue{0};
+            atomic<uint64_t> words[wordsPerBlock] = {};
+        };
+        //one roll-up bucket in a word: bits 0-15 interval number (mod 2^16), 16-27 count, 28-35 min,
+        //36-43 max, 44-63 sum. The count stops at 4095, a change every 0.4 s; min and max still move after.
+        struct Rollup{
+            uint32_t interval, count;
+            int minValue, maxValue;
+            int32_t sum;
+        };
+        struct Series{
+            atomic<uint32_t> head{0}; //number of the block being filled, block n is ring[n % ringBlocks]
+            atomic<uint32_t> foldSeq{0}; //twice the number of blocks folded, odd during a fold
+            Block ring[ringBlocks];
+            atomic<uint64_t> roll[rollBuckets] = {}; //interval i is roll[i % rollBuckets]
+            //writer only
+            uint64_t lastMs = 0;
+            int64_t lastDelta = 0;
+            int lastValue = 0;
+            uint32_t bits = 0;
+        };
+        struct Copy{//a block as a reader saw it
+            uint32_t count;
+            uint64_t startMs;
+            int32_t firstValue;
+            uint64_t words[wordsPerBlock];
+        };
+
+        const size_t maxSeries;
+        const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+        const uint64_t startedNs = chrono::duration_cast<chrono::nanoseconds>(started.time_since_epoch()).count();
+        unordered_map<uint32_t, shared_ptr<Series>> index; //only the writer inserts and erases
+        mutable mutex indexMtx; //taken by the writer when inserting or erasing and by readers looking up
+        atomic<long> samples{0}, dropped{0}, forgotten{0};
+        atomic<long> closedSamples{0}, closedBits{0}; //blocks that filled up, for the compression ratio
+        mutex forgetMtx;
+        vector<uint32_t> toForget; //guarded by forgetMtx, applied by the writer
+        atomic<bool> forgetPending{false};
+        //writer only: serials forgotten lately, so their events still in flight do not make a new series
+        unordered_set<uint32_t> recent;
+        deque<uint32_t> recentOrder;
+        int subscription = -1;
+        mutex startMtx;
+
+        static void putBits(Block& b, uint32_t pos, uint64_t value, uint32_t n){
+            uint32_t w = pos / 64, off = pos % 64;
+            b.words[w].store(b.words[w].load(memory_order_relaxed) | value << off, memory_order_relaxed);
+            if(off + n > 64) b.words[w + 1].store(b.words[w + 1].load(memory_order_relaxed) | value >> (64 - off), memory_order_relaxed);
+        }
+        static uint64_t getBits(const uint64_t* words, uint32_t& pos, uint32_t n){
+            uint32_t w = pos / 64, off = pos % 64;
+            uint64_t v = words[w] >> off;
+            if(off + n > 64) v |= words[w + 1] << (64 - off);
+            pos += n;
+            return n == 64 ? v : v & ((1ull << n) - 1);
+        }
+        static bool fits(int64_t v, int bits){
+            return v >= -(1ll << (bits - 1)) && v < (1ll << (bits - 1));
+        }
+        static uint32_t timeBits(int64_t dod){
+            if(dod == 0) return 1;
+            if(fits(dod, 7)) return 2 + 7;
+            if(fits(dod, 12)) return 3 + 12;
+            if(fits(dod, 20)) return 4 + 20;
+            return 4 + 32;
+        }
+        static uint32_t valueBits(int dv){
+            if(dv == 0) return 1;
+            if(fits(dv, 3)) return 2 + 3;
+            return 2 + 8;
+        }
+        //prefix and payload go in as one field: code bits first, payload after
+        static void putCoded(Block& b, uint32_t& pos, uint32_t code, uint32_t codeBits, int64_t payload, uint32_t payloadBits){
+            putBits(b, pos, code, codeBits);
+            pos += codeBits;
+            if(payloadBits == 0) return;
+            putBits(b, pos, (uint64_t)payload & ((1ull << payloadBits) - 1), payloadBits);
+            pos += payloadBits;
+        }
+        static int64_t signExtend(uint64_t v, uint32_t bits){
+            return (int64_t)(v << (64 - bits)) >> (64 - bits);
+        }
+        static uint64_t packRoll(const Rollup& r){
+            return (uint64_t)(r.interval & 0xFFFF)
+                | (uint64_t)r.count << 16
+                | (uint64_t)(uint8_t)(int8_t)r.minValue << 28
+                | (uint64_t)(uint8_t)(int8_t)r.maxValue << 36
+                | (uint64_t)((uint32_t)r.sum & 0xFFFFF) << 44;
+        }
+        static Rollup unpackRoll(uint64_t w){
+            Rollup r;
+            r.interval = w & 0xFFFF;
+            r.count = (w >> 16) & 0xFFF;
+            r.minValue = (int8_t)(uint8_t)(w >> 28);
+            r.maxValue = (int8_t)(uint8_t)(w >> 36);
+            r.sum = (int32_t)signExtend(w >> 44, 20);
+            return r;
+        }
+
+        shared_ptr<Series> find(uint32_t serial) const{
+            lock_guard<mutex> lock(indexMtx);
+            auto it = index.find(serial);
+            return it == index.end() ? nullptr : it->second;
+        }
+        //writer side of forget()
+        void applyForgets(){
+            vector<uint32_t> serials;
+            {
+                lock_guard<mutex> lock(forgetMtx);
+                serials.swap(toForget);
+                forgetPending.store(false, memory_order_relaxed);
+            }
+            for(uint32_t serial : serials){
+                {
+                    lock_guard<mutex> lock(indexMtx);
+                    if(index.erase(serial)) forgotten++;
+                }
+                if(!recent.insert(serial).second) continue;
+                recentOrder.push_back(serial);
+                if(recentOrder.size() > recentForgets){
+                    recent.erase(recentOrder.front());
+                    recentOrder.pop_front();
+                }
+            }
+        }
+        Copy copyOf(const Block& b) const{//writer only, nothing changes under it
+            Copy c;
+            c.count = b.count.load(memory_order_relaxed);
+            c.startMs = b.startMs.load(memory_order_relaxed);
+            c.firstValue = b.firstValue.load(memory_order_relaxed);
+            for(int w = 0; w < wordsPerBlock; w++) c.words[w] = b.words[w].load(memory_order_relaxed);
+            return c;
+        }
+        //folds block number into the roll-up before it is reused; blocks are folded oldest first, so an
+        //interval is only ever replaced by a later one
+        void fold(Series& s, uint32_t number){
+            Copy c = copyOf(s.ring[number % ringBlocks]);
+            s.foldSeq.store(2 * number + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            decode(c, [&s](TelemetryPoint p){
+                uint64_t interval = p.timeMs / rollStepMs;
+                atomic<uint64_t>& slot = s.roll[interval % rollBuckets];
+                Rollup r = unpackRoll(slot.load(memory_order_relaxed));
+                if(r.count == 0 || r.interval != (interval & 0xFFFF)) r = {(uint32_t)interval, 0, p.value, p.value, 0};
+                r.minValue = min(r.minValue, p.value);
+                r.maxValue = max(r.maxValue, p.value);
+                if(r.count < maxRollCount){
+                    r.count++;
+                    r.sum += p.value;
+                }
+                slot.store(packRoll(r), memory_order_relaxed);
+            });
+            s.foldSeq.store(2 * (number + 1), memory_order_release);
+        }
+        void openBlock(Series& s, uint32_t number, uint64_t timeMs, int value){
+            if(number >= ringBlocks) fold(s, number - ringBlocks);
+            Block& b = s.ring[number % ringBlocks];
+            b.number.store(reusing, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            b.count.store(0, memory_order_relaxed);
+            for(auto& w : b.words) w.store(0, memory_order_relaxed);
+            b.startMs.store(timeMs, memory_order_relaxed);
+            b.firstValue.store(value, memory_order_relaxed);
+            b.count.store(1, memory_order_relaxed);
+            b.number.store(number, memory_order_release);
+            s.head.store(number, memory_order_release);
+            s.lastMs = timeMs;
+            s.lastDelta = 0;
+            s.lastValue = value;
+            s.bits = 0;
+        }
+        //copies the readable blocks numbered from on, oldest first, leaving out any the writer reused meanwhile
+        vector<Copy> copyBlocks(const Series& s, uint32_t from = 0) const{
+            vector<Copy> out;
+            uint32_t head = s.head.load(memory_order_acquire);
+            uint32_t first = max(from, head >= ringBlocks ? head - ringBlocks + 1 : 0);
+            for(uint32_t n = first; n <= head; n++){
+                const Block& b = s.ring[n % ringBlocks];
+                Copy c;
+                if(b.number.load(memory_order_acquire) != n) continue; //already reused
+                c.count = b.count.load(memory_order_acquire);
+                c.startMs = b.startMs.load(memory_order_relaxed);
+                c.firstValue = b.firstValue.load(memory_order_relaxed);
+                for(int w = 0; w < wordsPerBlock; w++) c.words[w] = b.words[w].load(memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+                if(b.number.load(memory_order_relaxed) != n) continue; //reused while copying
+                out.push_back(c);
+            }
+            return out;
+        }
+        //the roll-up and the raw blocks not folded into it, both as of the same fold
+        void copySeries(const Series& s, vector<Copy>& blocks, uint64_t roll[rollBuckets]) const{
+            while(true){
+                uint32_t seq = s.foldSeq.load(memory_order_acquire);
+                if(seq & 1){
+                    this_thread::yield();
+                    continue;
+                }
+                for(int i = 0; i < rollBuckets; i++) roll[i] = s.roll[i].load(memory_order_relaxed);
+                blocks = copyBlocks(s, seq / 2);
+                atomic_thread_fence(memory_order_acquire);
+                if(s.foldSeq.load(memory_order_relaxed) == seq) return;
+            }
+        }
+        template <typename F>
+        static void decode(const Copy& c, F visit){
+            uint32_t pos = 0;
+            int64_t t = c.startMs, delta = 0;
+            int value = c.firstValue;
+            visit(TelemetryPoint{(uint64_t)t, value});
+            for(uint32_t i = 1; i < c.count; i++){
+                int64_t dod = 0;
+                if(getBits(c.words, pos, 1)){
+                    if(!getBits(c.words, pos, 1)) dod = signExtend(getBits(c.words, pos, 7), 7);
+                    else if(!getBits(c.words, pos, 1)) dod = signExtend(getBits(c.words, pos, 12), 12);
+                    else if(!getBits(c.words, pos, 1)) dod = signExtend(getBits(c.words, pos, 20), 20);
+                    else dod = signExtend(getBits(c.words, pos, 32), 32);
+                }
+                delta += dod;
+                t += delta;
+                if(getBits(c.words, pos, 1)){
+                    if(!getBits(c.words, pos, 1)) value += signExtend(getBits(c.words, pos, 3), 3);
+                    else value = (int8_t)getBits(c.words, pos, 8);
+                }
+                visit(TelemetryPoint{(uint64_t)t, value});
+            }
+        }
+        void onEvents(const DeviceEvent* e, size_t n){
+            for(size_t i = 0; i < n; i++){
+                append(e[i].serial, (e[i].timeNs - startedNs) / 1000000, e[i].value);
+            }
+        }
+    public:
+        //budgetBytes caps the memory of all series together
+        explicit TelemetryStore(size_t budgetBytes) : maxSeries(budgetBytes / sizeof(Series)){}
+        ~TelemetryStore(){
+            stop();
+        }
+        //changes a series keeps raw however badly they compress: the full blocks behind the one being filled
+        static uint32_t minKept(){
+            return (ringBlocks - 1) * (1 + blockBits / maxSampleBits) + 1;
+        }
+        static size_t seriesBytes(){
+            return sizeof(Series);
+        }
+        uint64_t nowMs() const{
+            return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+        }
+        //single writer: only one thread may append at a time
+        void append(uint32_t serial, uint64_t timeMs, int value){
+            if(forgetPending.load(memory_order_acquire)) applyForgets();
+            auto it = index.find(serial);
+            Series* s;
+            if(it != index.end()) s = it->second.get();
+            else{
+                if(recent.count(serial)) return; //removed, this change was still on its way
+                if(index.size() >= maxSeries){
+                    dropped++;
+                    return;
+                }
+                shared_ptr<Series> fresh = make_shared<Series>();
+                openBlock(*fresh, 0, timeMs, value);
+                lock_guard<mutex> lock(indexMtx);
+                index.emplace(serial, move(fresh));
+                samples++;
+                return;
+            }
+            timeMs = max(timeMs, s->lastMs); //events of one device can arrive a few us out of order
+            int64_t delta = (int64_t)(timeMs - s->lastMs);
+            int64_t dod = delta - s->lastDelta;
+            int dv = value - s->lastValue;
+            uint32_t need = timeBits(dod) + valueBits(dv);
+            uint32_t head = s->head.load(memory_order_relaxed);
+            if(s->bits + need > blockBits || !fits(dod, 32)){
+                closedSamples += s->ring[head % ringBlocks].count.load(memory_order_relaxed);
+                closedBits += s->bits + 8 * (sizeof(uint64_t) + sizeof(int32_t)); //plus the first time and value
+                openBlock(*s, head + 1, timeMs, value);
+                samples++;
+                return;
+            }
+            Block& b = s->ring[head % ringBlocks];
+            uint32_t pos = s->bits;
+            if(dod == 0) putCoded(b, pos, 0b0, 1, 0, 0);
+            else if(fits(dod, 7)) putCoded(b, pos, 0b01, 2, dod, 7); //bits are read lowest first, so "10" is stored as 0b01
+            else if(fits(dod, 12)) putCoded(b, pos, 0b011, 3, dod, 12);
+            else if(fits(dod, 20)) putCoded(b, pos, 0b0111, 4, dod, 20);
+            else putCoded(b, pos, 0b1111, 4, dod, 32);
+            if(dv == 0) putCoded(b, pos, 0b0, 1, 0, 0);
+            else if(fits(dv, 3)) putCoded(b, pos, 0b01, 2, dv, 3);
+            else putCoded(b, pos, 0b11, 2, value, 8);
+            s->bits = pos;
+            s->lastMs = timeMs;
+            s->lastDelta = delta;
+            s->lastValue = value;
+            b.count.store(b.count.load(memory_order_relaxed) + 1, memory_order_release);
+            samples++;
+        }
+        //frees the series of a removed device, from any thread; the writer does it on its next append
+        void forget(uint32_t serial){
+            lock_guard<mutex> lock(forgetMtx);
+            toForget.push_back(serial);
+            forgetPending.store(true, memory_order_release);
+        }
+        //whether older changes of the series are only left in the roll-up
+        bool folded(uint32_t serial) const{
+            shared_ptr<Series> s = find(serial);
+            return s && s->foldSeq.load(memory_order_acquire) > 0;
+        }
+        //raw samples with fromMs <= time < toMs
+        vector<TelemetryPoint> range(uint32_t serial, uint64_t fromMs, uint64_t toMs) const{
+            vector<TelemetryPoint> out;
+            shared_ptr<Series> s = find(serial);
+            if(!s) return out;
+            for(const Copy& c : copyBlocks(*s)){
+                decode(c, [&](TelemetryPoint p){
+                    if(p.timeMs >= fromMs && p.timeMs < toMs) out.push_back(p);
+                });
+            }
+            return out;
+        }
+        //the same range cut into steps of stepMs, empty steps left out. Where only the roll-up is left, a
+        //half hour goes into the step holding its start, whole: a step there is never finer than that.
+        vector<TelemetryBucket> downsample(uint32_t serial, uint64_t fromMs, uint64_t toMs, uint64_t stepMs) const{
+            vector<TelemetryBucket> out;
+            shared_ptr<Series> s = find(serial);
+            if(!s || stepMs == 0 || fromMs >= toMs) return out;
+            vector<Copy> blocks;
+            uint64_t roll[rollBuckets];
+            copySeries(*s, blocks, roll);
+            struct Acc{
+                int minValue, maxValue;
+                double sum;
+                uint32_t samples;
+            };
+            map<uint64_t, Acc> steps; //by start
+            auto add = [&](uint64_t at, int lo, int hi, double sum, uint32_t n){
+                uint64_t start = fromMs + (max(at, fromMs) - fromMs) / stepMs * stepMs;
+                auto it = steps.try_emplace(start, Acc{lo, hi, 0, 0}).first;
+                it->second.minValue = min(it->second.minValue, lo);
+                it->second.maxValue = max(it->second.maxValue, hi);
+                it->second.sum += sum;
+                it->second.samples += n;
+            };
+            uint64_t latest = 0;
+            for(const Copy& c : blocks){
+                decode(c, [&](TelemetryPoint p){
+                    latest = max(latest, p.timeMs);
+                    if(p.timeMs >= fromMs && p.timeMs < toMs) add(p.timeMs, p.value, p.value, p.value, 1);
+                });
+            }
+            uint64_t last = latest / rollStepMs; //the day the roll-up covers ends with this interval
+            for(int i = 0; i < rollBuckets; i++){
+                Rollup r = unpackRoll(roll[i]);
+                if(r.count == 0) continue;
+                uint64_t interval = last - ((last - r.interval) & 0xFFFF); //latest interval with these low bits
+                if(interval > last || last - interval >= rollBuckets || interval % rollBuckets != (uint64_t)i) continue; //stale
+                uint64_t start = interval * rollStepMs;
+                if(start >= toMs || start + rollStepMs <= fromMs) continue;
+                add(start, r.minValue, r.maxValue, r.sum, r.count);
+            }
+            for(auto& [start, a] : steps) out.push_back({start, a.minValue, a.maxValue, a.sum / a.samples, a.samples});
+            return out;
+        }
+        TelemetryStats stats() const{
+            TelemetryStats st;
+            {
+                lock_guard<mutex> lock(indexMtx);
+                st.series = index.size();
+            }
+            st.maxSeries = maxSeries;
+            st.samples = samples;
+            st.dropped = dropped;
+            st.forgotten = forgotten;
+            st.bytes = st.series * sizeof(Series);
+            st.bitsPerSample = closedSamples ? (double)closedBits / closedSamples : 0;
+            return st;
+        }
+        void start(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription >= 0) return;
+            subscription = bus.subscribe("Telemetry", topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+                [this](const DeviceEvent* e, size_t n){onEvents(e, n);}, OverflowPolicy::Block, 16384);
+        }
+        void stop(){
+            lock_guard<mutex> lock(startMtx);
+            if(subscription < 0) return;
+            bus.unsubscribe(subscription);
+            subscription = -1;
+        }
+        bool running(){
+            lock_guard<mutex> lock(startMtx);
+            return subscription >= 0;
+        }
+};
+
+struct TimerId{
+    uint32_t index = UINT32_MAX;
+    uint32_t gen = 0;
+    bool valid() const{
+        return index != UINT32_MAX;
+    }
+};
+
+//Hierarchical timer wheel: 4 levels of 256 slots, so one level covers 256 ticks of the level below and
+//the wheel reaches 2^32 ticks ahead. Timers live in a node pool on intrusive lists, so insert and cancel
+//are O(1); a timer in a higher level is moved down when its slot comes up. Not thread-safe.
+template<class T> class TimerWheel{
+    private:
+        static const int levels = 4;
+        static const int slotBits = 8;
+        static const uint32_t slots = 1u << slotBits;
+        static const uint32_t none = UINT32_MAX;
+        struct Node{
+            uint64_t expires = 0;
+            uint32_t prev = none, next = none;
+            uint32_t gen = 0;
+            uint32_t slot = none; //level * slots + slot while linked
+            T value;
+        };
+        vector<Node> nodes;
+        vector<uint32_t> freeNodes;
+        uint32_t heads[levels * slots];
+        uint64_t now = 0;
+        size_t count = 0;
+
+        //expires >= now: a timer cascaded down on its due tick lands in the level 0 slot still to be run this tick
+        void link(uint32_t n){
+            Node& node = nodes[n];
+            int level = 0;
+            while(level < levels - 1 && (node.expires >> (slotBits * (level + 1))) != (now >> (slotBits * (level + 1)))) level++;
+            uint32_t key = level * slots + ((node.expires >> (slotBits * level)) & (slots - 1));
+            node.slot = key;
+            node.prev = none;
+            node.next = heads[key];
+            if(node.next != none) nodes[node.next].prev = n;
+            heads[key] = n;
+        }
+        void unlink(uint32_t n){
+            Node& node = nodes[n];
+            if(node.prev != none) nodes[node.prev].next = node.next;
+            else heads[node.slot] = node.next;
+            if(node.next != none) nodes[node.next].prev = node.prev;
+            node.slot = none;
+        }
+        bool live(TimerId id) const{
+            return id.index < nodes.size() && nodes[id.index].gen == id.gen;
+        }
+    public:
+        explicit TimerWheel(uint64_t start = 0) : now(start){
+            fill(begin(heads), end(heads), none);
+        }
+        void reserve(size_t timers){
+            nodes.reserve(timers);
+        }
+        TimerId insert(uint64_t expires, T value){
+            uint32_t n;
+            if(!freeNodes.empty()){
+                n = freeNodes.back();
+                freeNodes.pop_back();
+            }
+            else{
+                n = nodes.size();
+                nodes.emplace_back();
+            }
+            nodes[n].expires = max(expires, now + 1); //this tick's slot is already done, overdue means next tick
+            nodes[n].value = move(value);
+            link(n);
+            count++;
+            return {n, nodes[n].gen};
+        }
+        bool cancel(TimerId id){
+            if(!live(id)) return false;
+            if(nodes[id.index].slot != none) unlink(id.index);
+            release(id);
+            return true;
+        }
+        //moves time to tick `to`; timers that come due are unlinked and their ids appended to expired.
+        //The caller then either release()s them or reschedule()s them.
+        void advance(uint64_t to, vector<TimerId>& expired){
+            while(now < to){
+                now++;
+                int top = 0; //highest level whose lower digits just wrapped
+                while(top < levels - 1 && (now & ((1ull << (slotBits * (top + 1))) - 1)) == 0) top++;
+                for(int level = top; level >= 1; level--){//top down, so what moves down is cascaded again this tick
+                    uint32_t key = level * slots + ((now >> (slotBits * level)) & (slots - 1));
+                    uint32_t n = heads[key];
+                    heads[key] = none;
+                    while(n != none){
+                        uint32_t next = nodes[n].next;
+                        link(n);
+                        n = next;
+                    }
+                }
+                uint32_t key = now & (slots - 1);
+                uint32_t n = heads[key];
+                heads[key] = none;
+                while(n != none){
+                    uint32_t next = nodes[n].next;
+                    nodes[n].slot = none;
+                    expired.push_back({n, nodes[n].gen});
+                    n = next;
+                }
+            }
+        }
+        void reschedule(TimerId id, uint64_t expires){
+            if(!live(id)) return;
+            if(nodes[id.index].slot != none) unlink(id.index);
+            nodes[id.index].expires = max(expires, now + 1);
+            link(id.index);
+        }
+        void release(TimerId id){
+            if(!live(id)) return;
+            Node& node = nodes[id.index];
+            node.gen++;
+            node.value = T();
+            freeNodes.push_back(id.index);
+            count--;
+        }
+        T* get(TimerId id){
+            return live(id) ? &nodes[id.index].value : nullptr;
+        }
+        uint64_t expiresAt(TimerId id) const{
+            return live(id) ? nodes[id.index].expires : 0;
+        }
+        //live timers in pool order, for listings
+        vector<TimerId> timers() const{
+            vector<TimerId> out;
+            vector<bool> freed(nodes.size(), false);
+            for(uint32_t n : freeNodes) freed[n] = true;
+            for(uint32_t n = 0; n < nodes.size(); n++) if(!freed[n]) out.push_back({n, nodes[n].gen});
+            return out;
+        }
+        uint64_t currentTick() const{
+            return now;
+        }
+        size_t size() const{
+            return count;
+        }
+};
+
+//Delayed and recurring commands: a ticker thread advances a 1 ms timer wheel and hands due jobs to a
+//small worker pool, so a waiting command costs a wheel node instead of a sleeping thread.
+class Scheduler{
+    public:
+        using Clock = chrono::steady_clock;
+    private:
+        struct Job{
+            function<void()> fn;
+            uint64_t period = 0; //ticks, 0 = once
+            string text;
+        };
+        TimerWheel<Job> wheel;
+        mutex wheelMtx;
+        Clock::time_point epoch = Clock::now(); //tick 0
+        thread ticker;
+        vector<thread> workers;
+        deque<function<void()>> ready;
+        mutex readyMtx;
+        condition_variable readyCv;
+        bool running = false; //guarded by readyMtx
+        atomic<bool> ticking{false};
+        mutex startMtx;
+        atomic<long> fired{0};
+
+        uint64_t tickOf(Clock::time_point t) const{
+            return chrono::duration_cast<chrono::milliseconds>(t - epoch).count();
+        }
+        void tick(){
+            vector<TimerId> due;
+            vector<function<void()>> run;
+            while(ticking.load()){
+                this_thread::sleep_until(epoch + chrono::milliseconds(wheel.currentTick() + 1));
+                due.clear();
+                run.clear();
+                {
+                    lock_guard<mutex> lock(wheelMtx);
+                    wheel.advance(tickOf(Clock::now()), due);
+                    for(TimerId id : due){
+                        Job* job = wheel.get(id);
+                        if(job->period){//re-arm from the due tick, not from now, so it does not drift
+                            run.push_back(job->fn);
+                            wheel.reschedule(id, wheel.expiresAt(id) + job->period);
+                        }
+                        else{
+                            run.push_back(move(job->fn));
+                            wheel.release(id);
+                        }
+                    }
+                }
+                if(run.empty()) continue;
+                fired += run.size();
+                {
+                    lock_guard<mutex> lock(readyMtx);
+                    for(auto& fn : run) ready.push_back(move(fn));
+                }
+                readyCv.notify_all();
+            }
+        }
+        void work(){
+            while(true){
+                function<void()> fn;
+                {
+                    unique_lock<mutex> lock(readyMtx);
+                    readyCv.wait(lock, [this](){return !ready.empty() || !running;});
+                    if(ready.empty()) return;
+                    fn = move(ready.front());
+                    ready.pop_front();
+                }
+                fn();
+            }
+        }
+        TimerId add(uint64_t delayTicks, uint64_t period, function<void()> fn, string text){
+            start();
+            lock_guard<mutex> lock(wheelMtx);
+            uint64_t due = max(tickOf(Clock::now()), wheel.currentTick()) + 1 + delayTicks; //never early: the current tick is partly gone
+            return wheel.insert(due, Job{move(fn), period, move(text)});
+        }
+    public:
+        explicit Scheduler(int workerCount = 4) : workers(workerCount){}
+        ~Scheduler(){
+            stop();
+        }
+        void start(){
+            lock_guard<mutex> lock(startMtx);
+            if(ticking.load()) return;
+            {
+                lock_guard<mutex> lock(readyMtx);
+                running = true;
+            }
+            for(auto& w : workers) w = thread([this](){work();});
+            ticking = true;
+            ticker = thread([this](){tick();});
+        }
+        //pending timers stay in the wheel, jobs already handed to the pool still run
+        void stop(){
+            lock_guard<mutex> lock(startMtx);
+            if(!ticking.load()) return;
+            ticking = false;
+            ticker.join();
+            {
+                lock_guard<mutex> lock(readyMtx);
+                running = false;
+            }
+            readyCv.notify_all();
+            for(auto& w : workers) w.join();
+        }
+        TimerId after(chrono::milliseconds delay, function<void()> fn, string text = ""){
+            return add(delay.count(), 0, move(fn), move(text));
+        }
+        TimerId every(chrono::milliseconds period, function<void()> fn, string text = ""){
+            return every(period, period, move(fn), move(text));
+        }
+        TimerId every(chrono::milliseconds first, chrono::milliseconds period, function<void()> fn, string text = ""){
+            return add(first.count(), max<long long>(period.count(), 1), move(fn), move(text));
+        }
+        bool cancel(TimerId id){
+            lock_guard<mutex> lock(wheelMtx);
+            return wheel.cancel(id);
+        }
+        struct Pending{
+            TimerId id;
+            string text;
+            long long dueInMs;
+            long long periodMs;
+        };
+        vector<Pending> pending(){
+            lock_guard<mutex> lock(wheelMtx);
+            vector<Pending> out;
+            uint64_t now = tickOf(Clock::now());
+            for(TimerId id : wheel.timers()){
+                Job* job = wheel.get(id);
+                uint64_t due = wheel.expiresAt(id);
+                out.push_back({id, job->text, due > now ? (long long)(due - now) : 0, (long long)job->period});
+            }
+            sort(out.begin(), out.end(), [](const Pending& a, const Pending& b){return a.dueInMs < b.dueInMs;});
+            return out;
+        }
+        size_t size(){
+            lock_guard<mutex> lock(wheelMtx);
+            return wheel.size();
+        }
+        long firedCount() const{
+            return fired;
+        }
+};
+
+enum class Priority : uint8_t {Interactive, Automation, Telemetry};
+const int priorities = 3;
+
+struct DispatchStats{
+    long submitted, done, stolen, aged; //aged: taken ahead of higher classes after waiting too long
+    double p50Us, p99Us, maxUs; //time in the queue, over the last 64k jobs
+};
+
+//Runs device work on a few workers, interactive commands first. Every worker has a queue per priority. A
+//submit from outside goes to the workers round robin, and one made by a worker goes to its own queues.
+//A worker takes the highest class anyone has pending, from its own queue if it can, otherwise it
+//steals the oldest one from another worker. So that a flood of automation cannot starve telemetry for
+//good, a background job that waited past its class's aging limit goes ahead of the other background
+//work; only interactive commands, which come one at a time from people, still go first.
+class CommandDispatcher{
+    public:
+        using Clock = chrono::steady_clock;
+    private:
+        struct Job{
+            function<void()> fn;
+            Clock::time_point queued;
+        };
+        struct Worker{
+            mutex mtx;
+            deque<Job> queues[priorities];
+            thread th;
+        };
+        static const size_t sampleCount = 65536;
+        const chrono::milliseconds agingLimit[priorities] = {chrono::milliseconds(0), chrono::milliseconds(20), chrono::milliseconds(50)};
+
+        const int workerCount;
+        vector<unique_ptr<Worker>> workers;
+        atomic<long> pending[priorities] = {};
+        atomic<long> queued{0}, busy{0};
+        atomic<uint32_t> nextWorker{0};
+        mutex sleepMtx;
+        condition_variable wake;
+        bool running = false; //guarded by sleepMtx
+        atomic<bool> started{false};
+        mutex startMtx;
+        inline static thread_local int self = -1; //worker index on a worker thread
+
+        mutex statsMtx;
+        long submitted[priorities] = {}, done[priorities] = {}, stolen[priorities] = {}, aged[priorities] = {};
+        vector<float> waitUs[priorities];
+        size_t sampleNext[priorities] = {};
+
+        bool takeFrom(int w, int p, bool onlyAged, Clock::time_point now, Job& job){
+            Worker& worker = *workers[w];
+            lock_guard<mutex> lock(worker.mtx);
+            deque<Job>& q = worker.queues[p];
+            if(q.empty() || (onlyAged && now - q.front().queued < agingLimit[p])) return false;
+            job = move(q.front());
+            q.pop_front();
+            return true;
+        }
+        bool takeClass(int me, int p, bool onlyAged, Clock::time_point now, Job& job, bool& wasStolen){
+            if(pending[p].load() == 0) return false;
+            for(int k = 0; k < workerCount; k++){
+                if(!takeFrom((me + k) % workerCount, p, onlyAged, now, job)) continue;
+                wasStolen = k > 0;
+                return true;
+            }
+            return false;
+        }
+        //fills job and its class, false if nothing is queued anywhere
+        bool take(int me, Job& job, int& prio, bool& wasStolen, bool& wasAged){
+            Clock::time_point now = Clock::now();
+            wasAged = false;
+            int interactive = (int)Priority::Interactive;
+            if(takeClass(me, interactive, false, now, job, wasStolen)){
+                prio = interactive;
+                return true;
+            }
+            for(int p = priorities - 1; p > interactive; p--){//starvation protection, lowest class first
+                if(!takeClass(me, p, true, now, job, wasStolen)) continue;
+                prio = p;
+                wasAged = true;
+                return true;
+            }
+            for(int p = interactive + 1; p < priorities; p++){
+                if(!takeClass(me, p, false, now, job, wasStolen)) continue;
+                prio = p;
+                return true;
+            }
+            return false;
+        }
+        void work(int me){
+            self = me;
+            while(true){
+                Job job;
+                int prio;
+                bool wasStolen, wasAged;
+                busy++; //counted before taking, so idle() never sees a job that is in neither count
+                if(take(me, job, prio, wasStolen, wasAged)){
+                    pending[prio]--;
+                    queued--;
+                    float us = chrono::duration<float, micro>(Clock::now() - job.queued).count();
+                    job.fn();
+                    lock_guard<mutex> lock(statsMtx);
+                    done[prio]++;
+                    stolen[prio] += wasStolen;
+                    aged[prio] += wasAged;
+                    if(waitUs[prio].size() < sampleCount) waitUs[prio].push_back(us);
+                    else waitUs[prio][sampleNext[prio]++ % sampleCount] = us;
+                    busy--;
+                    continue;
+                }
+                busy--;
+                unique_lock<mutex> lock(sleepMtx);
+                wake.wait(lock, [this](){return queued.load() > 0 || !running;});
+                if(!running && queued.load() == 0) return;
+            }
+        }
+    public:
+        explicit CommandDispatcher(int workerCount = 4) : workerCount(workerCount){
+            for(int i = 0; i < workerCount; i++) workers.push_back(make_unique<Worker>());
+        }
+        ~CommandDispatcher(){
+            stop();
+        }
+        void start(){
+            lock_guard<mutex> lock(startMtx);
+            if(started.load()) return;
+            {
+                lock_guard<mutex> lock(sleepMtx);
+                running = true;
+            }
+            for(int i = 0; i < workerCount; i++) workers[i]->th = thread([this, i](){work(i);});
+            started = true;
+        }
+        //queued jobs still run
+        void stop(){
+            lock_guard<mutex> lock(startMtx);
+            if(!started.load()) return;
+            {
+                lock_guard<mutex> lock(sleepMtx);
+                running = false;
+            }
+            wake.notify_all();
+            for(auto& w : workers) w->th.join();
+            started = false;
+        }
+        void submit(Priority prio, function<void()> fn){
+            if(!started.load()) start();
+            int p = (int)prio;
+            int w = self >= 0 ? self : nextWorker++ % workerCount;
+            {
+                lock_guard<mutex> lock(workers[w]->mtx);
+                workers[w]->queues[p].push_back({move(fn), Clock::now()});
+            }
+            pending[p]++;
+            queued++;
+            {
+                lock_guard<mutex> lock(statsMtx);
+                submitted[p]++;
+            }
+            {
+                lock_guard<mutex> lock(sleepMtx); //a worker between its check and its wait still gets the notify
+            }
+            wake.notify_one();
+        }
+        //submits and blocks until the job has run; not from a worker of this dispatcher
+        //the flag is shared with the job because the caller may wake and return before notify_one does
+        void run(Priority prio, function<void()> fn){
+            auto finished = make_shared<atomic<bool>>(false);
+            submit(prio, [finished, fn = move(fn)](){
+                fn();
+                finished->store(true);
+                finished->notify_one();
+            });
+            finished->wait(false);
+        }
+        size_t size() const{
+            return queued.load();
+        }
+        bool idle() const{
+            return queued.load() == 0 && busy.load() == 0;
+        }
+        DispatchStats stats(Priority prio){
+            int p = (int)prio;
+            lock_guard<mutex> lock(statsMtx);
+            DispatchStats st{submitted[p], done[p], stolen[p], aged[p], 0, 0, 0};
+            vector<float> w = waitUs[p];
+            if(!w.empty()){
+                sort(w.begin(), w.end());
+                st.p50Us = w[w.size() / 2];
+                st.p99Us = w[w.size() * 99 / 100];
+                st.maxUs = w.back();
+            }
+            return st;
+        }
+};
+
+//Fire-and-forget coroutine: created suspended, started by CoExecutor::spawn, frees itself when it returns
+struct SimTask{
+    struct promise_type{
+        SimTask get_return_object(){
+            return SimTask{coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        suspend_always initial_suspend() noexcept{return {};}
+        suspend_never final_suspend() noexcept{return {};}
+        void return_void(){}
+        void unhandled_exception(){terminate();}
+    };
+    coroutine_handle<promise_type> handle;
+};
+
+enum class SimClock {Real, Virtual};
+
+//Runs coroutines. With a Real clock they run on a few worker threads, and a coroutine that awaits
+//sleepFor gives its thread back and is put back on the ready queue by a timer wheel (its own
+//Scheduler), so waiting costs no thread. A coroutine may resume on a different worker than it
+//suspended on: never keep an EpochGuard or a thread-owned lock across a co_await.
+//With a Virtual clock nothing runs until run(), which works on the calling thread alone: it drains the
+//ready queue, then jumps the clock straight to the next wake-up. Wake-ups at the same time run in the
+//order they were scheduled, so a run with the same seeds always does the same thing.
+class CoExecutor{
+    private:
+        struct Wakeup{
+            int64_t at; //virtual ms
+            uint64_t seq;
+            coroutine_handle<> h;
+            bool operator>(const Wakeup& other) const{
+                return at != other.at ? at > other.at : seq > other.seq;
+            }
+        };
+        const SimClock clock;
+        deque<coroutine_handle<>> ready;
+        mutex readyMtx;
+        condition_variable readyCv;
+        bool running = true;
+        vector<thread> workers;
+        Scheduler timers{1}; //its one worker only moves due coroutines onto the ready queue
+        priority_queue<Wakeup, vector<Wakeup>, greater<Wakeup>> wakeups; //virtual clock only
+        int64_t virtualNow = 0;
+        uint64_t nextSeq = 0;
+        uint64_t eventsRun = 0;
+        const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+        void work(){
+            while(true){
+                coroutine_handle<> h;
+                {
+                    unique_lock<mutex> lock(readyMtx);
+                    readyCv.wait(lock, [this](){return !ready.empty() || !running;});
+                    if(!running) return;
+                    h = ready.front();
+                    ready.pop_front();
+                }
+                h.resume();
+            }
+        }
+    public:
+        explicit CoExecutor(int threads, SimClock clock = SimClock::Real) : clock(clock){
+            if(clock == SimClock::Real){
+                for(int i = 0; i < threads; i++) workers.emplace_back([this](){work();});
+            }
+        }
+        ~CoExecutor(){
+            timers.stop();
+            {
+                lock_guard<mutex> lock(readyMtx);
+                running = false;
+            }
+            readyCv.notify_all();
+            for(auto& w : workers) w.join();
+        }
+        CoExecutor(const CoExecutor&) = delete;
+        CoExecutor& operator=(const CoExecutor&) = delete;
+
+        //notifies under the lock: a post from outside (a dispatcher job) can resume the last session, and
+        //the executor must not be destroyed while that post is still in notify_one
+        void post(coroutine_handle<> h){
+            lock_guard<mutex> lock(readyMtx);
+            ready.push_back(h);
+            readyCv.notify_one();
+        }
+        void spawn(SimTask task){
+            post(task.handle);
+        }
+        bool isVirtual() const{
+            return clock == SimClock::Virtual;
+        }
+        //virtual: time of the wake-up being run, real: time since the executor was made
+        chrono::milliseconds now() const{
+            if(isVirtual()) return chrono::milliseconds(virtualNow);
+            return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+        }
+        uint64_t events() const{
+            return eventsRun;
+        }
+        //virtual clock: runs every coroutine to completion on this thread
+        void run(){
+            while(true){
+                coroutine_handle<> h;
+                {
+                    lock_guard<mutex> lock(readyMtx);
+                    if(!ready.empty()){
+                        h = ready.front();
+                        ready.pop_front();
+                    }
+                }
+                if(!h){
+                    if(wakeups.empty()) return;
+                    Wakeup next = wakeups.top();
+                    wakeups.pop();
+                    virtualNow = next.at; //jump straight there
+                    h = next.h;
+                }
+                eventsRun++;
+                h.resume();
+            }
+        }
+        struct SleepAwaiter{
+            CoExecutor& exec;
+            chrono::milliseconds delay;
+            bool await_ready() const noexcept{return delay.count() <= 0;}
+            void await_suspend(coroutine_handle<> h){
+                if(exec.isVirtual()){
+                    exec.wakeups.push({exec.virtualNow + delay.count(), exec.nextSeq++, h});
+                    return;
+                }
+                CoExecutor* e = &exec; //the awaiter lives in the frame, which may be running again before after() returns
+                exec.timers.after(delay, [e, h](){e->post(h);});
+            }
+            void await_resume() const noexcept{}
+        };
+        SleepAwaiter sleepFor(chrono::milliseconds delay){
+            return {*this, delay};
+        }
+};
+
+//Everything one simulation run shares. unit is one simulated second.
+//With a dayEnd set, each session idles for up to idleMax, runs, and starts again until dayEnd.
+struct SimContext{
+    CoExecutor& exec;
+    UserTable& users;
+    DeviceRegistry& reg;
+    chrono::milliseconds unit;
+    bool verbose;
+    chrono::milliseconds idleMax{0}, dayEnd{0};
+    atomic<long> actions{0}; //device operations done
+    atomic<long> live{0}, peak{0}; //sessions between login and logout
+    CommandDispatcher* dispatch = nullptr; //device commands go here as interactive jobs when set
+    //shared with every session: waitFor can see the last count and return, and the context go, before
+    //that session's notify_all has run
+    shared_ptr<atomic<uint32_t>> finished = make_shared<atomic<uint32_t>>(0);
+
+    SimContext(CoExecutor& exec, UserTable& users, DeviceRegistry& reg, chrono::milliseconds unit, bool verbose)
+        : exec(exec), users(users), reg(reg), unit(unit), verbose(verbose){}
+    void waitFor(uint32_t sessions){
+        if(exec.isVirtual()) exec.run();
+        uint32_t done;
+        while((done = finished->load()) < sessions) finished->wait(done);
+    }
+    //co_await command(fn): runs fn as an interactive dispatcher job and resumes the session after it,
+    //or runs it right away with no dispatcher. A virtual clock keeps it inline: run() works on one thread
+    //and would see the suspended session as finished.
+    struct CommandAwaiter{
+        SimContext& ctx;
+        function<void()> fn;
+        bool await_ready(){
+            if(ctx.dispatch && !ctx.exec.isVirtual()) return false;
+            fn();
+            return true;
+        }
+        void await_suspend(coroutine_handle<> h){
+            CoExecutor* exec = &ctx.exec; //the awaiter lives in the frame, which may be running again before submit returns
+            ctx.dispatch->submit(Priority::Interactive, [exec, h, fn = move(fn)](){
+                fn();
+                exec->post(h);
+            });
+        }
+        void await_resume() const noexcept{}
+    };
+    CommandAwaiter command(function<void()> fn){
+        return {*this, move(fn)};
+    }
+    //virtual clock time for log lines, empty in real time
+    string stamp() const{
+        if(!exec.isVirtual()) return "";
+        long long t = exec.now().count() / 1000;
+        auto two = [](long long v){return (v < 10 ? "0" : "") + to_string(v);};
+        return two(t / 3600) + ":" + two(t / 60 % 60) + ":" + two(t % 60) + " ";
+    }
+};
+
+//Seed for one session's own generator, so runs with the same seed are repeatable (splitmix64)
+uint32_t sessionSeed(uint64_t seed, uint64_t session){
+    uint64_t z = seed + (session + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (uint32_t)(z ^ (z >> 31));
+}
+
+//Global Variables
+DeviceRegistry devices;
+DeviceFleet fleet(devices); //add and remove devices through this, it keeps the status table in step
+CommandDispatcher dispatcher;
+RuleEngine automation(devices, [](function<void()> action){dispatcher.submit(Priority::Automation, move(action));});
+TelemetryStore telemetry(size_t(1) << 30); //room for about 1.7M devices
+Scheduler scheduler;
+UserTable users;
+
+TrackedMutex<recursive_mutex> printMtx("Print Mutex");
+
+//Prototypes
+void mainMenu();
+void startThreads();
+SimTask userSession(SimContext& ctx, int sessionId, uint32_t seed);
+void deviceManagement();
+void addDev();
+void removeDev();
+vector<DeviceHandle> listDev();
+void displayDev();
+void userManagement();
+void deviceControl();
+void showHistory(Device* dev);
+void statusSummary();
+void bulkCommands();
+int chooseGroup(bool withAll);
+void automationRules();
+void addRuleMenu();
+void scheduledCommands();
+void scheduleCommand();
+vector<Scheduler::Pending> listScheduled();
+void concurrencyControl();
+void livenessCheck();
+vector<UserId> listUser();
+void removeUser();
+
+string getColor(int threadId);
+void addUser();
+void makeExample();
+
+int getCh(int max);
+void showLocks();
+
+void performanceTests();
+void stressRegistry();
+void benchmarkDeviceLocking();
+void benchmarkStateReads();
+void benchmarkStatusScan();
+void benchmarkBulkCommands();
+void benchmarkWakeLatency();
+void benchmarkEventBus();
+void benchmarkRuleEngine();
+void benchmarkTimerWheel();
+void benchmarkCoroutineSim();
+void benchmarkVirtualDay();
+void benchmarkUserPool();
+void benchmarkLockValidator();
+void benchmarkTelemetry();
+void benchmarkCoalescing();
+void benchmarkPriorityDispatch();
+void benchmarkDirectories();
+
+
+//Main
+int main(){
+    SetConsoleOutputCP(CP_UTF8); //for degrees
+
+
+    telemetry.start(); //records every setpoint and brightness change
+    fleet.start();
+    // makeExample();
+    //Main Menu
+    mainMenu();
+
+    automation.stop(); //no new actions, then the queued ones run while the engine is still there
+    dispatcher.stop();
+    return 0;
+}
+
+//Functions
+void mainMenu(){
+    int ch;
+    while(true){
+        cout<<"====== Smart Home System ======"<<endl;
+        cout<<"1 - Simulate Multiple Users"<<endl;
+        cout<<"2 - Device Management"<<endl;
+        cout<<"3 - User Management"<<endl;
+        cout<<"4 - Concurrency Control"<<endl;
+        cout<<"5 - Performance Tests"<<endl;
+        cout<<"0 - Exit"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Enter Choice: ";
+        ch = getCh(5);
+        if(ch == -1){
+            continue;
+        }
+        cout<<"\n"<<endl;
+
+        switch(ch){
+            case 1: startThreads(); break;
+            case 2: deviceManagement(); break;
+            case 3: userManagement(); break;
+            case 4: showLocks(); break;
+            case 5: performanceTests(); break;
+            case 0:
+                cout<<"Exiting... \n"<<endl;
+                cout<<"Group 2"<<endl;
+                cout<<"Bea Ganotisi"<<endl;
+                cout<<"Denise Ballano"<<endl;
+                cout<<"Charisse See"<<endl; 
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+}
+
+void startThreads(){
+    if (devices.empty() || users.size() < 3){
+        cout<<"Please ensure at least 3 users and 1 or more devices are added."<<endl;
+        return;
+    }
+    cout<<"Number of simulated users: ";
+    int sessions = getCh(100000);
+    if(sessions <= 0) return;
+    cout<<"1 - Real Time"<<endl;
+    cout<<"2 - Virtual Time (no waiting, repeatable)"<<endl;
+    cout<<"Clock: ";
+    int mode = getCh(2);
+    if(mode <= 0) return;
+    cout<<"Seed (0 = random): ";
+    int seed = getCh(INT32_MAX);
+    if(seed == -1) return;
+    if(seed == 0){
+        seed = random_device{}() & INT32_MAX;
+        cout<<"Using seed "<<seed<<endl;
+    }
+
+    SimClock clock = (mode == 2 ? SimClock::Virtual : SimClock::Real);
+    if(clock == SimClock::Real) cout<<"\033[1;32mStarting "<<sessions<<" user sessions on 3 worker threads...\033[0m"<<endl;
+    else cout<<"\033[1;32mStarting "<<sessions<<" user sessions on a virtual clock...\033[0m"<<endl;
+    CoExecutor exec(3, clock);
+    SimContext ctx(exec, users, devices, chrono::seconds(1), true);
+    ctx.dispatch = &dispatcher; //queued with, and ahead of, rule actions and scheduled commands
+    for (int i = 1; i <= sessions; i++){
+        exec.spawn(userSession(ctx, i, sessionSeed(seed, i)));
+    }
+    ctx.waitFor(sessions);
+    cout<<"Simulation done!\n\n"<<endl;
+    return;
+}
+
+//One simulated user: log in as a free user, use 3 random devices, log out. Waits are co_awaited
+//delays of 1 or 2 simulated seconds, so the session holds no thread while it waits.
+SimTask userSession(SimContext& ctx, int sessionId, uint32_t seed){
+    shared_ptr<atomic<uint32_t>> finished = ctx.finished;
+    minstd_rand rng(seed); //small, a frame is kept per session
+    string color = getColor(sessionId);
+    string label = "Session " + to_string(sessionId);
+    chrono::milliseconds sec = ctx.unit * (1 + (int)(rng() % 2)); //diff delays for each session
+    auto say = [&](const string& text){
+        if(!ctx.verbose) return;
+        lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx); //makes sure no interleaved output
+        cout<<color<<"[" << ctx.stamp() << label << "]\033[0m "<<text<<endl;
+    };
+
+    bool again = true;
+    while(again){
+        if(ctx.idleMax.count() > 0){//time at home before using devices again
+            co_await ctx.exec.sleepFor(chrono::milliseconds(rng() % (ctx.idleMax.count() + 1)));
+        }
+
+        //LOG IN USER
+        UserId userId = ctx.users.acquire();
+        if(!userId.valid()){//everyone is logged in: park until a logout hands this session a user
+            say("Waiting for a free user...");
+            CoExecutor* exec = &ctx.exec;
+            userId = co_await ctx.users.acquireAsync([exec](coroutine_handle<> h){exec->post(h);});
+        }
+        string name = ctx.verbose ? ctx.users.name(userId) : "";
+        long now = ++ctx.live;
+        long peak = ctx.peak.load();
+        while(now > peak && !ctx.peak.compare_exchange_weak(peak, now)){}
+        say("User " + name + " logged in.");
+        co_await ctx.exec.sleepFor(sec);
+
+        //USE DEVICES
+        for(int i = 0; i < 3; i++){//simulate 3 actions
+            DeviceHandle handle;
+            {
+                EpochGuard guard; //never held across a co_await, the session may resume on another thread
+                handle = ctx.reg.pickRandom(rng); //get a random device
+                Device* dev = ctx.reg.get(handle);
+                if(dev == nullptr){//if no devices
+                    say("No devices available.");
+                    break;
+                }
+                say(name + " is using device " + dev->getId() + ".");
+            }
+            co_await ctx.exec.sleepFor(sec);
+            bool removed = false;
+            co_await ctx.command([&](){//Turn on device
+                EpochGuard guard;
+                Device* dev = ctx.reg.get(handle);
+                if(dev == nullptr){
+                    removed = true;
+                    return;
+                }
+                bool on = rng() % 2;
+                CommandBatch r = dev->post({CommandType::SetPower, on}); //user turns on device
+                ctx.actions++;
+                if(ctx.verbose){
+                    lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+                    cout<<color<<"[" << ctx.stamp() << label << "]\033[0m ";
+                    if(r.applied) dev->reportOn(r.before.on != r.after.on, r.after.on);
+                    else dev->reportMerged();
+                }
+            });
+            if(removed){
+                say("Device was removed.");
+                break;
+            }
+            co_await ctx.exec.sleepFor(sec);
+            co_await ctx.command([&](){//Change device settings
+                EpochGuard guard;
+                Device* dev = ctx.reg.get(handle);
+                if(dev == nullptr){
+                    removed = true;
+                    return;
+                }
+                if(dev->getKind() == DeviceKind::Fridge){
+                    int temp = (int)(rng() % 11) - 5;
+                    CommandBatch r = dev->post({CommandType::SetTemp, temp}); //Varying temps
+                    if(ctx.verbose){
+                        lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+                        cout<<color<<"[" << ctx.stamp() << label << "]\033[0m ";
+                        if(r.applied) static_cast<Fridge*>(dev)->reportTemp(r.after.temp);
+                        else dev->reportMerged();
+                    }
+                }
+                else if(dev->getKind() == DeviceKind::Light){
+                    CommandBatch r = dev->post({CommandType::SetBrightness, 1 + (int)(rng() % 3)});
+                    if(ctx.verbose){
+                        lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+                        cout<<color<<"[" << ctx.stamp() << label << "]\033[0m ";
+                        if(r.applied) static_cast<Light*>(dev)->reportBrightness();
+                        else dev->reportMerged();
+                    }
+                }
+                ctx.actions++;
+            });
+            if(removed){
+                say("Device was removed.");
+                break;
+            }
+            co_await ctx.exec.sleepFor(sec);
+            {//Print device status
+                EpochGuard guard;
+                Device* dev = ctx.reg.get(handle);
+                if(dev == nullptr){
+                    say("Device was removed.");
+                    break;
+                }
+                DeviceState state = dev->snapshot();
+                ctx.actions++;
+                if(ctx.verbose){
+                    lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+                    cout<<color<<"[" << ctx.stamp() << label << "]\033[0m ";
+                    dev->showStatus(); //show dev status
+                }
+                (void)state;
+            }
+            co_await ctx.exec.sleepFor(sec);
+        }
+
+        //LOG OUT USER
+        ctx.users.release(userId); //logs out user
+        ctx.live--;
+        if(ctx.verbose){
+            lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+            cout<<"\033[1;31m[" << ctx.stamp() << label << "] User "<<name<<" logged out.\033[0m"<<endl;
+        }
+        again = ctx.exec.now() < ctx.dayEnd;
+    }
+    finished->fetch_add(1); //ctx may be gone as soon as this lands
+    finished->notify_all();
+}
+
+//runs fn on the device under a guard that lasts only the call, false if it was removed
+template <typename F>
+bool withDevice(DeviceHandle h, F fn){
+    EpochGuard guard;
+    Device* dev = devices.get(h);
+    if(dev == nullptr) return false;
+    fn(dev);
+    return true;
+}
+
+void deviceManagement(){
+    int ch;
+    while(true){
+        cout<<"====== Device Management ======"<<endl;
+        cout<<"1 - Add Devices"<<endl;
+        cout<<"2 - Remove Devices"<<endl;
+        cout<<"3 - Manage Devices"<<endl;
+        cout<<"4 - Automation Rules"<<endl;
+        cout<<"5 - Scheduled Commands"<<endl;
+        cout<<"6 - Status Summary"<<endl;
+        cout<<"7 - Bulk Commands"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Enter Choice: ";
+        ch = getCh(7);
+        if(ch == -1){
+            continue;
+        }
+        cout<<"\n"<<endl;
+
+        switch(ch){
+            case 1: addDev(); break;
+            case 2: removeDev(); break;
+            case 3: deviceControl(); break;
+            case 4: automationRules(); break;
+            case 5: scheduledCommands(); break;
+            case 6: statusSummary(); break;
+            case 7: bulkCommands(); break;
+            case 0: return;
+        }
+    }
+}
 void addDev(){
     int type;
     string id;
@@ -446,315 +3971,2267 @@ void addDev(){
     cout<<"\t2 - Light"<<endl;
     cout<<"\t3 - Air Conditioner"<<endl;
     cout<<"Choice: ";
-    cin>>type;
+    cin>>type;
+    cout<<"==============================="<<endl;
+    Device* dev;
+    string kind;
+    switch(type){
+        case 1: dev = new Fridge(id); kind = "Fridge "; break;
+        case 2: dev = new Light(id); kind = "Light "; break;
+        case 3: dev = new AirCon(id); kind = "Air Conditioner "; break;
+        default:
+            cout<<"Error adding device."<<endl;
+            cout<<"\n"<<endl;
+            return;
+    }
+    if(fleet.add(dev).valid()) cout<<kind<<id<<" added successfully!"<<endl;
+    else cout<<"Device ID already exists!"<<endl;
+    cout<<"\n"<<endl;
+    return;
+}
+
+void removeDev(){
+    int indx;
+    while(true){
+        vector<DeviceHandle> listed = listDev();
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choose device to remove: ";
+        
+        indx = getCh(listed.size());
+        if(indx == 0){
+            cout<<"\n"<<endl;
+            return;
+        }
+        else if(indx == -1)continue;
+        else if(indx <= (int)listed.size() && indx > 0){
+            uint32_t serial = 0;
+            withDevice(listed[indx-1], [&](Device* dev){serial = dev->getSerial();});
+            if(fleet.remove(listed[indx-1])){
+                automation.forget(serial);
+                telemetry.forget(serial);
+                cout<<"Sucessfully deleted."<<endl;
+            }
+            else cout<<"Device was already removed."<<endl;
+        }
+        else{}
+        cout<<"\n"<<endl;
+        return;
+        
+    }
+}
+
+vector<DeviceHandle> listDev(){//returns the handles in the order they were numbered
+    vector<DeviceHandle> listed;
+    if(devices.empty()){//if no devices
+        cout<<"\033[1;33mNo devices available.\033[0m"<<endl;
+        return listed;
+    }
+    EpochGuard guard;
+    int i = 1;
+    for (auto& h : devices.handles()) {
+        Device* d = devices.get(h);
+        if(!d) continue;
+        cout<<i<<" - ";
+        d->showStatus();
+        listed.push_back(h);
+        i++;
+    }
+    return listed;
+}
+
+//one scan of the status table instead of a walk over every device
+void statusSummary(){
+    TableSummary sum = fleet.scan();
+    const char* names[deviceKinds] = {"Fridges", "Lights", "Air Conditioners"};
+    cout<<"======== Status Summary ======="<<endl;
+    for(int k = 0; k < deviceKinds; k++){
+        cout<<names[k]<<": "<<sum.total[k]<<" ("<<sum.on[k]<<" ON)";
+        if(k == (int)DeviceKind::Light){
+            for(int l = 1; l <= 3; l++) cout<<", "<<sum.levelCount[l]<<" "<<Light::levelName(l);
+        }
+        else if(sum.total[k] > 0) cout<<", average "<<sum.setpointSum[k] / (long)sum.total[k]<<"\u00B0C";
+        cout<<endl;
+    }
+    cout<<"==============================="<<endl;
+    cout<<"\n"<<endl;
+}
+
+//"Set every fridge in Building X to 4\u00B0C", "Turn off all lights": one kernel pass over the fleet's
+//table, then a command to each device it changed
+void bulkCommands(){
+    while(true){
+        cout<<"======== Bulk Commands ========"<<endl;
+        cout<<"1 - Set Temp"<<endl;
+        cout<<"2 - Turn On/Off"<<endl;
+        cout<<"3 - New Group"<<endl;
+        cout<<"4 - Add Device to Group"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(4);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        switch(ch){
+            case 1:{
+                int group = chooseGroup(true);
+                if(group < DeviceFleet::allDevices) break;
+                cout<<"1 - Fridges"<<endl;
+                cout<<"2 - Air Conditioners"<<endl;
+                cout<<"Choice: ";
+                int kind = getCh(2);
+                if(kind <= 0) break;
+                int temp;
+                cout<<"Set Temp to: ";
+                cin>>temp;
+                if(cin.fail()){
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    cout<<"Invalid input."<<endl;
+                    break;
+                }
+                size_t sent = fleet.setTemp(group, kind == 1 ? DeviceKind::Fridge : DeviceKind::AirCon, temp);
+                cout<<"\033[1;33mSet "<<sent<<" device(s) to "<<temp<<"\u00B0C\033[0m"<<endl;
+                break;
+            }
+            case 2:{
+                int group = chooseGroup(true);
+                if(group < DeviceFleet::allDevices) break;
+                cout<<"1 - Fridges"<<endl;
+                cout<<"2 - Lights"<<endl;
+                cout<<"3 - Air Conditioners"<<endl;
+                cout<<"4 - Every Device"<<endl;
+                cout<<"Choice: ";
+                int kind = getCh(4);
+                if(kind <= 0) break;
+                cout<<"1 - Turn On"<<endl;
+                cout<<"2 - Turn Off"<<endl;
+                cout<<"Choice: ";
+                int on = getCh(2);
+                if(on <= 0) break;
+                size_t sent = 0;
+                for(int k = 0; k < deviceKinds; k++){
+                    if(kind == 4 || kind == k + 1) sent += fleet.power(group, (DeviceKind)k, on == 1 ? PowerOp::On : PowerOp::Off);
+                }
+                cout<<"\033[1;33mTurned "<<(on == 1 ? "ON " : "OFF ")<<sent<<" device(s)\033[0m"<<endl;
+                break;
+            }
+            case 3:{
+                string name;
+                cout<<"Group name: ";
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                getline(cin, name);
+                if(name.empty()) break;
+                fleet.addGroup(name);
+                cout<<"Group "<<name<<" added."<<endl;
+                break;
+            }
+            case 4:{
+                int group = chooseGroup(false);
+                if(group < 0) break;
+                vector<DeviceHandle> listed = listDev();
+                if(listed.empty()) break;
+                cout<<"Choose device: ";
+                int indx = getCh(listed.size());
+                if(indx <= 0) break;
+                if(fleet.addToGroup(group, listed[indx - 1])) cout<<"Added to "<<fleet.groupNames()[group]<<"."<<endl;
+                else cout<<"Device was removed."<<endl;
+                break;
+            }
+            case 0:
+                cout<<"\n"<<endl;
+                return;
+        }
+        cout<<"===============================\n\n"<<endl;
+    }
+}
+
+//numbered list of the groups, "All Devices" first if allowed; the group, DeviceFleet::allDevices,
+//or less than that for none
+int chooseGroup(bool withAll){
+    vector<string> names = fleet.groupNames();
+    int first = withAll ? 2 : 1;
+    if(withAll) cout<<"1 - All Devices"<<endl;
+    else if(names.empty()){
+        cout<<"\033[1;33mNo groups yet.\033[0m"<<endl;
+        return DeviceFleet::allDevices - 1;
+    }
+    for(size_t i = 0; i < names.size(); i++) cout<<first + i<<" - "<<names[i]<<endl;
+    cout<<"0 - Back"<<endl;
+    cout<<"Choose group: ";
+    int ch = getCh(names.size() + first - 1);
+    if(ch <= 0) return DeviceFleet::allDevices - 1;
+    return withAll && ch == 1 ? DeviceFleet::allDevices : ch - first;
+}
+
+void automationRules(){
+    while(true){
+        cout<<"====== Automation Rules ======="<<endl;
+        cout<<"1 - Add Rule"<<endl;
+        cout<<"2 - List Rules"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(2);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        switch(ch){
+            case 1: addRuleMenu(); break;
+            case 2:{
+                cout<<"\n========== Rule List =========="<<endl;
+                vector<string> texts = automation.ruleTexts();
+                if(texts.empty()) cout<<"\033[1;33mNo rules yet.\033[0m"<<endl;
+                for(size_t i = 0; i < texts.size(); i++) cout<<i + 1<<" - "<<texts[i]<<endl;
+                RuleStats st = automation.stats();
+                cout<<"Fired "<<st.fired<<" times, "<<st.actions<<" actions"<<endl;
+                cout<<"===============================\n\n"<<endl;
+                break;
+            }
+            case 0:
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+}
+
+void addRuleMenu(){
+    cout<<"\n========== Add Rule ==========="<<endl;
+    cout<<"e.g. if A1 turns ON and F1 temp > 6 then set L1 to Low"<<endl;
+    cout<<"Rule: ";
+    string text;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    getline(cin, text);
+    Rule rule;
+    string error;
+    if(!parseRule(text, devices, rule, error)){
+        cout<<"\033[1;31m"<<error<<"\033[0m"<<endl;
+    }
+    else if(!automation.addRule(rule)){
+        cout<<"\033[1;31mA device in the rule was removed.\033[0m"<<endl;
+    }
+    else{
+        automation.start();
+        cout<<"Rule added."<<endl;
+    }
+    cout<<"===============================\n\n"<<endl;
+}
+
+void scheduledCommands(){
+    while(true){
+        cout<<"===== Scheduled Commands ======"<<endl;
+        cout<<"1 - Schedule Command"<<endl;
+        cout<<"2 - Pending Commands"<<endl;
+        cout<<"3 - Cancel Command"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(3);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        switch(ch){
+            case 1: scheduleCommand(); break;
+            case 2:
+                cout<<"\n====== Pending Commands ======="<<endl;
+                listScheduled();
+                cout<<"===============================\n\n"<<endl;
+                break;
+            case 3:{
+                cout<<"\n======= Cancel Command ========"<<endl;
+                vector<Scheduler::Pending> listed = listScheduled();
+                cout<<"0 - Back"<<endl;
+                cout<<"Choose command to cancel: ";
+                int indx = getCh(listed.size());
+                if(indx > 0){
+                    if(scheduler.cancel(listed[indx - 1].id)) cout<<"Command cancelled."<<endl;
+                    else cout<<"Command already ran."<<endl;
+                }
+                cout<<"===============================\n\n"<<endl;
+                break;
+            }
+            case 0:
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+}
+
+vector<Scheduler::Pending> listScheduled(){
+    vector<Scheduler::Pending> listed = scheduler.pending();
+    if(listed.empty()) cout<<"\033[1;33mNothing scheduled.\033[0m"<<endl;
+    for(size_t i = 0; i < listed.size(); i++){
+        cout<<i + 1<<" - "<<listed[i].text<<", in "<<listed[i].dueInMs / 1000.0<<" s";
+        if(listed[i].periodMs) cout<<", every "<<listed[i].periodMs / 1000.0<<" s";
+        cout<<endl;
+    }
+    return listed;
+}
+
+void scheduleCommand(){
+    cout<<"\n====== Schedule Command ======="<<endl;
+    vector<DeviceHandle> listed = listDev();
+    if(listed.empty()) return;
+    cout<<"Choose device: ";
+    int indx = getCh(listed.size());
+    if(indx <= 0) return;
+    DeviceHandle handle = listed[indx - 1];
+    string id;
+    DeviceKind kind;
+    {
+        EpochGuard guard;
+        Device* dev = devices.get(handle);
+        if(!dev){
+            cout<<"Device was removed."<<endl;
+            return;
+        }
+        id = dev->getId();
+        kind = dev->getKind();
+    }
+    cout<<"1 - Turn On"<<endl;
+    cout<<"2 - Turn Off"<<endl;
+    cout<<(kind == DeviceKind::Light ? "3 - Set Brightness" : "3 - Set Temp")<<endl;
+    cout<<"4 - Report Status"<<endl;
+    cout<<"Choice: ";
+    int action = getCh(4);
+    if(action <= 0) return;
+    int value = 0;
+    long long delay, period;
+    if(action == 3){
+        cout<<(kind == DeviceKind::Light ? "(1 - Low, 2 - Mid, 3 - High) Set Brightness to: " : "Set Temp to: ");
+        cin>>value;
+    }
+    cout<<"Run in how many seconds: ";
+    cin>>delay;
+    cout<<"Repeat every how many seconds (0 - once): ";
+    cin>>period;
+    if(cin.fail() || delay < 0 || period < 0){
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout<<"Invalid input."<<endl;
+        return;
+    }
+
+    string text;
+    switch(action){
+        case 1: text = "Turn on " + id; break;
+        case 2: text = "Turn off " + id; break;
+        case 3: text = "Set " + id + (kind == DeviceKind::Light ? " brightness to " : " temp to ") + to_string(value); break;
+        case 4: text = "Report " + id + " status"; break;
+    }
+    auto command = [handle, action, value](){
+        EpochGuard guard;
+        Device* dev = devices.get(handle);
+        if(!dev){
+            lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx);
+            cout<<"\033[1;32m[Scheduler]\033[0m Device was removed."<<endl;
+            return;
+        }
+        CommandBatch r;
+        if(action == 1 || action == 2) r = dev->post({CommandType::SetPower, action == 1});
+        else if(action == 3) r = dev->post({dev->getKind() == DeviceKind::Light ? CommandType::SetBrightness : CommandType::SetTemp, value});
+        lock_guard<TrackedMutex<recursive_mutex>> lock(printMtx); //makes sure no interleaved output
+        cout<<"\033[1;32m[Scheduler]\033[0m ";
+        if(action == 4) dev->showStatus();
+        else if(!r.applied) dev->reportMerged();
+        else if(action == 1 || action == 2) dev->reportOn(r.before.on != r.after.on, r.after.on);
+        else if(dev->getKind() == DeviceKind::Light) static_cast<Light*>(dev)->reportBrightness();
+        else cout<<"Turned "<<dev->getId()<<" temperature to "<<r.after.temp<<"\u00B0C."<<endl;
+    };
+    //the timer thread only hands the command on; status reports go in the lowest class
+    Priority prio = action == 4 ? Priority::Telemetry : Priority::Automation;
+    auto dispatch = [prio, command](){dispatcher.submit(prio, command);};
+    if(period > 0) scheduler.every(chrono::seconds(delay), chrono::seconds(period), dispatch, text);
+    else scheduler.after(chrono::seconds(delay), dispatch, text);
+    cout<<"Scheduled: "<<text<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+void userManagement(){
+    while(true){
+        cout<<"======= User Management ======="<<endl;
+        cout<<"1 - Register Users"<<endl;
+        cout<<"2 - User List"<<endl;
+        cout<<"3 - Remove Users"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(3);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        switch(ch){
+            case 1: addUser(); break;
+            case 2: 
+                cout<<"\n========= User List ==========="<<endl;
+                listUser();
+                cout<<"===============================\n\n"<<endl; 
+                break;
+            case 3: removeUser(); break;
+            case 0: 
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+
+}
+
+void deviceControl(){
+    DeviceHandle chosen;
+    vector<DeviceHandle> listed;
+    while(true){
+        cout<<"======= Control Device ========"<<endl;
+        listed = listDev();
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choose device to manage (number or ID): ";
+        string choice;
+        cin>>choice;
+        int indx = -2;
+        if(!choice.empty() && all_of(choice.begin(), choice.end(), ::isdigit) && choice.size() < 9) indx = stoi(choice) - 1;
+        if(indx == -1){
+            cout<<"\n"<<endl; 
+            return;
+        }
+        else if(indx >= 0 && indx < (int)listed.size()){
+            chosen = listed[indx];
+            cout<<"\n";
+            break;
+        }
+        else if((chosen = devices.find(choice)).valid()){
+            cout<<"\n";
+            break;
+        }
+        else{
+            cout<<"Enter a valid number or device ID."<<endl;
+            cout<<"\n";
+            continue;
+        }
+    }
+    //the device is looked up again under a short guard for each step: a guard held while the user sits
+    //at a prompt would keep every device retired meanwhile from being freed
+    DeviceKind kind;
+    cout<<"======= Control Device ========"<<endl;
+    if(!withDevice(chosen, [&](Device* dev){kind = dev->getKind(); dev->showStatus();})){
+        cout<<"Device was removed."<<endl;
+        return;
+    }
+    bool light = kind == DeviceKind::Light;
+    cout<<"1 - Turn On/Off"<<endl;
+    cout<<(light ? "2 - Set Brightness" : "2 - Set Temp")<<endl;
+    cout<<"3 - History"<<endl;
+    cout<<"0 - Back"<<endl;
+    cout<<"==============================="<<endl;
+    cout<<"Choice: ";
+    int ch = getCh(3);
+    cout<<"\n";
     cout<<"==============================="<<endl;
-    switch(type){
+    bool there = true;
+    switch(ch){
         case 1:
-            devices.push_back(new Fridge(id)); 
-            cout<<"Fridge "<<id<<" added successfully!"<<endl;
+            dispatcher.run(Priority::Interactive, [chosen](){withDevice(chosen, [](Device* dev){dev->toggleOn();});});
+            there = withDevice(chosen, [](Device* dev){dev->showStatus();});
             break;
-        case 2: 
-            devices.push_back(new Light(id)); 
-            cout<<"Light "<<id<<" added successfully!"<<endl;
+        case 2:{
+            int value;
+            if(light){
+                cout<<"(1 - Low, 2 - Mid, 3 - High)"<<endl;
+                cout<<"Set Brightness to : ";
+            }
+            else cout<<"Set Temp to: ";
+            cin>>value;
+            if(light) cout<<"\n";
+            dispatcher.run(Priority::Interactive, [chosen, value, &there](){
+                there = withDevice(chosen, [value](Device* dev){
+                    switch(dev->getKind()){
+                        case DeviceKind::Fridge: static_cast<Fridge*>(dev)->putTemp(value); break;
+                        case DeviceKind::Light: static_cast<Light*>(dev)->putBrightness(value); break;
+                        case DeviceKind::AirCon: static_cast<AirCon*>(dev)->putTemp(value); break;
+                    }
+                });
+            });
             break;
-        case 3:
-            devices.push_back(new AirCon(id)); 
-            cout<<"Air Conditioner "<<id<<" added successfully!"<<endl;
+        }
+        case 3: there = withDevice(chosen, showHistory); break;
+        case 0:
             break;
-        default:
-            cout<<"Error adding device."<<endl;
     }
-    cout<<"\n"<<endl;
-    return;
+    if(!there) cout<<"Device was removed."<<endl;
+    cout<<"==============================="<<endl;
+    cout<<"\n"<<endl;
+}
+
+template <typename M>
+void showLock(const TrackedMutex<M>& mtx){
+    cout<<mtx.getName()<<": "<<(mtx.checkLock() ? "Locked by "+ mtx.getOwner() : "Unlocked")<<endl;
+}
+
+//last 10 changes, then the last hour a minute at a time; older changes only come back per half hour
+void showHistory(Device* dev){
+    uint64_t now = telemetry.nowMs() + 1;
+    uint64_t hourAgo = now > 3600000 ? now - 3600000 : 0;
+    auto text = [dev](int v){
+        return dev->getKind() == DeviceKind::Light ? Light::levelName(v) : to_string(v) + "\u00B0C";
+    };
+    vector<TelemetryPoint> points = telemetry.range(dev->getSerial(), 0, now);
+    cout<<"History of "<<dev->getId()<<":"<<endl;
+    if(points.empty()){
+        cout<<"\033[1;33mNo changes recorded yet.\033[0m"<<endl;
+        return;
+    }
+    cout<<"Kept: the last "<<points.size()<<" changes, back to "<<(now - points.front().timeMs) / 1000
+        <<" s ago (a device keeps at least its last "<<TelemetryStore::minKept()<<")"<<endl;
+    for(size_t i = points.size() > 10 ? points.size() - 10 : 0; i < points.size(); i++){
+        cout<<"  "<<(now - points[i].timeMs) / 1000<<" s ago: "<<text(points[i].value)<<endl;
+    }
+    bool cut = telemetry.folded(dev->getSerial()) && points.front().timeMs > hourAgo;
+    cout<<"Last hour by minute"<<(cut ? " (before the kept changes, a half hour at a time):" : ":")<<endl;
+    for(auto& b : telemetry.downsample(dev->getSerial(), hourAgo, now, 60000)){
+        cout<<"  "<<(now - b.startMs) / 60000<<" min ago: "<<b.samples<<" changes, "<<text(b.minValue)<<" to "<<text(b.maxValue)<<endl;
+    }
+}
+
+void showLocks(){
+    while(true){
+        cout<<"========= Lock Status ========="<<endl;
+        showLock(users.writeLock());
+        showLock(devices.writeLock());
+        showLock(printMtx);
+        cout<<"Lock order validator: "<<(lockdep.on() ? "ON" : "OFF")<<", "<<lockdep.orderingCount()<<" orderings seen"<<endl;
+        cout<<"1 - Turn Validator On/Off"<<endl;
+        cout<<"2 - Lock Order Report"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(2);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        cout<<"\n";
+        switch(ch){
+            case 1: lockdep.enable(!lockdep.on()); break;
+            case 2:{
+                cout<<"====== Lock Order Report ======"<<endl;
+                vector<string> cycles = lockdep.reports();
+                if(cycles.empty()) cout<<"\033[1;32mNo lock order cycles seen.\033[0m"<<endl;
+                for(auto& c : cycles) cout<<"\033[1;31mPossible deadlock: \033[0m"<<c<<endl;
+                cout<<"===============================\n\n"<<endl;
+                break;
+            }
+            case 0:
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+}
+
+void addUser(){
+    string user;
+    cout<<"\n======== Register User ========"<<endl;
+    cout<<"Enter username: ";
+    cin>>user;
+
+    //add to user table, fails if the name is taken
+    if(!users.add(user).valid()){
+        cout<<"Username already exists!"<<endl;
+        return;
+    }
+    cout<<"User "<<user<<" registered successfully!"<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+vector<UserId> listUser(){
+    vector<UserId> ids;
+    int i = 1;
+    for (auto& u : users.list()){
+        cout<<i<<" - "<<u.second<<(users.isLoggedIn(u.first) ? " (logged in)" : "")<<endl;
+        ids.push_back(u.first);
+        i++;
+    }
+    return ids;
+}
+
+void removeUser(){
+    int indx;
+    while(true){
+        cout<<"\n======== Remove User =========="<<endl;
+        vector<UserId> ids = listUser();
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choose user to remove: ";
+        cin>>indx;
+        
+        if(indx == 0){
+            cout<<"\n"<<endl; 
+            return;
+        }else if(indx <= (int)ids.size() && indx > 0){
+            if(users.remove(ids[indx-1])) cout<<"Sucessfully deleted."<<endl; //a logged in user is logged out when their session ends
+            else cout<<"User was already removed."<<endl;
+            break;
+        }
+        else{
+            cout<<"Enter a valid number.\n"<<endl;
+            continue;
+        }
+    }
+    cout<<"\n"<<endl;
+}
+
+void makeExample(){
+    //devices sample
+    Fridge* f1 = new Fridge("F1");
+    f1->setTemp(5);
+    fleet.add(f1);
+
+    Light* l1 = new Light("L1");
+    l1->setBrightness(3);
+    fleet.add(l1);
+
+    //users sample
+    users.add("Bea");
+    users.add("Denise");
+    users.add("Charisse");
+
+    cout<<"Examples added."<<endl;
+}
+
+string getColor(int num){
+    switch(num){
+        case 1: return "\033[1;34m"; // Blue
+        case 2: return "\033[1;35m"; // Magenta
+        case 3: return "\033[1;36m"; // Cyan
+        default: return "\033[1;37m"; // White (default)
+    }
+}
+
+int getCh(int max){
+    int ch;
+    cin>>ch;
+    if(cin.fail() || (ch > max || ch < 0)){
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout<<"Invalid input. Please choose between the numbers listed."<<endl;
+        return -1;
+    }
+    return ch;
+}
+
+void performanceTests(){
+    bool recording = telemetry.running(), tracking = fleet.running();
+    telemetry.stop(); //so the tests measure the device paths alone
+    fleet.stop();
+    while(true){
+        cout<<"====== Performance Tests ======"<<endl;
+        cout<<"1 - Device Registry Churn (64 threads)"<<endl;
+        cout<<"2 - Global vs Per-Device Locking"<<endl;
+        cout<<"3 - Packed State vs shared_mutex Reads"<<endl;
+        cout<<"4 - Status Scan (1M devices, fleet table vs objects)"<<endl;
+        cout<<"5 - Bulk Group Commands (1M devices)"<<endl;
+        cout<<"6 - State-Change Wake-up Latency (2000 waiters)"<<endl;
+        cout<<"7 - Event Bus Throughput"<<endl;
+        cout<<"8 - Rule Engine (100k rules, 100k devices)"<<endl;
+        cout<<"9 - Timer Wheel (2M timers)"<<endl;
+        cout<<"10 - Coroutine Simulation (100k users)"<<endl;
+        cout<<"11 - Virtual-Time Day (100k devices)"<<endl;
+        cout<<"12 - User Login Pool (10k users, 64 threads)"<<endl;
+        cout<<"13 - Lock Order Validator"<<endl;
+        cout<<"14 - Telemetry Store (1M devices, 48 changes each)"<<endl;
+        cout<<"15 - Command Coalescing (4 hot devices, 64 threads)"<<endl;
+        cout<<"16 - Priority Dispatch (interactive under a flood)"<<endl;
+        cout<<"17 - Hash Directories (1M devices, 1M users)"<<endl;
+        cout<<"0 - Back"<<endl;
+        cout<<"==============================="<<endl;
+        cout<<"Choice: ";
+        int ch = getCh(17);
+        if(ch == -1){
+            cout<<"\n"<<endl;
+            continue;
+        }
+        cout<<"\n";
+        switch(ch){
+            case 1: stressRegistry(); break;
+            case 2: benchmarkDeviceLocking(); break;
+            case 3: benchmarkStateReads(); break;
+            case 4: benchmarkStatusScan(); break;
+            case 5: benchmarkBulkCommands(); break;
+            case 6: benchmarkWakeLatency(); break;
+            case 7: benchmarkEventBus(); break;
+            case 8: benchmarkRuleEngine(); break;
+            case 9: benchmarkTimerWheel(); break;
+            case 10: benchmarkCoroutineSim(); break;
+            case 11: benchmarkVirtualDay(); break;
+            case 12: benchmarkUserPool(); break;
+            case 13: benchmarkLockValidator(); break;
+            case 14: benchmarkTelemetry(); break;
+            case 15: benchmarkCoalescing(); break;
+            case 16: benchmarkPriorityDispatch(); break;
+            case 17: benchmarkDirectories(); break;
+            case 0:
+                if(recording) telemetry.start();
+                if(tracking) fleet.start();
+                cout<<"\n"<<endl;
+                return;
+        }
+    }
+}
+
+//64 threads keep using random devices while another thread adds and removes devices as fast as it can.
+//Any device seen with a cleared canary would mean it was freed while still reachable.
+void stressRegistry(){
+    const int workers = 64;
+    const int startDevices = 1000;
+    const auto runFor = chrono::seconds(2);
+
+    long before = liveDevices;
+    long freedBefore = epochs.getFreed();
+    atomic<bool> running{true};
+    atomic<long> ops{0}, misses{0}, violations{0}, adds{0}, removes{0};
+    {
+        DeviceRegistry reg;
+        for(int i = 0; i < startDevices; i++){
+            reg.add(new Fridge("F" + to_string(i)));
+        }
+
+        vector<thread> threads;
+        for(int t = 0; t < workers; t++){
+            threads.emplace_back([&, t](){
+                mt19937 rng(t);
+                long done = 0;
+                while(running){
+                    EpochGuard guard;
+                    Device* dev = reg.get(reg.pickRandom(rng));
+                    if(dev == nullptr){
+                        misses++;
+                        continue;
+                    }
+                    if(!dev->isAlive()) violations++;
+                    if(dev->getKind() == DeviceKind::Fridge){
+                        Fridge* fridge = static_cast<Fridge*>(dev);
+                        fridge->setTemp(fridge->getTemp() % 10 + 1);
+                    }
+                    if(dev->getId().empty()) violations++;
+                    done++;
+                }
+                ops += done;
+            });
+        }
+        threads.emplace_back([&](){//churn: replace a random device with a new one
+            mt19937 rng(999);
+            int next = startDevices;
+            while(running){
+                DeviceHandle victim = reg.pickRandom(rng);
+                if(reg.remove(victim)) removes++;
+                if(reg.add(new Light("L" + to_string(next++))).valid()) adds++;
+            }
+        });
+
+        this_thread::sleep_for(runFor);
+        running = false;
+        for(auto& t : threads) t.join();
+        epochs.reclaim();
+
+        cout<<"Operations on devices: "<<ops<<" ("<<ops / runFor.count()<<" per second)"<<endl;
+        cout<<"Handles gone before use: "<<misses<<endl;
+        cout<<"Devices added/removed during the run: "<<adds<<"/"<<removes<<endl;
+        cout<<"Freed by epoch reclamation: "<<epochs.getFreed() - freedBefore<<" (still pending: "<<epochs.getPending()<<")"<<endl;
+        cout<<"Use-after-free detected: "<<violations<<(violations == 0 ? " (PASS)" : " (FAIL)")<<endl;
+    }
+    epochs.reclaim();
+    long leaked = liveDevices - before - (long)epochs.getPending();
+    cout<<"Leaked devices: "<<leaked<<(leaked == 0 ? " (PASS)" : " (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//10k devices, 32 threads doing the userSession mix (power, setpoint, status read) without printing.
+//First every operation also takes one global mutex like the old devMtx path, then only the device's lock.
+void benchmarkDeviceLocking(){
+    const int deviceCount = 10000;
+    const int threadCount = 32;
+    const auto runFor = chrono::seconds(1);
+
+    DeviceRegistry reg;
+    for(int i = 0; i < deviceCount; i++){
+        switch(i % 3){
+            case 0: reg.add(new Fridge("F" + to_string(i))); break;
+            case 1: reg.add(new Light("L" + to_string(i))); break;
+            case 2: reg.add(new AirCon("A" + to_string(i))); break;
+        }
+    }
+
+    mutex globalMtx;
+    double rate[2];
+    for(int mode = 0; mode < 2; mode++){
+        bool useGlobal = (mode == 0);
+        atomic<bool> running{true};
+        atomic<long> ops{0};
+        vector<thread> threads;
+        for(int t = 0; t < threadCount; t++){
+            threads.emplace_back([&, t](){
+                mt19937 rng(t);
+                long done = 0;
+                while(running){
+                    EpochGuard guard;
+                    Device* dev = reg.get(reg.pickRandom(rng));
+                    int action = rng() % 3;
+                    unique_lock<mutex> global(globalMtx, defer_lock);
+                    if(useGlobal) global.lock();
+                    if(action == 0) dev->setOn(rng() & 1);
+                    else switch(dev->getKind()){
+                        case DeviceKind::Fridge:
+                            if(action == 1) static_cast<Fridge*>(dev)->setTemp((int)(rng() % 11) - 5);
+                            else static_cast<Fridge*>(dev)->getTemp();
+                            break;
+                        case DeviceKind::AirCon:
+                            if(action == 1) static_cast<AirCon*>(dev)->setTemp(16 + (int)(rng() % 10));
+                            else static_cast<AirCon*>(dev)->getTemp();
+                            break;
+                        case DeviceKind::Light:
+                            if(action == 1) static_cast<Light*>(dev)->setBrightness(1 + rng() % 3);
+                            else static_cast<Light*>(dev)->getBrightness();
+                            break;
+                    }
+                    done++;
+                }
+                ops += done;
+            });
+        }
+        this_thread::sleep_for(runFor);
+        running = false;
+        for(auto& t : threads) t.join();
+        rate[mode] = (double)ops / runFor.count();
+    }
+
+    cout<<deviceCount<<" devices, "<<threadCount<<" threads"<<endl;
+    cout<<"Global device mutex: "<<rate[0]<<" ops/s"<<endl;
+    cout<<"Per-device locks only: "<<rate[1]<<" ops/s"<<endl;
+    cout<<"Speedup: "<<rate[1] / rate[0]<<"x"<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//Status reads against one writer, through the packed state word and through the shared_mutex
+//layout devices used before (separate fields, shared_lock per read).
+void benchmarkStateReads(){
+    const int readerCount = 8;
+    const auto runFor = chrono::seconds(1);
+
+    struct LockedState{
+        shared_mutex rwLock;
+        bool isOn = false;
+        int temperature = 5;
+    } locked;
+    Fridge fridge("BenchFridge");
+
+    double readRate[2], writeRate[2];
+    for(int mode = 0; mode < 2; mode++){
+        bool packed = (mode == 1);
+        atomic<bool> running{true};
+        atomic<long> reads{0};
+        atomic<long> torn{0}; //reads that saw a temperature the writer never paired with that power state
+        long writes = 0;
+        if(packed) fridge.setOnAndTemp(true, 5);
+        else locked.isOn = true;
+        vector<thread> threads;
+        for(int t = 0; t < readerCount; t++){
+            threads.emplace_back([&](){
+                long done = 0, bad = 0;
+                while(running){
+                    bool on; int temp;
+                    if(packed){
+                        DeviceState s = fridge.snapshot();
+                        on = s.on; temp = s.temp;
+                    }
+                    else{
+                        shared_lock lock(locked.rwLock);
+                        on = locked.isOn; temp = locked.temperature;
+                    }
+                    if(on != (temp % 2 != 0)) bad++;
+                    done++;
+                }
+                reads += done;
+                torn += bad;
+            });
+        }
+        threads.emplace_back([&](){//writer keeps "on" equal to "temperature is odd"
+            int temp = 5;
+            while(running){
+                temp = temp % 9 + 1;
+                bool on = temp % 2 != 0;
+                if(packed){
+                    fridge.setOnAndTemp(on, temp);
+                }
+                else{
+                    unique_lock lock(locked.rwLock);
+                    locked.isOn = on;
+                    locked.temperature = temp;
+                }
+                writes++;
+            }
+        });
+        this_thread::sleep_for(runFor);
+        running = false;
+        for(auto& t : threads) t.join();
+        readRate[mode] = (double)reads / runFor.count();
+        writeRate[mode] = (double)writes / runFor.count();
+        cout<<(packed ? "Packed atomic state:  " : "shared_mutex fields:  ")<<readRate[mode]<<" reads/s, "
+            <<writeRate[mode]<<" writes/s, inconsistent reads: "<<torn<<endl;
+    }
+    cout<<"Read speedup: "<<readRate[1] / readRate[0]<<"x"<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//1M devices with random states added through a DeviceFleet, then a full status scan (power count,
+//setpoint sums, brightness histogram) over the fleet's table and over the registry objects. Afterwards
+//threads change devices the way the menus do, some devices are removed, and the table, kept up by the
+//event bus, must still match.
+void benchmarkStatusScan(){
+    const int deviceCount = 1000000;
+    const int passes = 10;
+    const int writers = 4, writesEach = 50000;
+
+    DeviceRegistry reg;
+    DeviceFleet fleet(reg);
+    for(int k = 0; k < deviceKinds; k++) fleet.reserve((DeviceKind)k, deviceCount / deviceKinds + 1);
+    mt19937 rng(7);
+    for(int i = 0; i < deviceCount; i++){
+        DeviceKind kind = (DeviceKind)(i % deviceKinds);
+        bool on = rng() & 1;
+        string id = to_string(i);
+        switch(kind){
+            case DeviceKind::Fridge:{
+                Fridge* f = new Fridge(id);
+                f->setOnAndTemp(on, (int)(rng() % 11) - 5);
+                fleet.add(f);
+                break;
+            }
+            case DeviceKind::Light:{
+                Light* l = new Light(id);
+                l->setOn(on);
+                l->setBrightness(1 + rng() % 3);
+                fleet.add(l);
+                break;
+            }
+            case DeviceKind::AirCon:{
+                AirCon* a = new AirCon(id);
+                a->setOn(on);
+                a->setTemp(16 + (int)(rng() % 10));
+                fleet.add(a);
+                break;
+            }
+        }
+    }
+    fleet.start();
+    vector<DeviceHandle> handles = reg.handles();
+
+    auto fromObjects = [&](){
+        EpochGuard guard;
+        TableSummary sum;
+        for(auto& h : handles){
+            Device* dev = reg.get(h);
+            if(!dev) continue;
+            int k = (int)dev->getKind();
+            DeviceState s = dev->snapshot();
+            sum.total[k]++;
+            sum.on[k] += s.on;
+            if(dev->getKind() == DeviceKind::Light) sum.levelCount[s.level]++;
+            else sum.setpointSum[k] += s.temp;
+        }
+        return sum;
+    };
+    auto same = [](const TableSummary& a, const TableSummary& b){
+        bool eq = true;
+        for(int k = 0; k < deviceKinds; k++){
+            eq = eq && a.total[k] == b.total[k] && a.on[k] == b.on[k] && a.setpointSum[k] == b.setpointSum[k];
+        }
+        for(int l = 0; l < 4; l++) eq = eq && a.levelCount[l] == b.levelCount[l];
+        return eq;
+    };
+
+    TableSummary tableSum, objectSum;
+    auto start = chrono::steady_clock::now();
+    for(int p = 0; p < passes; p++) tableSum = fleet.scan();
+    double tableMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / passes;
+
+    start = chrono::steady_clock::now();
+    for(int p = 0; p < passes; p++) objectSum = fromObjects();
+    double objectMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / passes;
+    bool matched = same(tableSum, objectSum);
+
+    vector<thread> threads;
+    for(int t = 0; t < writers; t++){
+        threads.emplace_back([&, t](){
+            mt19937 r(100 + t);
+            EpochGuard guard;
+            for(int i = 0; i < writesEach; i++){
+                Device* dev = reg.get(handles[r() % handles.size()]);
+                if(!dev) continue;
+                switch(r() % 3){
+                    case 0: dev->post({CommandType::Toggle}); break;
+                    case 1: dev->post({CommandType::SetTemp, (int)(r() % 30) - 5}); break; //lights refuse it
+                    default: dev->post({CommandType::SetBrightness, 1 + (int)(r() % 3)}); break; //only lights take it
+                }
+            }
+        });
+    }
+    for(auto& th : threads) th.join();
+    for(size_t i = 0; i < handles.size(); i += 1000) fleet.remove(handles[i]);
+    bool followed = same(fleet.scan(), fromObjects());
+
+    cout<<deviceCount<<" devices, average of "<<passes<<" scans"<<endl;
+    cout<<"Fleet table:      "<<tableMs<<" ms/scan ("<<deviceCount / tableMs * 1000<<" devices/s)"<<endl;
+    cout<<"Registry objects: "<<objectMs<<" ms/scan ("<<deviceCount / objectMs * 1000<<" devices/s)"<<endl;
+    cout<<"Speedup: "<<objectMs / tableMs<<"x"<<endl;
+    cout<<"Results match, and still after "<<writers * writesEach<<" device writes and "<<deviceCount / 1000<<" removals: "<<(matched && followed ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//Five building-management commands over 1M devices, first device by device on registry objects,
+//then as bulk commands on the column table with each kernel set this CPU supports, and last through a
+//DeviceFleet, whose kernels work on its table and whose posts must leave the real devices as the first run did.
+//Every command runs an even number of times so the toggle leaves the same end state everywhere.
+void benchmarkBulkCommands(){
+    const int deviceCount = 1000000;
+    const int objectReps = 2, tableReps = 20;
+    const char* commands[] = {"Building X fridges to 4\u00B0C", "Clamp air conditioners to 18-24", "All lights off",
+                              "Toggle Building X fridges", "Count devices on"};
+
+    auto timeMs = [](int reps, auto fn){
+        auto start = chrono::steady_clock::now();
+        for(int i = 0; i < reps; i++) fn();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / reps;
+    };
+    //same devices, states and Building X membership for every run
+    auto build = [&](DeviceTable* table, int* group, DeviceRegistry* reg, vector<Device*>* buildingX, DeviceFleet* fleet = nullptr){
+        mt19937 rng(11);
+        if(table){
+            for(int k = 0; k < deviceKinds; k++) table->reserve((DeviceKind)k, deviceCount / deviceKinds + 1);
+            *group = table->addGroup("Building X");
+        }
+        if(fleet){
+            for(int k = 0; k < deviceKinds; k++) fleet->reserve((DeviceKind)k, deviceCount / deviceKinds + 1);
+            *group = fleet->addGroup("Building X");
+        }
+        for(int i = 0; i < deviceCount; i++){
+            DeviceKind kind = (DeviceKind)(i % deviceKinds);
+            bool on = rng() & 1;
+            int value = kind == DeviceKind::Light ? 1 + rng() % 3 : (kind == DeviceKind::Fridge ? (int)(rng() % 11) - 5 : 14 + (int)(rng() % 14));
+            bool inX = kind == DeviceKind::Fridge && (rng() & 1);
+            if(table){
+                TableHandle row = table->add(kind, to_string(i));
+                table->setOn(row, on);
+                if(kind == DeviceKind::Light) table->setBrightness(row, value);
+                else table->setTemp(row, value);
+                if(inX) table->addToGroup(*group, row);
+            }
+            else{
+                Device* dev;
+                switch(kind){
+                    case DeviceKind::Fridge: dev = new Fridge(to_string(i)); static_cast<Fridge*>(dev)->setTemp(value); break;
+                    case DeviceKind::Light: dev = new Light(to_string(i)); static_cast<Light*>(dev)->setBrightness(value); break;
+                    default: dev = new AirCon(to_string(i)); static_cast<AirCon*>(dev)->setTemp(value); break;
+                }
+                dev->setOn(on);
+                if(fleet){
+                    DeviceHandle h = fleet->add(dev);
+                    if(inX) fleet->addToGroup(*group, h);
+                }
+                else{
+                    reg->add(dev);
+                    if(inX) buildingX->push_back(dev);
+                }
+            }
+        }
+    };
+
+    vector<string> columns;
+    vector<vector<double>> ms; //[column][command]
+    TableSummary expected;
+    size_t expectedOn = 0;
+    {//device by device, what the menus do today minus the printing
+        DeviceRegistry reg;
+        vector<Device*> buildingX;
+        build(nullptr, nullptr, &reg, &buildingX);
+        vector<DeviceHandle> handles = reg.handles();
+        EpochGuard guard;
+        vector<Device*> all;
+        for(auto& h : handles) all.push_back(reg.get(h));
+        size_t onCount = 0;
+        columns.push_back("Per device");
+        ms.push_back({
+            timeMs(objectReps, [&](){ for(Device* d : buildingX) static_cast<Fridge*>(d)->setTemp(4); }),
+            timeMs(objectReps, [&](){
+                for(Device* d : all){
+                    if(d->getKind() != DeviceKind::AirCon) continue;
+                    AirCon* a = static_cast<AirCon*>(d);
+                    a->setTemp(clamp(a->getTemp(), 18, 24));
+                }
+            }),
+            timeMs(objectReps, [&](){ for(Device* d : all) if(d->getKind() == DeviceKind::Light) d->setOn(false); }),
+            timeMs(objectReps, [&](){ for(Device* d : buildingX) d->toggleOn(); }),
+            timeMs(objectReps, [&](){
+                onCount = 0;
+                for(Device* d : all) onCount += d->snapshot().on;
+            })
+        });
+        expectedOn = onCount;
+        for(Device* d : all){
+            int k = (int)d->getKind();
+            DeviceState s = d->snapshot();
+            expected.total[k]++;
+            expected.on[k] += s.on;
+            if(d->getKind() == DeviceKind::Light) expected.levelCount[s.level]++;
+            else expected.setpointSum[k] += s.temp;
+        }
+    }
+
+    bool allMatch = true;
+    for(const BulkKernels* k : supportedKernels()){
+        DeviceTable table;
+        int buildingX;
+        build(&table, &buildingX, nullptr, nullptr);
+        table.useKernels(k);
+        size_t onCount = 0;
+        columns.push_back(k->name);
+        ms.push_back({
+            timeMs(tableReps, [&](){ table.bulkSetTemp(buildingX, DeviceKind::Fridge, 4); }),
+            timeMs(tableReps, [&](){ table.bulkClampTemp(DeviceTable::allDevices, DeviceKind::AirCon, 18, 24); }),
+            timeMs(tableReps, [&](){ table.bulkPower(DeviceTable::allDevices, DeviceKind::Light, PowerOp::Off); }),
+            timeMs(tableReps, [&](){ table.bulkPower(buildingX, DeviceKind::Fridge, PowerOp::Toggle); }),
+            timeMs(tableReps, [&](){
+                onCount = 0;
+                for(int kind = 0; kind < deviceKinds; kind++) onCount += table.countOn(DeviceTable::allDevices, (DeviceKind)kind);
+            })
+        });
+        TableSummary got = table.scan();
+        bool same = onCount == expectedOn;
+        for(int kind = 0; kind < deviceKinds; kind++){
+            same = same && got.total[kind] == expected.total[kind] && got.on[kind] == expected.on[kind]
+                && got.setpointSum[kind] == expected.setpointSum[kind];
+        }
+        for(int l = 0; l < 4; l++) same = same && got.levelCount[l] == expected.levelCount[l];
+        if(!same) cout<<"\033[1;31m"<<k->name<<" results differ from the per-device run\033[0m"<<endl;
+        allMatch = allMatch && same;
+    }
+
+    bool devicesMatch;
+    {//the real path: kernels over the fleet's table, then a post to each device they changed
+        DeviceRegistry reg;
+        DeviceFleet fleet(reg);
+        int buildingX;
+        build(nullptr, &buildingX, &reg, nullptr, &fleet);
+        fleet.start();
+        size_t onCount = 0;
+        columns.push_back("Fleet");
+        ms.push_back({
+            timeMs(objectReps, [&](){ fleet.setTemp(buildingX, DeviceKind::Fridge, 4); }),
+            timeMs(objectReps, [&](){ fleet.clampTemp(DeviceFleet::allDevices, DeviceKind::AirCon, 18, 24); }),
+            timeMs(objectReps, [&](){ fleet.power(DeviceFleet::allDevices, DeviceKind::Light, PowerOp::Off); }),
+            timeMs(objectReps, [&](){ fleet.power(buildingX, DeviceKind::Fridge, PowerOp::Toggle); }),
+            timeMs(objectReps, [&](){
+                onCount = 0;
+                for(int kind = 0; kind < deviceKinds; kind++) onCount += fleet.countOn(DeviceFleet::allDevices, (DeviceKind)kind);
+            })
+        });
+        //read back from the device objects themselves, not the table
+        TableSummary got;
+        {
+            EpochGuard guard;
+            for(auto& h : reg.handles()){
+                Device* d = reg.get(h);
+                if(!d) continue;
+                int k = (int)d->getKind();
+                DeviceState s = d->snapshot();
+                got.total[k]++;
+                got.on[k] += s.on;
+                if(d->getKind() == DeviceKind::Light) got.levelCount[s.level]++;
+                else got.setpointSum[k] += s.temp;
+            }
+        }
+        TableSummary table = fleet.scan();
+        devicesMatch = onCount == expectedOn;
+        for(int kind = 0; kind < deviceKinds; kind++){
+            devicesMatch = devicesMatch && got.total[kind] == expected.total[kind] && got.on[kind] == expected.on[kind]
+                && got.setpointSum[kind] == expected.setpointSum[kind]
+                && table.on[kind] == got.on[kind] && table.setpointSum[kind] == got.setpointSum[kind];
+        }
+        for(int l = 0; l < 4; l++) devicesMatch = devicesMatch && got.levelCount[l] == expected.levelCount[l];
+    }
+
+    cout<<deviceCount<<" devices, ms per command"<<endl;
+    cout<<"Command                          ";
+    for(auto& c : columns) cout<<"\t"<<c;
+    cout<<endl;
+    for(int cmd = 0; cmd < 5; cmd++){
+        string label = commands[cmd];
+        label.resize(33, ' ');
+        cout<<label;
+        for(auto& col : ms) cout<<"\t"<<col[cmd];
+        cout<<endl;
+    }
+    cout<<"Results match: "<<(allMatch ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"Fleet commands changed the real devices as the per-device run did: "<<(devicesMatch ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//2000 waiter threads over 1000 devices. One write is in flight at a time: the writer stamps the clock,
+//changes a device, and waits until every thread watching it has woken and recorded the delay.
+//Old path: shared_mutex + condition_variable_any per device, notify_all under the exclusive lock.
+//New paths: atomic::wait on the device's state word, and subscriptions to 8 devices per waiter.
+void benchmarkWakeLatency(){
+    const int deviceCount = 1000;
+    const int waiterCount = 2000;
+    const int writes = 300;
+    const int watchPerSub = 8;
+
+    struct CvDevice{
+        shared_mutex rwLock;
+        condition_variable_any changed;
+        uint32_t version = 0;
+    };
+    vector<unique_ptr<CvDevice>> cvDevs;
+    vector<unique_ptr<Fridge>> devs;
+    for(int i = 0; i < deviceCount; i++){
+        cvDevs.push_back(make_unique<CvDevice>());
+        devs.push_back(make_unique<Fridge>("W" + to_string(i)));
+    }
+    auto watchedBy = [&](int mode, int w){//devices waiter w watches
+        vector<int> out;
+        if(mode < 2) out.push_back(w % deviceCount);
+        else for(int j = 0; j < watchPerSub; j++) out.push_back((w * 7 + j * 131) % deviceCount);
+        return out;
+    };
+    const char* names[] = {"condition_variable_any", "atomic::wait per device", "Subscriptions (8 devices each)"};
+
+    for(int mode = 0; mode < 3; mode++){
+        vector<int> watchers(deviceCount, 0);
+        for(int w = 0; w < waiterCount; w++) for(int d : watchedBy(mode, w)) watchers[d]++;
+
+        atomic<long long> stamp{0}; //steady_clock ns of the write in flight
+        atomic<int> acks{0};
+        atomic<bool> done{false};
+        atomic<int> ready{0};
+        vector<vector<double>> samples(waiterCount);
+        vector<unique_ptr<DeviceSubscription>> subs(waiterCount);
+        auto nowNs = [](){
+            return (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        };
+        auto record = [&](int w){
+            samples[w].push_back((nowNs() - stamp.load()) / 1000.0);
+            acks++;
+        };
+
+        vector<thread> threads;
+        for(int w = 0; w < waiterCount; w++){
+            if(mode == 2){//subscribe before the writer starts so no write is missed
+                vector<Device*> watched;
+                for(int d : watchedBy(mode, w)) watched.push_back(devs[d].get());
+                subs[w] = make_unique<DeviceSubscription>(watched);
+            }
+            threads.emplace_back([&, w](){
+                int d = w % deviceCount;
+                if(mode == 0){
+                    CvDevice& cd = *cvDevs[d];
+                    shared_lock lock(cd.rwLock);
+                    uint32_t seen = cd.version;
+                    ready++;
+                    while(true){
+                        cd.changed.wait(lock, [&](){return cd.version != seen;});
+                        seen = cd.version;
+                        if(done) return;
+                        record(w);
+                    }
+                }
+                else if(mode == 1){
+                    uint32_t seen = devs[d]->changeCount();
+                    ready++;
+                    while(true){
+                        seen = devs[d]->waitForChange(seen);
+                        if(done) return;
+                        record(w);
+                    }
+                }
+                else{
+                    ready++;
+                    while(subs[w]->wait()) record(w);
+                }
+            });
+        }
+        while(ready < waiterCount) this_thread::yield();
+
+        long expected = 0;
+        for(int i = 0; i < writes; i++){
+            int d = (i * 37) % deviceCount;
+            expected += watchers[d];
+            stamp = nowNs();
+            if(mode == 0){
+                unique_lock lock(cvDevs[d]->rwLock);
+                cvDevs[d]->version++;
+                cvDevs[d]->changed.notify_all();
+            }
+            else devs[d]->toggleOn();
+            while(acks < expected) this_thread::yield();
+        }
+
+        done = true;
+        for(int d = 0; d < deviceCount; d++){
+            if(mode == 0){
+                unique_lock lock(cvDevs[d]->rwLock);
+                cvDevs[d]->version++;
+                cvDevs[d]->changed.notify_all();
+            }
+            else if(mode == 1) devs[d]->toggleOn();
+        }
+        for(auto& sub : subs) if(sub) sub->cancel();
+        for(auto& t : threads) t.join();
+
+        vector<double> all;
+        for(auto& v : samples) all.insert(all.end(), v.begin(), v.end());
+        sort(all.begin(), all.end());
+        if(all.empty()) continue;
+        cout<<names[mode]<<": "<<all.size()<<" wake-ups, median "<<all[all.size() / 2]<<" us, p99 "
+            <<all[all.size() * 99 / 100]<<" us, max "<<all.back()<<" us"<<endl;
+    }
+    cout<<waiterCount<<" waiters, "<<deviceCount<<" devices, "<<writes<<" writes"<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//4 producer threads change their own 1000 devices as fast as they can, each step is a power event
+//plus a setpoint or brightness event. First with nobody subscribed, then with an automation
+//subscriber (power, drop), a logger (everything, backpressure) and telemetry (settings, drop, small queue).
+void benchmarkEventBus(){
+    const int producerCount = 4;
+    const int devicesPerProducer = 1000;
+    const auto runFor = chrono::seconds(1);
+
+    vector<unique_ptr<Device>> devs;
+    for(int i = 0; i < producerCount * devicesPerProducer; i++){
+        if(i % 2) devs.push_back(make_unique<Light>("B" + to_string(i)));
+        else devs.push_back(make_unique<Fridge>("B" + to_string(i)));
+    }
+    auto produce = [&](){//returns the number of events generated, every step really changes both fields
+        atomic<bool> running{true};
+        atomic<long> events{0};
+        vector<thread> producers;
+        for(int p = 0; p < producerCount; p++){
+            producers.emplace_back([&, p](){
+                long done = 0;
+                while(running){
+                    for(int i = p * devicesPerProducer; i < (p + 1) * devicesPerProducer && running; i++){
+                        Device* d = devs[i].get();
+                        d->toggleOn();
+                        DeviceState s = d->snapshot();
+                        if(d->getKind() == DeviceKind::Light) static_cast<Light*>(d)->setBrightness(s.level == 1 ? 3 : 1);
+                        else static_cast<Fridge*>(d)->setTemp(s.temp == 3 ? 4 : 3);
+                        done += 2;
+                    }
+                }
+                events += done;
+            });
+        }
+        this_thread::sleep_for(runFor);
+        running = false;
+        for(auto& t : producers) t.join();
+        return events.load();
+    };
+
+    double quiet = (double)produce() / runFor.count();
+
+    atomic<long> turnedOn{0};
+    atomic<uint64_t> logChecksum{0};
+    vector<double> latencyUs; //sampled by the logger, only its thread touches it
+    auto nowNs = [](){
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    int automation = bus.subscribe("Automation", topicBit(EventTopic::Power), [&](const DeviceEvent* e, size_t n){
+        long on = 0;
+        for(size_t i = 0; i < n; i++) on += e[i].value;
+        turnedOn += on;
+    });
+    int logger = bus.subscribe("Logger", topicBit(EventTopic::Power) | topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+        [&](const DeviceEvent* e, size_t n){
+            uint64_t sum = 0;
+            for(size_t i = 0; i < n; i++) sum += e[i].version ^ (uint64_t)e[i].value;
+            logChecksum += sum;
+            if(latencyUs.size() < 100000) latencyUs.push_back((nowNs() - e[n - 1].timeNs) / 1000.0);
+        }, OverflowPolicy::Block);
+    int telemetry = bus.subscribe("Telemetry", topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+        [&](const DeviceEvent*, size_t){}, OverflowPolicy::Drop, 1024);
+
+    long published = produce();
+    double busy = (double)published / runFor.count();
+    const char* names[] = {"Automation (power, drop)", "Logger (all, backpressure)", "Telemetry (settings, drop, 1024)"};
+    int ids[] = {automation, logger, telemetry};
+    BusStats st[3];
+    for(int i = 0; i < 3; i++) st[i] = bus.unsubscribe(ids[i]);
+
+    cout<<"No subscribers:   "<<quiet<<" events/s"<<endl;
+    cout<<"3 subscribers:    "<<busy<<" events/s published"<<endl;
+    for(int i = 0; i < 3; i++){
+        cout<<names[i]<<": delivered "<<st[i].delivered<<", dropped "<<st[i].dropped<<", publisher waits "<<st[i].blocked
+            <<", avg batch "<<(st[i].batches ? (double)st[i].delivered / st[i].batches : 0)<<endl;
+    }
+    if(!latencyUs.empty()){
+        sort(latencyUs.begin(), latencyUs.end());
+        cout<<"Logger delivery latency: median "<<latencyUs[latencyUs.size() / 2]<<" us, p99 "
+            <<latencyUs[latencyUs.size() * 99 / 100]<<" us"<<endl;
+    }
+    cout<<"Logger saw every event: "<<(st[1].delivered == published ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//100k devices: the first 80k are read by rules, the last 20k are only written by them, so the run has
+//no cascades and a known end. Each rule is "if <input> turns on and <input> temp/brightness > x then
+//set <output> to y". A writer then makes 200k random power/setpoint changes on the inputs.
+void benchmarkRuleEngine(){
+    const int deviceCount = 100000;
+    const int inputCount = 80000;
+    const int ruleCount = 100000;
+    const int changes = 200000;
+    const int scanSample = 200;
+
+    DeviceRegistry reg;
+    vector<DeviceHandle> handles;
+    vector<Device*> devs;
+    for(int i = 0; i < deviceCount; i++){
+        Device* d;
+        switch(i % 3){
+            case 0: d = new Fridge("R" + to_string(i)); break;
+            case 1: d = new Light("R" + to_string(i)); break;
+            default: d = new AirCon("R" + to_string(i)); break;
+        }
+        handles.push_back(reg.add(d));
+        devs.push_back(d);
+    }
+
+    RuleEngine engine(reg);
+    engine.reserve(ruleCount, inputCount);
+    mt19937 rng(41);
+    vector<Rule> rules; //kept for the unindexed comparison
+    auto start = chrono::steady_clock::now();
+    for(int r = 0; r < ruleCount; r++){
+        Rule rule;
+        int a = rng() % inputCount, b = rng() % inputCount, c = inputCount + rng() % (deviceCount - inputCount);
+        rule.when.push_back({handles[a], EventTopic::Power, CmpOp::Eq, 1});
+        if(devs[b]->getKind() == DeviceKind::Light) rule.when.push_back({handles[b], EventTopic::Brightness, CmpOp::Ge, 2});
+        else rule.when.push_back({handles[b], EventTopic::Setpoint, CmpOp::Gt, (int)(rng() % 20)});
+        if(devs[c]->getKind() == DeviceKind::Light) rule.then.push_back({handles[c], EventTopic::Brightness, 1 + (int)(rng() % 3)});
+        else rule.then.push_back({handles[c], EventTopic::Setpoint, (int)(rng() % 20)});
+        engine.addRule(rule);
+        rules.push_back(rule);
+    }
+    double compileMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    engine.start();
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < changes; i++){
+        Device* d = devs[rng() % inputCount];
+        if(i % 2) d->toggleOn();
+        else if(d->getKind() == DeviceKind::Light) static_cast<Light*>(d)->setBrightness(1 + rng() % 3);
+        else if(d->getKind() == DeviceKind::Fridge) static_cast<Fridge*>(d)->setTemp(rng() % 20);
+        else static_cast<AirCon*>(d)->setTemp(rng() % 20);
+    }
+    while(!engine.idle()) this_thread::yield();
+    double runMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    engine.stop();
+    RuleStats st = engine.stats();
+
+    //the same events against a plain rule list: every rule is looked at to find the ones that read the device
+    double scanMs;
+    {
+        EpochGuard guard;
+        start = chrono::steady_clock::now();
+        long matches = 0;
+        for(int i = 0; i < scanSample; i++){
+            const Device* src = devs[rng() % inputCount];
+            for(const Rule& r : rules){
+                for(const RuleCondition& c : r.when){
+                    if(reg.get(c.device) == src && c.field == EventTopic::Power) matches++;
+                }
+            }
+        }
+        scanMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / scanSample;
+        if(matches < 0) cout<<matches; //keeps the loop from being optimized away
+    }
+
+    cout<<ruleCount<<" rules over "<<deviceCount<<" devices, compiled in "<<compileMs<<" ms"<<endl;
+    cout<<"Events handled: "<<st.events<<" in "<<runMs<<" ms ("<<st.events / runMs * 1000<<" events/s, writer included)"<<endl;
+    cout<<"Rules checked per event: "<<(st.events ? (double)st.checked / st.events : 0)<<" (of "<<ruleCount<<")"<<endl;
+    cout<<"Rules fired: "<<st.fired<<", actions applied: "<<st.actions<<endl;
+    cout<<"Indexed: "<<(st.events ? runMs / st.events * 1000 : 0)<<" us/event, unindexed scan: "<<scanMs * 1000<<" us/event"<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-void removeDev(){
-    int indx;
-    while(true){
-        listDev();
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choose device to remove: ";
-        
-        indx = getCh(devices.size());
-        if(indx == 0){
-            cout<<"\n"<<endl;
-            return;
+//2M timers spread over an hour of 1 ms ticks in the wheel, half of them cancelled, then the hour is
+//advanced tick by tick; std::multimap does the same inserts and cancels for comparison.
+//Then 10k real timers over one second on a scheduler to see how late they fire.
+void benchmarkTimerWheel(){
+    const int timerCount = 2000000;
+    const uint64_t horizon = 3600000; //1 h in ms ticks
+    const int realTimers = 10000;
+
+    mt19937 rng(42);
+    vector<uint64_t> due(timerCount);
+    for(auto& d : due) d = 1 + rng() % horizon;
+    vector<int> cancelOrder(timerCount / 2);
+    for(auto& c : cancelOrder) c = rng() % timerCount;
+
+    auto elapsedNs = [](chrono::steady_clock::time_point since){
+        return (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - since).count();
+    };
+
+    TimerWheel<uint32_t> wheel;
+    wheel.reserve(timerCount);
+    vector<TimerId> ids(timerCount);
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < timerCount; i++) ids[i] = wheel.insert(due[i], i);
+    double wheelInsert = elapsedNs(start) / timerCount;
+    vector<bool> cancelled(timerCount, false);
+    long cancels = 0;
+    start = chrono::steady_clock::now();
+    for(int c : cancelOrder){
+        if(wheel.cancel(ids[c])){
+            cancelled[c] = true;
+            cancels++;
         }
-        else if(indx == -1)continue;
-        else if(indx <= devices.size() && indx > 0){
-            devices.erase(devices.begin() + (indx-1));
-            cout<<"Sucessfully deleted."<<endl;
+    }
+    double wheelCancel = elapsedNs(start) / cancelOrder.size();
+    size_t pendingAfterCancel = wheel.size();
+
+    vector<TimerId> expired;
+    long firedCount = 0, wrongTick = 0, firedCancelled = 0;
+    start = chrono::steady_clock::now();
+    for(uint64_t t = 1000; t <= horizon + 1000; t += 1000){//a second of ticks at a time
+        expired.clear();
+        wheel.advance(t, expired);
+        for(TimerId id : expired){
+            uint32_t i = *wheel.get(id);
+            if(due[i] > t || due[i] + 1000 <= t) wrongTick++;
+            if(cancelled[i]) firedCancelled++;
+            wheel.release(id);
+            firedCount++;
         }
-        else{}
-        cout<<"\n"<<endl;
-        return;
-        
     }
-}
+    double advanceMs = elapsedNs(start) / 1e6;
 
-void listDev(){
-    if(devices.empty()){//if no devices
-        cout<<"\033[1;33mNo devices available.\033[0m"<<endl;
-        return;
+    multimap<uint64_t, uint32_t> tree;
+    vector<multimap<uint64_t, uint32_t>::iterator> its(timerCount);
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < timerCount; i++) its[i] = tree.emplace(due[i], i);
+    double treeInsert = elapsedNs(start) / timerCount;
+    vector<bool> gone(timerCount, false);
+    start = chrono::steady_clock::now();
+    for(int c : cancelOrder){
+        if(gone[c]) continue;
+        tree.erase(its[c]);
+        gone[c] = true;
     }
-    int i = 1;
-    for (auto& d : devices) {
-        cout<<i<<" - ";
-        d->showStatus();
-        i++;
+    double treeCancel = elapsedNs(start) / cancelOrder.size();
+
+    cout<<timerCount<<" timers over 1 h of 1 ms ticks"<<endl;
+    cout<<"Timer wheel: insert "<<wheelInsert<<" ns, cancel "<<wheelCancel<<" ns"<<endl;
+    cout<<"std::multimap: insert "<<treeInsert<<" ns, cancel "<<treeCancel<<" ns"<<endl;
+    cout<<"Advanced 1 h in "<<advanceMs<<" ms, fired "<<firedCount<<" of "<<pendingAfterCancel<<" pending"<<endl;
+    cout<<"Fired in the right second, none cancelled: "
+        <<(wrongTick == 0 && firedCancelled == 0 && firedCount == (long)pendingAfterCancel && wheel.size() == 0 ? "yes (PASS)" : "no (FAIL)")<<endl;
+
+    Scheduler local(4);
+    vector<double> lateMs(realTimers, -1);
+    auto begin = Scheduler::Clock::now();
+    for(int i = 0; i < realTimers; i++){
+        int delay = rng() % 1000;
+        auto target = Scheduler::Clock::now() + chrono::milliseconds(delay);
+        local.after(chrono::milliseconds(delay), [&lateMs, i, target](){
+            lateMs[i] = chrono::duration<double, milli>(Scheduler::Clock::now() - target).count();
+        });
     }
+    while(local.firedCount() < realTimers && Scheduler::Clock::now() - begin < chrono::seconds(5)) this_thread::sleep_for(chrono::milliseconds(10));
+    local.stop();
+    vector<double> late;
+    for(double l : lateMs) if(l >= 0) late.push_back(l);
+    sort(late.begin(), late.end());
+    if(!late.empty()){
+        cout<<"Scheduler, "<<realTimers<<" timers over 1 s: "<<late.size()<<" ran, lateness median "<<late[late.size() / 2]
+            <<" ms, p99 "<<late[late.size() * 99 / 100]<<" ms"<<endl;
+    }
+    cout<<"===============================\n\n"<<endl;
 }
 
-void userManagement(){
-    while(true){
-        cout<<"======= User Management ======="<<endl;
-        cout<<"1 - Register Users"<<endl;
-        cout<<"2 - User List"<<endl;
-        cout<<"3 - Remove Users"<<endl;
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choice: ";
-        int ch = getCh(3);
-        if(ch == -1){
-            cout<<"\n"<<endl;
-            continue;
-        }
-        switch(ch){
-            case 1: addUser(); break;
-            case 2: 
-                cout<<"\n========= User List ==========="<<endl;
-                listUser();
-                cout<<"===============================\n\n"<<endl; 
-                break;
-            case 3: removeUser(); break;
-            case 0: 
-                cout<<"\n"<<endl;
-                return;
-        }
+//100k user sessions at once, each a coroutine, on 4 workers plus one timer thread. A simulated second
+//is 100 ms so every session is still running when the last one is spawned.
+void benchmarkCoroutineSim(){
+    const int deviceCount = 1000;
+    const int userCount = 200000;
+    const int sessionCount = 100000;
+    const int workerCount = 4;
+
+    DeviceRegistry reg;
+    for(int i = 0; i < deviceCount; i++){
+        if(i % 2 == 0) reg.add(new Fridge("F" + to_string(i)));
+        else reg.add(new Light("L" + to_string(i)));
+    }
+    UserTable simUsers;
+    for(int i = 0; i < userCount; i++) simUsers.add("U" + to_string(i));
+
+    double seconds;
+    long actions, peak;
+    {
+        CoExecutor exec(workerCount);
+        SimContext ctx(exec, simUsers, reg, chrono::milliseconds(100), false);
+        mt19937 rng(42);
+        auto start = chrono::steady_clock::now();
+        for(int i = 1; i <= sessionCount; i++) exec.spawn(userSession(ctx, i, rng()));
+        ctx.waitFor(sessionCount);
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        actions = ctx.actions;
+        peak = ctx.peak;
     }
+    long stillIn = 0;
+    for(auto& u : simUsers.list()) if(simUsers.isLoggedIn(u.first)) stillIn++;
 
+    cout<<sessionCount<<" sessions, "<<deviceCount<<" devices, "<<workerCount<<" workers + 1 timer thread"<<endl;
+    cout<<"Finished in "<<seconds<<" s, "<<actions<<" device actions ("<<(long)(actions / seconds)<<" actions/s)"<<endl;
+    cout<<"Peak concurrent sessions: "<<peak<<endl;
+    cout<<"All actions done, every user logged out: "
+        <<(actions == 9L * sessionCount && stillIn == 0 ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-void deviceControl(){
-    int indx;
-    while(true){
-        cout<<"======= Control Device ========"<<endl;
-        listDev();
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choose device to manage: ";
-        cin>>indx;
-        indx--;
-        if(indx == -1){
-            cout<<"\n"<<endl; 
-            return;
-        }
-        else if(indx >= 0 && indx < devices.size()){
-            cout<<"\n";
-            break;
+//A whole day for 10k household users over 100k devices on the virtual clock: everyone idles up to an
+//hour, uses three devices, and goes again until midnight. Run twice with the same seed, the device
+//states at the end must match.
+void benchmarkVirtualDay(){
+    const int deviceCount = 100000;
+    const int userCount = 10000;
+    const uint64_t seed = 2024;
+
+    struct DayResult{
+        double seconds;
+        uint64_t events;
+        long actions;
+        uint64_t fingerprint;
+    };
+    auto runDay = [&](){
+        DeviceRegistry reg;
+        for(int i = 0; i < deviceCount; i++){
+            if(i % 2 == 0) reg.add(new Fridge("F" + to_string(i)));
+            else reg.add(new Light("L" + to_string(i)));
         }
-        else{
-            cout<<"Enter a valid number."<<endl;
-            cout<<"\n";
-            continue;
+        UserTable simUsers;
+        for(int i = 0; i < userCount; i++) simUsers.add("U" + to_string(i));
+
+        DayResult result;
+        CoExecutor exec(0, SimClock::Virtual);
+        SimContext ctx(exec, simUsers, reg, chrono::seconds(1), false);
+        ctx.idleMax = chrono::hours(1);
+        ctx.dayEnd = chrono::hours(24);
+        auto start = chrono::steady_clock::now();
+        for(int i = 1; i <= userCount; i++) exec.spawn(userSession(ctx, i, sessionSeed(seed, i)));
+        ctx.waitFor(userCount);
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        result.events = exec.events();
+        result.actions = ctx.actions;
+        result.fingerprint = 1469598103934665603ull; //FNV-1a over every device's on/temp/level
+        EpochGuard guard;
+        for(DeviceHandle h : reg.handles()){
+            DeviceState st = reg.get(h)->snapshot();
+            for(int v : {(int)st.on, st.temp, st.level}){
+                result.fingerprint = (result.fingerprint ^ (uint32_t)v) * 1099511628211ull;
+            }
         }
+        return result;
+    };
+
+    DayResult first = runDay();
+    DayResult second = runDay();
+    cout<<userCount<<" users, "<<deviceCount<<" devices, 24 h of virtual time"<<endl;
+    cout<<"Ran in "<<first.seconds<<" s ("<<(long)(86400 / first.seconds)<<"x real time), "
+        <<first.events<<" events, "<<first.actions<<" device actions"<<endl;
+    cout<<"Second run with the same seed: "<<second.seconds<<" s, "<<second.events<<" events"<<endl;
+    cout<<"Same events and final device states: "
+        <<(first.events == second.events && first.actions == second.actions && first.fingerprint == second.fingerprint ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}
+
+//10k users, 64 threads that each keep 155 of them logged in (99% of the pool) and keep swapping the
+//oldest for a new one. First the old way, random draws under one mutex until a free user turns up,
+//then the UserTable idle stack while another thread removes and re-adds users.
+void benchmarkUserPool(){
+    const int userCount = 10000;
+    const int threadCount = 64;
+    const int holdEach = 155;
+    const int churnMax = 1000; //users replaced while logging in
+    const auto runFor = chrono::seconds(1);
+
+    //old: random index under the lock, retry while that user is logged in
+    vector<char> loggedIn(userCount, 0);
+    fill(loggedIn.begin(), loggedIn.begin() + threadCount * holdEach, 1); //thread t starts holding its own 155
+    mutex poolMtx;
+    atomic<bool> running{true};
+    atomic<long> logins{0}, draws{0};
+    vector<thread> threads;
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&, t](){
+            mt19937 rng(t);
+            deque<int> held;
+            for(int i = 0; i < holdEach; i++) held.push_back(t * holdEach + i);
+            long done = 0, tries = 0;
+            while(running){
+                int id = -1;
+                while(id < 0 && running){
+                    lock_guard<mutex> lock(poolMtx);
+                    int pick = rng() % userCount;
+                    tries++;
+                    if(loggedIn[pick]) continue;
+                    loggedIn[pick] = 1;
+                    id = pick;
+                }
+                if(id < 0) break;
+                held.push_back(id);
+                done++;
+                if((int)held.size() > holdEach){
+                    lock_guard<mutex> lock(poolMtx);
+                    loggedIn[held.front()] = 0;
+                    held.pop_front();
+                }
+            }
+            logins += done;
+            draws += tries;
+        });
     }
-    Device* dev = devices[indx];
-    cout<<"======= Control Device ========"<<endl;
-    if(Fridge* fridge = dynamic_cast<Fridge*>(dev)){
-        fridge->showStatus();
-        cout<<"1 - Turn On/Off"<<endl;
-        cout<<"2 - Set Temp"<<endl;
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choice: ";
-        int ch = getCh(2);
-        cout<<"\n";
-        cout<<"==============================="<<endl;
-        switch(ch){
-            case 1: fridge->toggleOn(); fridge->showStatus(); break;
-            case 2: 
-                int temp;
-                cout<<"Set Temp to: ";
-                cin>>temp;
-                fridge->putTemp(temp);
-                break;
-            case 0:
-                break;
-        }
-        cout<<"==============================="<<endl;
-    } 
-    else if (Light* light = dynamic_cast<Light*>(dev)){
-        light->showStatus();
-        cout<<"1 - Turn On/Off"<<endl;
-        cout<<"2 - Set Brightness"<<endl;
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choice: ";
-        int ch = getCh(2);
-        cout<<"\n";
-        cout<<"==============================="<<endl;
-        switch(ch){
-            case 1: light->toggleOn(); light->showStatus(); break;
-            case 2: 
-                int lvl;
-                cout<<"(1 - Low, 2 - Mid, 3 - High)"<<endl;
-                cout<<"Set Brightness to : ";
-                cin>>lvl;
-                cout<<"\n";
-                light->putBrightness(lvl);
-                break;
-            case 0:
-                break;
+    this_thread::sleep_for(runFor);
+    running = false;
+    for(auto& th : threads) th.join();
+    double oldRate = logins.load() / chrono::duration<double>(runFor).count();
+    double oldDraws = logins ? (double)draws / logins : 0;
+
+    //new: pop from the idle stack, while users are removed and re-added
+    UserTable table;
+    for(int i = 0; i < userCount; i++) table.add("U" + to_string(i));
+    vector<atomic<int>> holders(userCount + churnMax);
+    vector<deque<UserId>> startHeld(threadCount);
+    for(auto& held : startHeld){
+        for(int i = 0; i < holdEach; i++){
+            held.push_back(table.acquire());
+            holders[held.back().index]++;
         }
-        cout<<"==============================="<<endl;
     }
-    else if(AirCon* aircon = dynamic_cast<AirCon*>(dev)){
-        aircon->showStatus();
-        cout<<"1 - Turn On/Off"<<endl;
-        cout<<"2 - Set Temp"<<endl;
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choice: ";
-        int ch = getCh(2);
-        cout<<"\n";
-        cout<<"==============================="<<endl;
-        switch(ch){
-            case 1: aircon->toggleOn(); aircon->showStatus(); break;
-            case 2: 
-                int temp;
-                cout<<"Set Temp to: ";
-                cin>>temp;
-                aircon->putTemp(temp);
-                break;
-            case 0:
-                break;
+    atomic<long> doubleLogins{0}, emptyPool{0}, churned{0};
+    running = true;
+    logins = 0;
+    threads.clear();
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&, t](){
+            deque<UserId> held = move(startHeld[t]);
+            long done = 0, empty = 0;
+            while(running){
+                UserId id = table.acquire();
+                if(!id.valid()){
+                    empty++;
+                    this_thread::yield();
+                    continue;
+                }
+                if(holders[id.index].fetch_add(1) != 0) doubleLogins++;
+                held.push_back(id);
+                done++;
+                if((int)held.size() > holdEach){
+                    holders[held.front().index].fetch_sub(1);
+                    table.release(held.front());
+                    held.pop_front();
+                }
+            }
+            for(UserId id : held){
+                holders[id.index].fetch_sub(1);
+                table.release(id);
+            }
+            logins += done;
+            emptyPool += empty;
+        });
+    }
+    thread churn([&](){
+        mt19937 rng(99);
+        long n = 0;
+        while(running && n < churnMax){
+            auto all = table.list();
+            if(table.remove(all[rng() % all.size()].first)){
+                table.add("C" + to_string(n));
+                n++;
+            }
+            this_thread::sleep_for(chrono::microseconds(100));
         }
-        cout<<"==============================="<<endl;
-    } 
-    cout<<"\n"<<endl;
-}
+        churned = n;
+    });
+    this_thread::sleep_for(runFor);
+    running = false;
+    for(auto& th : threads) th.join();
+    churn.join();
+    double newRate = logins.load() / chrono::duration<double>(runFor).count();
 
-void showLocks(){
-    cout<<"========= Lock Status ========="<<endl;
-    cout<<devMutex.getName()<<": "<<(devMutex.checkLock() ? "Locked by "+ devMutex.getOwner() : "Unlocked")<<endl;
-    cout<<userMutex.getName()<<": "<<(userMutex.checkLock() ? "Locked by "+ userMutex.getOwner() : "Unlocked")<<endl;
-    cout<<printMutex.getName()<<": "<<(printMutex.checkLock() ? "Locked by "+ printMutex.getOwner() : "Unlocked")<<endl;
-    cout<<"==============================="<<endl;
-    cout<<"\n"<<endl;
+    size_t idle = 0;
+    vector<UserId> drained;
+    for(UserId id; (id = table.acquire()).valid();) drained.push_back(id);
+    idle = drained.size();
+    for(UserId id : drained) table.release(id);
+
+    cout<<userCount<<" users, "<<threadCount<<" threads holding "<<threadCount * holdEach<<" logins"<<endl;
+    cout<<"Random draw under one mutex: "<<(long)oldRate<<" logins/s, "<<oldDraws<<" draws per login"<<endl;
+    cout<<"Lock-free idle stack: "<<(long)newRate<<" logins/s, "<<emptyPool<<" times found empty, "<<churned<<" users replaced meanwhile"<<endl;
+    cout<<"Speedup: "<<newRate / oldRate<<"x"<<endl;
+    cout<<"No user logged in twice, every user idle again: "
+        <<(doubleLogins == 0 && idle == table.size() && table.size() == (size_t)userCount ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-void addUser(){
-    string user;
-    cout<<"\n======== Register User ========"<<endl;
-    cout<<"Enter username: ";
-    cin>>user;
+//Cost of a TrackedMutex lock/unlock with the validator off and on, then two threads that take the same
+//pair of locks in opposite orders one after the other. They never deadlock here, the validator must still
+//report the cycle. Taking a recursive lock twice and scoped_lock of both (std::lock only try_locks the
+//second) must not be reported.
+void benchmarkLockValidator(){
+    const int rounds = 5000000;
+    bool wasOn = lockdep.on();
 
-    for (const auto& u : users){
-        if(u.user == user){
-            cout<<"Username already exists!"<<endl;
-            return;
+    auto nsPerLock = [&](auto& outer, auto& inner){
+        auto start = chrono::steady_clock::now();
+        lock_guard<decay_t<decltype(outer)>> hold(outer);
+        for(int i = 0; i < rounds; i++){
+            inner.lock();
+            inner.unlock();
         }
-    } 
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rounds;
+    };
+    mutex plainOuter, plainInner;
+    TrackedMutex<mutex> outer("Bench Outer"), inner("Bench Inner");
+    double plain = nsPerLock(plainOuter, plainInner);
+    lockdep.enable(false);
+    double off = nsPerLock(outer, inner);
+    lockdep.enable(true);
+    double on = nsPerLock(outer, inner);
 
-    User newUser;
-    newUser.user = user;
-    newUser.isLoggedIn = false;
+    TrackedMutex<mutex> userLock("Demo User Lock");
+    TrackedMutex<recursive_mutex> printLock("Demo Print Lock");
+    thread([&](){//log out: user lock, then print
+        lock_guard<TrackedMutex<mutex>> u(userLock);
+        lock_guard<TrackedMutex<recursive_mutex>> p(printLock);
+    }).join();
+    thread([&](){//flag a lock while printing: print lock, then user
+        lock_guard<TrackedMutex<recursive_mutex>> p(printLock);
+        lock_guard<TrackedMutex<recursive_mutex>> again(printLock);
+        lock_guard<TrackedMutex<mutex>> u(userLock);
+    }).join();
+    TrackedMutex<mutex> scopedA("Demo Scoped A"), scopedB("Demo Scoped B");
+    thread([&](){scoped_lock both(scopedA, scopedB);}).join();
+    thread([&](){scoped_lock both(scopedB, scopedA);}).join();
+    lockdep.enable(wasOn);
 
-    //add to users vector
-    users.push_back(newUser);
-    cout<<"User "<<user<<" registered successfully!"<<endl;
+    bool demoFound = false, falseAlarm = false;
+    for(auto& r : lockdep.reports()){
+        if(r.find("Demo User Lock") != string::npos && r.find("Demo Print Lock") != string::npos) demoFound = true;
+        if(r.find("Demo Scoped") != string::npos || r.find("Bench") != string::npos) falseAlarm = true;
+    }
+
+    cout<<rounds<<" lock/unlock pairs while holding another lock"<<endl;
+    cout<<"std::mutex: "<<plain<<" ns, TrackedMutex validator off: "<<off<<" ns, on: "<<on<<" ns"<<endl;
+    cout<<"Opposite orders reported, no false alarms: "<<(demoFound && !falseAlarm ? "yes (PASS)" : "no (FAIL)")<<endl;
+    for(auto& r : lockdep.reports()) cout<<"  "<<r<<endl;
     cout<<"===============================\n\n"<<endl;
 }
 
-void listUser(){
-    int i = 1;
-    for (auto& u : users){
-        cout<<i<<" - "<<u.user<<endl;
-        i++;
-    }
-}
+//A day of setpoint history for 1M devices, one change every 30 min give or take 10, values drifting by
+//up to 2 a step. One thread appends round by round while two others keep querying random devices and
+//checking every raw point they get back. Afterwards 10k devices are checked in full: the raw changes the
+//ring still holds, and the whole day per hour, which for the older hours comes from the roll-up.
+//Last, 1000 devices are removed and 1000 new ones must fit in the memory they leave behind.
+void benchmarkTelemetry(){
+    const uint32_t deviceCount = 1000000;
+    const uint32_t rounds = 48;
+    const uint64_t roundMs = 1800000;
+    const uint32_t removedCount = 1000;
+    auto jitter = [](uint32_t d, uint32_t r){return sessionSeed(d, r) % 600000;};
+    auto valueAt = [](uint32_t d, uint32_t r){
+        int v = 0;
+        for(uint32_t i = 0; i <= r; i++) v = clamp(v + (int)(sessionSeed(d, 1000 + i) % 5) - 2, -20, 20);
+        return v;
+    };
+    auto matches = [&](uint32_t d, TelemetryPoint p){
+        uint32_t r = p.timeMs / roundMs;
+        return r < rounds && p.timeMs == r * roundMs + jitter(d, r) && p.value == valueAt(d, r);
+    };
 
-void removeUser(){
-    int indx;
-    while(true){
-        cout<<"\n======== Remove User =========="<<endl;
-        listUser();
-        cout<<"0 - Back"<<endl;
-        cout<<"==============================="<<endl;
-        cout<<"Choose user to remove: ";
-        cin>>indx;
-        
-        if(indx == 0){
-            cout<<"\n"<<endl; 
-            return;
-        }else if(indx <= users.size() && indx > 0){
-            users.erase(users.begin() + (indx-1));
-            cout<<"Sucessfully deleted."<<endl;
-            break;
+    TelemetryStore store(size_t(deviceCount) * TelemetryStore::seriesBytes());
+    atomic<bool> writing{true};
+    atomic<long> queries{0}, badPoints{0};
+    vector<thread> readers;
+    for(int t = 0; t < 2; t++){
+        readers.emplace_back([&, t](){
+            mt19937 rng(t);
+            long done = 0, bad = 0;
+            while(writing){
+                uint32_t d = rng() % deviceCount;
+                for(TelemetryPoint p : store.range(d, 0, UINT64_MAX)) bad += !matches(d, p);
+                done++;
+                this_thread::sleep_for(chrono::microseconds(50)); //a dashboard, not a second writer-sized load
+            }
+            queries += done;
+            badPoints += bad;
+        });
+    }
+    vector<int> values(deviceCount, 0); //valueAt, one step at a time
+    auto start = chrono::steady_clock::now();
+    for(uint32_t r = 0; r < rounds; r++){
+        for(uint32_t d = 0; d < deviceCount; d++){
+            values[d] = clamp(values[d] + (int)(sessionSeed(d, 1000 + r) % 5) - 2, -20, 20);
+            store.append(d, r * roundMs + jitter(d, r), values[d]);
         }
-        else{
-            cout<<"Enter a valid number.\n"<<endl;
-            continue;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    writing = false;
+    for(auto& th : readers) th.join();
+
+    long wrongRaw = 0, wrongHourly = 0;
+    size_t fewestKept = rounds;
+    for(uint32_t d = 0; d < deviceCount; d += deviceCount / 10000){
+        vector<TelemetryPoint> points = store.range(d, 0, UINT64_MAX);
+        fewestKept = min(fewestKept, points.size());
+        if(points.size() < TelemetryStore::minKept() || points.back().timeMs / roundMs != rounds - 1) wrongRaw++;
+        for(TelemetryPoint p : points) badPoints += !matches(d, p);
+        vector<TelemetryBucket> hours = store.downsample(d, 0, rounds * roundMs, 3600000);
+        if(hours.size() != rounds / 2) wrongHourly++;
+        for(auto& b : hours){
+            uint32_t r = b.startMs / roundMs;
+            int lo = min(valueAt(d, r), valueAt(d, r + 1)), hi = max(valueAt(d, r), valueAt(d, r + 1));
+            double mean = (valueAt(d, r) + valueAt(d, r + 1)) / 2.0;
+            if(b.samples != 2 || b.minValue != lo || b.maxValue != hi || b.mean != mean) wrongHourly++;
         }
     }
-    cout<<"\n"<<endl;
+
+    long dropped = store.stats().dropped;
+    for(uint32_t d = 0; d < removedCount; d++) store.forget(d);
+    for(uint32_t d = 0; d < removedCount; d++) store.append(deviceCount + d, rounds * roundMs, 0);
+    store.append(0, rounds * roundMs, 1); //a change of a removed device still on its way
+    bool reused = store.stats().dropped == dropped && store.range(0, 0, UINT64_MAX).empty()
+        && store.range(deviceCount, 0, UINT64_MAX).size() == 1;
+
+    TelemetryStats st = store.stats();
+    double rawMb = (double)st.samples * (sizeof(uint64_t) + sizeof(int32_t)) / (1 << 20);
+    cout<<deviceCount<<" devices x "<<rounds<<" changes over 24 h = "<<st.samples<<" samples"<<endl;
+    cout<<"Appended in "<<seconds<<" s ("<<(long)(st.samples / seconds)<<" samples/s), "<<queries<<" concurrent queries"<<endl;
+    cout<<"Memory: "<<st.bytes / (1 << 20)<<" MB fixed ("<<TelemetryStore::seriesBytes()<<" B per device), raw time+value would be "
+        <<(long)rawMb<<" MB; "<<st.bitsPerSample<<" bits per sample in full blocks"<<endl;
+    cout<<"Raw changes kept: at least "<<fewestKept<<" a device, older ones per half hour; "<<st.forgotten<<" series freed, "
+        <<st.series<<" in use"<<endl;
+    cout<<"Every raw point right, 24 h of hourly min/max/mean right, removed devices' memory reused: "
+        <<(badPoints == 0 && wrongRaw == 0 && wrongHourly == 0 && dropped == 0 && reused
+            && st.forgotten == removedCount && st.series == deviceCount ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-void makeExample(){
-    //devices sample
-    Fridge* f1 = new Fridge("F1");
-    f1->setTemp(5);
-    devices.push_back(f1);
+//64 threads send power, toggle and setpoint commands to 4 hot devices while a logger formats every
+//change event behind a small backpressured queue, so an update costs what it would with a slow consumer.
+//First each command is its own update, then commands go through the devices' mailboxes.
+//Afterwards: toggles from all threads must net out exactly, and a burst from one thread must end on its last setpoint.
+void benchmarkCoalescing(){
+    const int threadCount = 64;
+    const int hotCount = 4;
+    const auto runFor = chrono::seconds(1);
 
-    Light* l1 = new Light("L1");
-    l1->setBrightness(3);
-    devices.push_back(l1);
+    vector<unique_ptr<Device>> hot;
+    for(int i = 0; i < hotCount; i++){
+        if(i % 2) hot.push_back(make_unique<Light>("H" + to_string(i)));
+        else hot.push_back(make_unique<Fridge>("H" + to_string(i)));
+    }
+    atomic<long> logged{0};
+    int logger = bus.subscribe("Logger", topicBit(EventTopic::Power) | topicBit(EventTopic::Setpoint) | topicBit(EventTopic::Brightness),
+        [&](const DeviceEvent* e, size_t n){
+            ostringstream line;
+            for(size_t i = 0; i < n; i++) line<<"device "<<e[i].serial<<" topic "<<(int)e[i].topic<<" now "<<e[i].value<<" was "<<e[i].previous<<"\n";
+            logged += n;
+        }, OverflowPolicy::Block, 64);
 
-    //users sample
-    User u1{"Bea",false};
-    User u2{"Denise", false};
-    User u3{"Charisse", false};
+    auto versions = [&](){
+        long v = 0;
+        for(auto& d : hot) v += d->snapshot().version;
+        return v;
+    };
+    long commands[2], updates[2], events[2];
+    uint64_t received = 0, applied = 0;
+    for(int mode = 0; mode < 2; mode++){
+        bool mailbox = (mode == 1);
+        atomic<bool> running{true};
+        atomic<long> sent{0};
+        long v0 = versions(), e0 = logged;
+        vector<thread> threads;
+        for(int t = 0; t < threadCount; t++){
+            threads.emplace_back([&, t](){
+                mt19937 rng(t);
+                long done = 0;
+                while(running){
+                    Device* d = hot[rng() % hotCount].get();
+                    int pick = rng() % 3;
+                    DeviceCommand c{CommandType::Toggle};
+                    if(pick == 0) c = {CommandType::SetPower, (int)(rng() & 1)};
+                    else if(pick == 2 && d->getKind() == DeviceKind::Light) c = {CommandType::SetBrightness, 1 + (int)(rng() % 3)};
+                    else if(pick == 2) c = {CommandType::SetTemp, (int)(rng() % 11) - 5};
+                    if(mailbox) d->post(c);
+                    else if(c.type == CommandType::SetPower) d->setOn(c.value);
+                    else if(c.type == CommandType::Toggle) d->toggleOn();
+                    else if(c.type == CommandType::SetBrightness) static_cast<Light*>(d)->setBrightness(c.value);
+                    else static_cast<Fridge*>(d)->setTemp(c.value);
+                    done++;
+                }
+                sent += done;
+            });
+        }
+        this_thread::sleep_for(runFor);
+        running = false;
+        for(auto& th : threads) th.join();
+        while(bus.stats(logger).delivered < bus.stats(logger).queued) this_thread::sleep_for(chrono::milliseconds(1));
+        commands[mode] = sent;
+        updates[mode] = versions() - v0;
+        events[mode] = logged - e0;
+    }
+    for(auto& d : hot){
+        MailboxStats st = d->mailboxStats();
+        received += st.received;
+        applied += st.applied;
+    }
+    bus.unsubscribe(logger);
 
-    users.push_back(u1);
-    users.push_back(u2);
-    users.push_back(u3);
+    //net effect of toggles: 64 threads x 1001 toggles is even, plus one more flips it
+    Device* d = hot[0].get();
+    bool startOn = d->snapshot().on;
+    vector<thread> togglers;
+    for(int t = 0; t < threadCount; t++){
+        togglers.emplace_back([d](){
+            for(int i = 0; i < 1001; i++) d->post({CommandType::Toggle});
+        });
+    }
+    for(auto& th : togglers) th.join();
+    d->post({CommandType::Toggle});
+    bool togglesRight = d->snapshot().on == !startOn;
+    for(int temp = -20; temp <= 7; temp++) d->post({CommandType::SetTemp, temp});
+    bool lastWins = d->snapshot().temp == 7;
 
-    cout<<"Examples added."<<endl;
+    cout<<threadCount<<" threads, "<<hotCount<<" hot devices, logger behind a 64-event queue"<<endl;
+    cout<<"One update per command: "<<commands[0] / runFor.count()<<" commands/s, "<<updates[0]<<" updates, "<<events[0]<<" events logged"<<endl;
+    cout<<"Mailbox:                "<<commands[1] / runFor.count()<<" commands/s, "<<updates[1]<<" updates, "<<events[1]<<" events logged"<<endl;
+    cout<<"Mailbox received "<<received<<" commands, applied "<<applied<<" batches ("
+        <<(applied ? (double)received / applied : 0)<<" commands per update)"<<endl;
+    cout<<"Speedup: "<<(double)commands[1] / commands[0]<<"x"<<endl;
+    cout<<"Toggles net out, last setpoint wins: "<<(togglesRight && lastWins ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-string getColor(int num){
-    switch(num){
-        case 1: return "\033[1;34m"; // Blue
-        case 2: return "\033[1;35m"; // Magenta
-        case 3: return "\033[1;36m"; // Cyan
-        default: return "\033[1;37m"; // White (default)
+//Producers keep the dispatcher flooded with automation and telemetry jobs while one client sends an
+//interactive command every millisecond and waits for it. Run once with every job in one class, so
+//the client queues behind the flood, and once with priority classes.
+void benchmarkPriorityDispatch(){
+    const int workerCount = 4;
+    const int producerCount = 4;
+    const int deviceCount = 1000;
+    const long backlog = 20000; //producers hold off above this many queued jobs
+    const auto runFor = chrono::seconds(2);
+
+    vector<unique_ptr<Device>> local;
+    for(int i = 0; i < deviceCount; i++){
+        if(i % 2) local.push_back(make_unique<Light>("P" + to_string(i)));
+        else local.push_back(make_unique<Fridge>("P" + to_string(i)));
     }
-}
+    auto automationJob = [&](uint32_t r){
+        for(int k = 0; k < 8; k++){
+            Device* d = local[(r + k * 131) % deviceCount].get();
+            if(d->getKind() == DeviceKind::Light) d->post({CommandType::SetBrightness, 1 + (int)(r + k) % 3});
+            else d->post({CommandType::SetTemp, (int)((r + k) % 11) - 5});
+        }
+    };
+    atomic<long> readSum{0};
+    auto telemetryJob = [&](uint32_t r){
+        long sum = 0;
+        for(int k = 0; k < 64; k++) sum += local[(r + k) % deviceCount]->snapshot().temp;
+        readSum += sum;
+    };
 
-int getCh(int max){
-    int ch;
-    cin>>ch;
-    if(cin.fail() || (ch > max || ch < 0)){
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cout<<"Invalid input. Please choose between the numbers listed."<<endl;
-        return -1;
+    DispatchStats inter, autom[2], tele[2];
+    vector<double> roundTrip[2]; //client side, submit to done, in us
+    for(int mode = 0; mode < 2; mode++){
+        bool classes = (mode == 1);
+        CommandDispatcher disp(workerCount);
+        atomic<bool> running{true};
+        vector<thread> producers;
+        for(int t = 0; t < producerCount; t++){
+            producers.emplace_back([&, t](){
+                mt19937 rng(t);
+                while(running){
+                    if((long)disp.size() > backlog){
+                        this_thread::sleep_for(chrono::microseconds(200));
+                        continue;
+                    }
+                    uint32_t r = rng();
+                    if(r % 4) disp.submit(Priority::Automation, [&, r](){automationJob(r);});
+                    else disp.submit(classes ? Priority::Telemetry : Priority::Automation, [&, r](){telemetryJob(r);});
+                }
+            });
+        }
+        mt19937 rng(99);
+        auto end = chrono::steady_clock::now() + runFor;
+        while(chrono::steady_clock::now() < end){
+            Device* d = local[rng() % deviceCount].get();
+            auto t0 = chrono::steady_clock::now();
+            disp.run(classes ? Priority::Interactive : Priority::Automation, [d](){d->post({CommandType::Toggle});});
+            roundTrip[mode].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        running = false;
+        for(auto& th : producers) th.join();
+        disp.stop();
+        sort(roundTrip[mode].begin(), roundTrip[mode].end());
+        inter = disp.stats(Priority::Interactive);
+        autom[mode] = disp.stats(Priority::Automation);
+        tele[mode] = disp.stats(Priority::Telemetry);
     }
-    return ch;
-}
 
-void flagLock(TrackedMutex& mtx, string name){
-    lock_guard<recursive_mutex> lock(printMtx);
-    mtx.flagLock(name);
-    cout<<"\033[30m"<<mtx.getName()<<" locked by "<< mtx.getOwner()<<"!\033[0m"<<endl;
-    return;
+    cout<<workerCount<<" workers, "<<producerCount<<" producers keeping up to "<<backlog<<" jobs queued, "<<deviceCount<<" devices"<<endl;
+    double p99[2];
+    for(int mode = 0; mode < 2; mode++){
+        const vector<double>& rt = roundTrip[mode];
+        p99[mode] = rt[rt.size() * 99 / 100];
+        long background = autom[mode].done + tele[mode].done - (mode == 0 ? (long)rt.size() : 0);
+        cout<<(mode == 0 ? "One class:       " : "Priority classes:")<<" interactive p50 "<<(long)rt[rt.size() / 2]<<" us, p99 "<<(long)p99[mode]
+            <<" us, max "<<(long)rt.back()<<" us ("<<rt.size()<<" commands); background "<<background / runFor.count()<<" jobs/s"<<endl;
+    }
+    cout<<"Interactive time in the queue with classes: p50 "<<(long)inter.p50Us<<" us, p99 "<<(long)inter.p99Us
+        <<" us (the rest of the round trip is the thread wake-ups)"<<endl;
+    cout<<"Stolen: "<<autom[1].stolen + tele[1].stolen<<" background jobs; aged ahead: "<<autom[1].aged<<" automation, "<<tele[1].aged
+        <<" telemetry (telemetry done "<<tele[1].done<<", p99 wait "<<(long)tele[1].p99Us<<" us)"<<endl;
+    bool pass = p99[1] < p99[0] && tele[1].done > 0 && tele[1].maxUs < 1e6;
+    cout<<"Interactive p99 lower with classes, telemetry not starved: "<<(pass ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
 }
 
-void flagUnlock(TrackedMutex& mtx){
-    lock_guard<recursive_mutex> lock(printMtx);
-    mtx.flagUnlock();
-    cout<<"\033[90m"<<mtx.getName()<<" unlocked!\033[0m"<<endl;
-    return;
-}
\ No newline at end of file
+//1M devices and 1M users, looked up by ID and name from 8 threads while another thread keeps removing
+//and re-adding entries. Every hit must be the entry that was asked for. The old lookups walked every
+//slot, so they are timed on a few keys only.
+void benchmarkDirectories(){
+    const int entryCount = 1000000;
+    const int threadCount = 8;
+    const int scanLookups = 20;
+    const auto runFor = chrono::seconds(2);
+
+    DeviceRegistry reg;
+    UserTable table;
+    reg.reserve(entryCount);
+    table.reserve(entryCount);
+    auto t0 = chrono::steady_clock::now();
+    for(int i = 0; i < entryCount; i++){
+        if(i % 2 == 0) reg.add(new Fridge("D" + to_string(i)));
+        else reg.add(new Light("D" + to_string(i)));
+        table.add("U" + to_string(i));
+    }
+    double buildS = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    bool duplicatesRejected = !reg.add(new Fridge("D7")).valid() && !table.add("U7").valid();
+
+    //old way: every slot until the ID matches
+    mt19937 rng(5);
+    t0 = chrono::steady_clock::now();
+    long scanFound = 0;
+    for(int k = 0; k < scanLookups; k++){
+        string id = "D" + to_string(rng() % entryCount);
+        EpochGuard guard;
+        for(auto& h : reg.handles()){
+            Device* d = reg.get(h);
+            if(d && d->getId() == id){
+                scanFound++;
+                break;
+            }
+        }
+        string name = "U" + to_string(rng() % entryCount);
+        for(auto& u : table.list()){
+            if(u.second == name){
+                scanFound++;
+                break;
+            }
+        }
+    }
+    double scanUs = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count() / (2 * scanLookups);
+
+    atomic<bool> running{true};
+    atomic<long> lookups{0}, hits{0}, wrong{0};
+    vector<thread> threads;
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&, t](){
+            mt19937 rng(t);
+            long done = 0, found = 0, bad = 0;
+            while(running){
+                int i = rng() % entryCount;
+                string id = "D" + to_string(i);
+                {
+                    EpochGuard guard;
+                    Device* d = reg.get(reg.find(id));
+                    if(d){
+                        found++;
+                        if(d->getId() != id) bad++;
+                    }
+                }
+                string name = "U" + to_string(i);
+                UserId u = table.find(name);
+                if(u.valid()){
+                    string got = table.name(u);
+                    if(!got.empty()){
+                        found++;
+                        if(got != name) bad++;
+                    }
+                }
+                done += 2;
+            }
+            lookups += done;
+            hits += found;
+            wrong += bad;
+        });
+    }
+    long churned = 0;
+    thread churn([&](){
+        mt19937 rng(77);
+        while(running){
+            int i = rng() % entryCount;
+            string id = "D" + to_string(i);
+            if(reg.remove(reg.find(id))) reg.add(new Fridge(id));
+            string name = "U" + to_string(i);
+            if(table.remove(table.find(name))) table.add(name);
+            churned++;
+            this_thread::sleep_for(chrono::microseconds(20));
+        }
+    });
+    this_thread::sleep_for(runFor);
+    running = false;
+    for(auto& th : threads) th.join();
+    churn.join();
+    double hashUs = chrono::duration<double, micro>(runFor).count() / lookups.load(); //all threads together
+
+    //every live entry is in the directory under its own key, and nothing else is
+    EpochGuard guard;
+    size_t devicesIndexed = 0, usersIndexed = 0;
+    for(auto& h : reg.handles()){
+        Device* d = reg.get(h);
+        DeviceHandle f = reg.find(d->getId());
+        if(f.index == h.index && f.gen == h.gen) devicesIndexed++;
+    }
+    for(auto& u : table.list()){
+        UserId f = table.find(u.second);
+        if(f.index == u.first.index && f.gen == u.first.gen) usersIndexed++;
+    }
+    bool consistent = devicesIndexed == reg.size() && usersIndexed == table.size() && reg.size() == (size_t)entryCount
+        && table.size() == (size_t)entryCount && reg.find("nope").valid() == false;
+
+    cout<<entryCount<<" devices and "<<entryCount<<" users, built in "<<buildS<<" s"<<endl;
+    cout<<"Slot scan:  "<<scanUs<<" us per lookup ("<<scanFound<<" of "<<2 * scanLookups<<" found)"<<endl;
+    cout<<"Hash index: "<<hashUs<<" us per lookup, "<<(long)(lookups.load() / chrono::duration<double>(runFor).count())
+        <<" lookups/s from "<<threadCount<<" threads ("<<hits.load()<<" hits, "<<wrong.load()<<" wrong) while "
+        <<churned<<" devices and users were removed and re-added"<<endl;
+    cout<<"Speedup: "<<scanUs / hashUs<<"x"<<endl;
+    bool pass = wrong.load() == 0 && duplicatesRejected && consistent && scanUs > 100 * hashUs;
+    cout<<"No wrong hits, duplicates rejected, index matches the tables: "<<(pass ? "yes (PASS)" : "no (FAIL)")<<endl;
+    cout<<"===============================\n\n"<<endl;
+}